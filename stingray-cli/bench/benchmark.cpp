@@ -0,0 +1,154 @@
+#include "benchmark.h"
+
+#include "utility/perfTimer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+namespace {
+    // Note: Every checksum is written here, which the compiler has to assume
+    // is observed, so it cannot drop the computations leading to it
+    volatile double g_ChecksumSink = 0.0;
+
+    double median(std::vector<double> values) {
+        if (values.empty()) {
+            return 0.0;
+        }
+
+        const size_t middle = values.size() / 2;
+        std::nth_element(values.begin(), values.begin() + middle, values.end());
+
+        if (values.size() % 2 != 0) {
+            return values[middle];
+        }
+
+        const double upper = values[middle];
+        const double lower = *std::max_element(values.begin(), values.begin() + middle);
+
+        return 0.5 * (lower + upper);
+    }
+
+    std::string getThroughputUnit(const std::string& unit) {
+        return "M" + unit + "s/s";
+    }
+
+    BenchmarkRun timeRun(const BenchmarkFunc& func, uint64_t iterations, double* const elapsed) {
+        PerfTimer timer{};
+        timer.begin();
+        const BenchmarkRun run = func(iterations);
+        timer.end();
+
+        g_ChecksumSink = g_ChecksumSink + run.checksum;
+        *elapsed = timer.getElapsedTime();
+
+        return run;
+    }
+}
+
+bool BenchmarkRunner::isSelected(const std::string& name) const {
+    return m_Settings.filter.empty() || name.find(m_Settings.filter) != std::string::npos;
+}
+
+bool BenchmarkRunner::run(const std::string& name, const std::string& unit, const BenchmarkFunc& func) {
+    if (!isSelected(name)) {
+        return false;
+    }
+
+    // Calibrate the iteration count, which also warms up caches and the
+    // branch predictors along the way
+    uint64_t iterations = 1;
+    double elapsed = 0.0;
+    timeRun(func, iterations, &elapsed);
+
+    while (elapsed < m_Settings.minRunTime) {
+        const double scale = (elapsed > 0.0) ? m_Settings.minRunTime / elapsed : 10.0;
+        iterations = (uint64_t)(iterations * std::clamp(1.2 * scale, 2.0, 10.0));
+        timeRun(func, iterations, &elapsed);
+    }
+
+    for (int i = 0; i < m_Settings.warmupRuns; ++i) {
+        timeRun(func, iterations, &elapsed);
+    }
+
+    BenchmarkResult result{};
+    result.name = name;
+    result.unit = unit;
+    result.iterations = iterations;
+
+    std::vector<double> timesNs(m_Settings.repetitions);
+
+    for (int i = 0; i < m_Settings.repetitions; ++i) {
+        const BenchmarkRun run = timeRun(func, iterations, &elapsed);
+
+        timesNs[i] = elapsed * 1e6 / (double)std::max<uint64_t>(run.operations, 1);
+        result.operations = run.operations;
+        result.checksum = run.checksum;
+    }
+
+    result.medianNs = median(timesNs);
+    result.minNs = *std::min_element(timesNs.begin(), timesNs.end());
+
+    std::vector<double> deviations(timesNs.size());
+
+    for (size_t i = 0; i < timesNs.size(); ++i) {
+        deviations[i] = fabs(timesNs[i] - result.medianNs);
+    }
+
+    result.madNs = median(deviations);
+
+    std::cout << std::left << std::setw(36) << name << std::right << std::fixed << std::setprecision(2)
+        << std::setw(14) << result.medianNs << " ns/op +- " << std::setw(5) << std::setprecision(1)
+        << (result.medianNs > 0.0 ? 100.0 * result.madNs / result.medianNs : 0.0) << "%"
+        << std::setw(12) << std::setprecision(2) << result.getThroughput() << ' ' << getThroughputUnit(unit) << '\n';
+    std::cout.unsetf(std::ios::floatfield);
+
+    m_Results.push_back(result);
+
+    return true;
+}
+
+bool BenchmarkRunner::writeJSON(const std::string& path, const std::vector<std::pair<std::string, std::string>>& context) const {
+    std::ofstream file(path);
+
+    if (!file) {
+        return false;
+    }
+
+    file << std::setprecision(9);
+    file << "{\n";
+    file << "  \"context\": {\n";
+
+    for (const auto& [key, value] : context) {
+        file << "    \"" << key << "\": \"" << value << "\",\n";
+    }
+
+    file << "    \"warmupRuns\": " << m_Settings.warmupRuns << ",\n";
+    file << "    \"repetitions\": " << m_Settings.repetitions << ",\n";
+    file << "    \"minRunTimeMs\": " << m_Settings.minRunTime << "\n";
+    file << "  },\n";
+    file << "  \"benchmarks\": [";
+
+    for (size_t i = 0; i < m_Results.size(); ++i) {
+        const BenchmarkResult& result = m_Results[i];
+
+        file << (i > 0 ? "," : "") << "\n    {\n";
+        file << "      \"name\": \"" << result.name << "\",\n";
+        file << "      \"unit\": \"" << result.unit << "\",\n";
+        file << "      \"iterations\": " << result.iterations << ",\n";
+        file << "      \"operations\": " << result.operations << ",\n";
+        file << "      \"medianNsPerOp\": " << result.medianNs << ",\n";
+        file << "      \"madNsPerOp\": " << result.madNs << ",\n";
+        file << "      \"minNsPerOp\": " << result.minNs << ",\n";
+        file << "      \"throughput\": " << result.getThroughput() << ",\n";
+        file << "      \"throughputUnit\": \"" << getThroughputUnit(result.unit) << "\",\n";
+        file << "      \"checksum\": " << result.checksum << "\n";
+        file << "    }";
+    }
+
+    file << "\n  ]\n}\n";
+
+    return (bool)file;
+}
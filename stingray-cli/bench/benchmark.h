@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct BenchmarkSettings {
+    int warmupRuns = 3;
+    int repetitions = 15;
+    double minRunTime = 20.0; // Note: Milliseconds, the iteration count of a run is calibrated to reach it
+    std::string filter = ""; // Note: Only benchmarks whose name contains it are run
+};
+
+// Note: Result of a single timed run. Most benchmarks perform exactly one
+// operation per iteration, but e.g. a render counts the rays it traced
+struct BenchmarkRun {
+    uint64_t operations = 0;
+    double checksum = 0.0;
+};
+
+// Note: Performs the given number of iterations and returns how many
+// operations they were, plus a checksum of the results. The checksum is
+// stored, so that the compiler cannot optimize the measured work away, and
+// changes whenever the benchmarked code starts computing different results
+using BenchmarkFunc = std::function<BenchmarkRun(uint64_t iterations)>;
+
+struct BenchmarkResult {
+    std::string name;
+    std::string unit; // Note: What a single operation is, e.g. "ray"
+    uint64_t iterations = 0; // Note: Per repetition
+    uint64_t operations = 0; // Note: Of the last repetition
+    double medianNs = 0.0; // Note: Per operation over all repetitions
+    double madNs = 0.0; // Note: Median absolute deviation from medianNs
+    double minNs = 0.0;
+    double checksum = 0.0;
+
+    // Note: Millions of operations per second at the median time
+    inline double getThroughput() const { return medianNs > 0.0 ? 1000.0 / medianNs : 0.0; }
+};
+
+// Note: Runs benchmarks with a fixed protocol. The iteration count of a run
+// is doubled until a run takes at least minRunTime, then the warmup runs are
+// discarded and the time per operation of every repetition is recorded.
+// Median and median absolute deviation are reported rather than mean and
+// standard deviation, as they are not skewed by the occasional slow run
+// when the OS preempts the benchmark
+class BenchmarkRunner {
+public:
+    BenchmarkRunner(const BenchmarkSettings& settings) : m_Settings(settings) {}
+    ~BenchmarkRunner() = default;
+
+    // Note: Prints the result as soon as it is done. Returns false and runs
+    // nothing if the filter excludes the benchmark
+    bool run(const std::string& name, const std::string& unit, const BenchmarkFunc& func);
+
+    // Note: Whether the filter lets the benchmark run, so that expensive
+    // setup such as building a large scene can be skipped
+    bool isSelected(const std::string& name) const;
+
+    // Note: Writes the settings and all results so far to a JSON file, the
+    // context holds additional string pairs such as the CPU features
+    bool writeJSON(const std::string& path, const std::vector<std::pair<std::string, std::string>>& context) const;
+
+    inline const std::vector<BenchmarkResult>& getResults() const { return m_Results; }
+
+private:
+    BenchmarkSettings m_Settings{};
+    std::vector<BenchmarkResult> m_Results;
+};
@@ -0,0 +1,644 @@
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "vendor/stb_image_write.h"
+
+#include "benchmark.h"
+#include "camera.h"
+#include "material.h"
+#include "sampler.h"
+#include "scene.h"
+#include "sphere.h"
+#include "sphereSoA.h"
+#include "math/sray_math.h"
+#include "utility/cpuFeatures.h"
+#include "utility/threadPool.h"
+
+struct Settings {
+    BenchmarkSettings benchmark{};
+    int numThreads = 1;
+    std::vector<int> sceneSizes = { 100, 10000, 1000000 }; // Note: Random sphere counts of the Scene::hit benchmarks
+    int renderWidth = 320;
+    int renderHeight = 180;
+    int renderSamples = 16;
+    std::string jsonPath = "bench.json";
+    bool verify = false; // Note: Runs the correctness checks instead of the benchmarks
+};
+
+// Note: All argument params either support 1 or 0 input entries
+// in this implementation
+const std::unordered_map<std::string, bool> argParamsAcceptInput = {
+    { "-t", true },
+    { "-n", true },
+    { "-spp", true },
+    { "-warmup", true },
+    { "-reps", true },
+    { "-mintime", true },
+    { "-filter", true },
+    { "-json", true },
+    { "-verify", false }
+};
+
+std::vector<int> parseIntList(const std::string& list) {
+    std::vector<int> values;
+    size_t begin = 0;
+
+    while (begin <= list.size()) {
+        const size_t end = std::min(list.find(',', begin), list.size());
+        values.push_back(std::stoi(list.substr(begin, end - begin)));
+        begin = end + 1;
+    }
+
+    return values;
+}
+
+void parseArgsToSettings(int argc, char* argv[], Settings& settings) {
+    const std::vector<std::string> args(argv + 1, argv + argc);
+
+    if (argc > 32) {
+        throw std::runtime_error("INPUT ERROR: Too many input arguments!");
+    }
+
+    int currArgParamCounter = 0;
+    std::string currArg = "";
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (currArgParamCounter > 0) {
+            currArgParamCounter--;
+        }
+
+        auto search = argParamsAcceptInput.find(args[i]);
+
+        if (search == argParamsAcceptInput.end() && currArg == "") {
+            throw std::runtime_error("INPUT ERROR: Unknown argument " + args[i] + "!");
+        }
+
+        if (currArg == "") {
+            currArg = search->first;
+
+            if (search->second) {
+                currArgParamCounter = 1;
+            }
+        }
+
+        if (currArg == "-t" && currArgParamCounter == 0) {
+            settings.numThreads = std::stoi(args[i]);
+            std::cout << "Setting thread count to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-n" && currArgParamCounter == 0) {
+            settings.sceneSizes = parseIntList(args[i]);
+
+            for (int size : settings.sceneSizes) {
+                if (size < 0) {
+                    throw std::runtime_error("INPUT ERROR: Sphere counts must not be negative!");
+                }
+            }
+
+            std::cout << "Setting scene sphere counts to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-spp" && currArgParamCounter == 0) {
+            settings.renderSamples = std::stoi(args[i]);
+
+            if (settings.renderSamples <= 0) {
+                throw std::runtime_error("INPUT ERROR: Samples per pixel must be positive!");
+            }
+
+            std::cout << "Setting render samples per pixel to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-warmup" && currArgParamCounter == 0) {
+            settings.benchmark.warmupRuns = std::stoi(args[i]);
+
+            if (settings.benchmark.warmupRuns < 0) {
+                throw std::runtime_error("INPUT ERROR: Warmup run count must not be negative!");
+            }
+
+            std::cout << "Setting warmup runs to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-reps" && currArgParamCounter == 0) {
+            settings.benchmark.repetitions = std::stoi(args[i]);
+
+            if (settings.benchmark.repetitions <= 0) {
+                throw std::runtime_error("INPUT ERROR: Repetition count must be positive!");
+            }
+
+            std::cout << "Setting repetitions to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-mintime" && currArgParamCounter == 0) {
+            settings.benchmark.minRunTime = std::stod(args[i]);
+
+            if (settings.benchmark.minRunTime < 0.0) {
+                throw std::runtime_error("INPUT ERROR: Minimum run time must not be negative!");
+            }
+
+            std::cout << "Setting minimum run time to: " << args[i] << " ms\n";
+
+            currArg = "";
+        }
+        else if (currArg == "-filter" && currArgParamCounter == 0) {
+            settings.benchmark.filter = args[i];
+            std::cout << "Only running benchmarks containing: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-json" && currArgParamCounter == 0) {
+            settings.jsonPath = args[i];
+            std::cout << "Writing results to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-verify") {
+            settings.verify = true;
+            std::cout << "Running correctness checks instead of benchmarks\n";
+
+            currArg = "";
+        }
+    }
+
+    if (currArgParamCounter != 0) {
+        std::cout << "Args missing\n";
+    }
+}
+
+// Note: Inputs are generated up front and cycled through, so that the
+// benchmarks measure the code under test rather than the random number
+// generator. The count is a power of two to wrap with a mask
+constexpr uint32_t InputCount = 4096;
+constexpr uint32_t InputMask = InputCount - 1;
+
+std::vector<Vec2> makeUniformInputs(RandomStream* rng) {
+    std::vector<Vec2> inputs(InputCount);
+
+    for (Vec2& u : inputs) {
+        u = { randomFloat(rng), randomFloat(rng) };
+    }
+
+    return inputs;
+}
+
+// Note: Rays from a shell around a box of the given half size towards random
+// points inside of it, so that about half of them hit a sphere of that radius
+std::vector<Ray> makeRaysTowardsBox(float halfSize, RandomStream* rng) {
+    std::vector<Ray> rays(InputCount);
+
+    for (Ray& ray : rays) {
+        const Vec3 origin = 4.0f * halfSize * sampleUnitSphere({ randomFloat(rng), randomFloat(rng) });
+        const Vec3 target = {
+            randomFloat(-halfSize, halfSize, rng),
+            randomFloat(-halfSize, halfSize, rng),
+            randomFloat(-halfSize, halfSize, rng)
+        };
+
+        ray = { origin, normalize(target - origin) };
+    }
+
+    return rays;
+}
+
+// Note: The scene of stingray-cli, three large spheres on a ground sphere
+// surrounded by random small ones, with a spread that keeps the density of
+// the 100 sphere scene for any count
+struct SphereScene {
+    Scene scene{};
+    SphereSoA spheres{};
+    std::unique_ptr<Sphere> ground;
+    std::unique_ptr<Sphere> center;
+    std::unique_ptr<Sphere> left;
+    std::unique_ptr<Sphere> right;
+    float spread = 0.0f;
+
+    SphereScene(int numSpheres, ThreadPool* const threadPool) {
+        const MaterialId materialGround = scene.materials.add(DiffuseMaterial({ 0.3f, 0.3f, 0.3f }));
+        const MaterialId materialCenter = scene.materials.add(DiffuseMaterial({ 0.4f, 0.2f, 0.1f }));
+        const MaterialId materialLeft = scene.materials.add(DielectricMaterial(1.5f));
+        const MaterialId materialRight = scene.materials.add(MetalMaterial({ 0.7f, 0.6f, 0.5f }, 0.0f));
+
+        ground = std::make_unique<Sphere>(Vec3{ 0.0f, -1000.0f, 0.0f }, 1000.0f, materialGround);
+        center = std::make_unique<Sphere>(Vec3{ -4.0f, 1.0f, 0.0f }, 1.0f, materialCenter);
+        left = std::make_unique<Sphere>(Vec3{ 0.0f, 1.0f, 0.0f }, 1.0f, materialLeft);
+        right = std::make_unique<Sphere>(Vec3{ 4.0f, 1.0f, 0.0f }, 1.0f, materialRight);
+
+        scene.add(ground.get());
+        scene.add(center.get());
+        scene.add(left.get());
+        scene.add(right.get());
+
+        spread = getSpread(numSpheres);
+        spheres.reserve(numSpheres);
+        scene.materials.reserve(scene.materials.size() + numSpheres);
+
+        RandomStream sceneRandom(123456789);
+
+        for (int i = 0; i < numSpheres; ++i) {
+            const MaterialId material = scene.materials.add(
+                DiffuseMaterial({ randomFloat(&sceneRandom), randomFloat(&sceneRandom), randomFloat(&sceneRandom) }));
+
+            const Vec3 p = { randomFloat(-spread, spread, &sceneRandom), 0.2f, randomFloat(-spread, spread, &sceneRandom) };
+            spheres.add(p, 0.2f, material);
+        }
+
+        if (numSpheres > 0) {
+            scene.add(&spheres);
+        }
+
+        scene.bvhSettings.threadPool = threadPool;
+        scene.build();
+    }
+
+    SphereScene(const SphereScene&) = delete;
+    SphereScene& operator=(const SphereScene&) = delete;
+
+    static float getSpread(int numSpheres) {
+        return 7.0f * sqrtf(numSpheres / 100.0f);
+    }
+};
+
+// Note: Axis-aligned rays through a grid of boxes, with every other
+// direction component +0 or -0, must find the same primitives in every BVH
+// width. Their origins lie inside the slabs of the zero components, where
+// a near and far plane selected from the wrong sign miss every box. Run
+// with -verify, so that a traversal that silently skips hits is caught
+// before its timings are trusted
+void checkAxisAlignedRays() {
+    constexpr int GridSize = 8;
+    std::vector<AABB> boxes;
+
+    for (int x = 0; x < GridSize; ++x) {
+        for (int y = 0; y < GridSize; ++y) {
+            for (int z = 0; z < GridSize; ++z) {
+                const Vec3 corner = { (float)x, (float)y, (float)z };
+                boxes.push_back({ corner, corner + Vec3{ 0.9f, 0.9f, 0.9f } });
+            }
+        }
+    }
+
+    const BVHType types[] = { BVHType::BVH2, BVHType::BVH4, BVHType::BVH8 };
+    AccelerationStructure accels[3];
+
+    for (int i = 0; i < 3; ++i) {
+        BVHSettings bvhSettings{};
+        bvhSettings.type = types[i];
+        accels[i].build(boxes, bvhSettings);
+    }
+
+    const auto countPrims = [](const AccelerationStructure& accel, const Ray& ray) {
+        uint32_t count = 0;
+
+        accel.intersect(ray, 0.0f, Infinity, [&](uint32_t first, uint32_t primCount, float& closestT) {
+            count += primCount;
+            return false;
+        });
+
+        return count;
+    };
+
+    int rayCount = 0;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        for (float sign : { 1.0f, -1.0f }) {
+            for (float zero : { 0.0f, -0.0f }) {
+                Vec3 dir = { zero, zero, zero };
+                dir[axis] = sign;
+
+                Vec3 origin = { 0.45f, 2.45f, 4.45f };
+                origin[axis] = (sign > 0.0f) ? -1.0f : GridSize + 1.0f;
+
+                const Ray ray = { origin, dir };
+                const uint32_t expected = countPrims(accels[0], ray);
+
+                for (int i = 1; i < 3; ++i) {
+                    if (countPrims(accels[i], ray) != expected) {
+                        throw std::runtime_error("CHECK ERROR: BVH" + std::to_string(accels[i].getActiveWidth())
+                            + " misses boxes on an axis-aligned ray found by BVH2!");
+                    }
+                }
+
+                ++rayCount;
+            }
+        }
+    }
+
+    std::cout << "Checked " << rayCount << " axis-aligned rays against every BVH width\n";
+}
+
+void setupCamera(Camera& camera, int samplesPerPixel) {
+    camera.maxDepth = 50;
+    camera.position = { 13.0f, 2.0f, 3.0f };
+    camera.lookAt = { 0.0f, 0.0f, 0.0f };
+    camera.up = { 0.0f, 1.0f, 0.0f };
+    camera.verticalFOV = toRadians(20.0f);
+    camera.focusDistance = 10.0f;
+    camera.samplesPerPixel = samplesPerPixel;
+}
+
+void benchmarkSphereIntersection(BenchmarkRunner& runner, RandomStream* rng) {
+    const std::vector<Ray> rays = makeRaysTowardsBox(1.0f, rng);
+    const Sphere sphere({ 0.0f, 0.0f, 0.0f }, 1.0f, 0);
+
+    runner.run("sphere/intersect", "ray", [&](uint64_t iterations) {
+        double checksum = 0.0;
+
+        for (uint64_t i = 0; i < iterations; ++i) {
+            HitRecord record{};
+
+            if (sphere.intersect(rays[i & InputMask], 0.001f, Infinity, &record)) {
+                checksum += record.t;
+            }
+        }
+
+        return BenchmarkRun{ iterations, checksum };
+    });
+
+    runner.run("sphere/occluded", "ray", [&](uint64_t iterations) {
+        double checksum = 0.0;
+
+        for (uint64_t i = 0; i < iterations; ++i) {
+            checksum += sphere.occluded(rays[i & InputMask], 0.001f, Infinity) ? 1.0 : 0.0;
+        }
+
+        return BenchmarkRun{ iterations, checksum };
+    });
+
+    // Note: A single leaf of eight spheres, i.e. one pass of the AVX2 kernel
+    // where available
+    SphereSoA leaf{};
+
+    for (int i = 0; i < 8; ++i) {
+        leaf.add({ (i & 1) ? 0.5f : -0.5f, (i & 2) ? 0.5f : -0.5f, (i & 4) ? 0.5f : -0.5f }, 0.4f, 0);
+    }
+
+    leaf.build({});
+
+    runner.run("sphereSoA/intersectRange8", "ray", [&](uint64_t iterations) {
+        double checksum = 0.0;
+
+        for (uint64_t i = 0; i < iterations; ++i) {
+            uint32_t slot = 0;
+            float t = 0.0f;
+
+            if (leaf.intersectRange(rays[i & InputMask], 0, 8, 0.001f, Infinity, &slot, &t)) {
+                checksum += t + slot;
+            }
+        }
+
+        return BenchmarkRun{ iterations, checksum };
+    });
+}
+
+void benchmarkSceneHit(BenchmarkRunner& runner, int numSpheres, ThreadPool* const threadPool, RandomStream* rng) {
+    const std::string hitName = "scene/hit/n=" + std::to_string(numSpheres);
+    const std::string occludedName = "scene/occluded/n=" + std::to_string(numSpheres);
+    const float extent = fmaxf(SphereScene::getSpread(numSpheres), 4.0f);
+
+    // Note: Incoherent rays from above the spheres down to random points
+    // on the ground, like the bounces of a path tracer. They are generated
+    // even when the filter skips the scene, so that the inputs of the
+    // following benchmarks do not depend on the filter
+    std::vector<Ray> rays(InputCount);
+
+    for (Ray& ray : rays) {
+        const Vec3 origin = { randomFloat(-extent, extent, rng), randomFloat(0.5f, 3.0f, rng), randomFloat(-extent, extent, rng) };
+        const Vec3 target = { randomFloat(-extent, extent, rng), 0.0f, randomFloat(-extent, extent, rng) };
+
+        ray = { origin, target - origin };
+    }
+
+    if (!runner.isSelected(hitName) && !runner.isSelected(occludedName)) {
+        return;
+    }
+
+    const SphereScene sphereScene(numSpheres, threadPool);
+
+    runner.run(hitName, "ray", [&](uint64_t iterations) {
+        double checksum = 0.0;
+
+        for (uint64_t i = 0; i < iterations; ++i) {
+            HitData hit{};
+
+            if (sphereScene.scene.hit(rays[i & InputMask], 0.001f, Infinity, &hit)) {
+                checksum += hit.t;
+            }
+        }
+
+        return BenchmarkRun{ iterations, checksum };
+    });
+
+    runner.run(occludedName, "ray", [&](uint64_t iterations) {
+        double checksum = 0.0;
+
+        for (uint64_t i = 0; i < iterations; ++i) {
+            checksum += sphereScene.scene.occluded(rays[i & InputMask], 0.001f, 0.999f) ? 1.0 : 0.0;
+        }
+
+        return BenchmarkRun{ iterations, checksum };
+    });
+}
+
+void benchmarkSampling(BenchmarkRunner& runner, RandomStream* rng) {
+    const std::vector<Vec2> inputs = makeUniformInputs(rng);
+    const Vec3 normal = normalize(Vec3{ 0.3f, 1.0f, -0.2f });
+
+    runner.run("sampling/sampleUnitSphere", "sample", [&](uint64_t iterations) {
+        Vec3 sum{};
+
+        for (uint64_t i = 0; i < iterations; ++i) {
+            sum += sampleUnitSphere(inputs[i & InputMask]);
+        }
+
+        return BenchmarkRun{ iterations, (double)(sum.x + sum.y + sum.z) };
+    });
+
+    runner.run("sampling/sampleHemisphere", "sample", [&](uint64_t iterations) {
+        Vec3 sum{};
+
+        for (uint64_t i = 0; i < iterations; ++i) {
+            sum += sampleHemisphere(normal, inputs[i & InputMask]);
+        }
+
+        return BenchmarkRun{ iterations, (double)(sum.x + sum.y + sum.z) };
+    });
+
+    runner.run("sampling/sampleUnitDisk", "sample", [&](uint64_t iterations) {
+        Vec3 sum{};
+
+        for (uint64_t i = 0; i < iterations; ++i) {
+            sum += sampleUnitDisk(inputs[i & InputMask]);
+        }
+
+        return BenchmarkRun{ iterations, (double)(sum.x + sum.y + sum.z) };
+    });
+
+    runner.run("sampling/randomFloat", "sample", [&](uint64_t iterations) {
+        RandomStream stream(1234u);
+        double sum = 0.0;
+
+        for (uint64_t i = 0; i < iterations; ++i) {
+            sum += randomFloat(&stream);
+        }
+
+        return BenchmarkRun{ iterations, sum };
+    });
+}
+
+void benchmarkScatter(BenchmarkRunner& runner, RandomStream* rng) {
+    // Note: Hits on a unit sphere seen from random directions, half of them
+    // from the inside so that the dielectric refracts both ways
+    struct ScatterInput {
+        Ray ray;
+        HitData hit;
+    };
+
+    std::vector<ScatterInput> inputs(InputCount);
+
+    for (uint32_t i = 0; i < InputCount; ++i) {
+        ScatterInput& input = inputs[i];
+        const Vec3 position = sampleUnitSphere({ randomFloat(rng), randomFloat(rng) });
+        const Vec3 direction = sampleHemisphere(-position, { randomFloat(rng), randomFloat(rng) });
+
+        input.ray = { position - direction, direction };
+        input.hit.position = position;
+        input.hit.t = 1.0f;
+        input.hit.setNormal(input.ray, (i & 1) ? position : -position);
+    }
+
+    const Material materials[] = {
+        DiffuseMaterial({ 0.5f, 0.5f, 0.5f }),
+        MetalMaterial({ 0.7f, 0.6f, 0.5f }, 0.3f),
+        DielectricMaterial(1.5f)
+    };
+    const char* const materialNames[] = { "diffuse", "metal", "dielectric" };
+
+    for (int m = 0; m < 3; ++m) {
+        const Material& material = materials[m];
+
+        runner.run(std::string("material/scatter/") + materialNames[m], "scatter", [&](uint64_t iterations) {
+            Sampler sampler(SamplerType::RANDOM, 0, 0, 0, 0);
+            Vec3 sum{};
+
+            for (uint64_t i = 0; i < iterations; ++i) {
+                const ScatterInput& input = inputs[i & InputMask];
+                Vec3 attenuation{};
+                Ray scattered{};
+
+                if (material.scatter(input.ray, input.hit, &attenuation, &scattered, &sampler)) {
+                    sum += scattered.dir;
+                }
+            }
+
+            return BenchmarkRun{ iterations, (double)(sum.x + sum.y + sum.z) };
+        });
+    }
+}
+
+void benchmarkRender(BenchmarkRunner& runner, const Settings& settings, ThreadPool& threadPool) {
+    const std::string renderName = "render/spheres/spp=" + std::to_string(settings.renderSamples);
+
+    // Note: The PNG encoder benchmark encodes a render of the scene too
+    if (!runner.isSelected(renderName) && !runner.isSelected("png/encode")) {
+        return;
+    }
+
+    const SphereScene sphereScene(100, &threadPool);
+    Camera camera(settings.renderWidth, settings.renderHeight);
+    setupCamera(camera, settings.renderSamples);
+
+    std::vector<uint32_t> pixels(settings.renderWidth * settings.renderHeight);
+
+    // Note: Counts all rays traced, including shadow rays, like stingray-cli
+    runner.run(renderName, "ray", [&](uint64_t iterations) {
+        uint64_t rays = 0;
+        double checksum = 0.0;
+
+        for (uint64_t i = 0; i < iterations; ++i) {
+            camera.render(sphereScene.scene, pixels.data(), threadPool);
+
+            const RenderStats& stats = camera.getStats();
+            rays += stats.primaryRays + stats.secondaryRays + stats.occlusionRays;
+            checksum += pixels[pixels.size() / 2] & 0xffffff;
+        }
+
+        return BenchmarkRun{ rays, checksum };
+    });
+
+    // Note: Encodes a render of the same scene, since noise and gradients
+    // compress very differently from synthetic test patterns
+    camera.samplesPerPixel = 4;
+    camera.render(sphereScene.scene, pixels.data(), threadPool);
+
+    runner.run("png/encode", "pixel", [&](uint64_t iterations) {
+        uint64_t bytes = 0;
+
+        const auto countBytes = [](void* context, void* data, int size) {
+            *(uint64_t*)context += (uint64_t)size;
+        };
+
+        for (uint64_t i = 0; i < iterations; ++i) {
+            stbi_write_png_to_func(countBytes, &bytes, settings.renderWidth, settings.renderHeight, 4,
+                pixels.data(), settings.renderWidth * 4);
+        }
+
+        return BenchmarkRun{ iterations * pixels.size(), (double)bytes };
+    });
+}
+
+int main(int argc, char* argv[]) {
+    // Note: Not aggregate initialized, for which GCC 12 falsely warns at -O3
+    // that the benchmark filter may be used uninitialized. The member
+    // initializers still apply
+    Settings settings;
+    settings.numThreads = std::thread::hardware_concurrency();
+
+    parseArgsToSettings(argc, argv, settings);
+
+    if (settings.verify) {
+        checkAxisAlignedRays();
+        return 0;
+    }
+
+    ThreadPool threadPool(settings.numThreads);
+    BenchmarkRunner runner(settings.benchmark);
+    RandomStream inputRandom(987654321);
+
+    benchmarkSphereIntersection(runner, &inputRandom);
+
+    for (int numSpheres : settings.sceneSizes) {
+        benchmarkSceneHit(runner, numSpheres, &threadPool, &inputRandom);
+    }
+
+    benchmarkSampling(runner, &inputRandom);
+    benchmarkScatter(runner, &inputRandom);
+    benchmarkRender(runner, settings, threadPool);
+
+    const CPUFeatures& features = getCPUFeatures();
+    const std::vector<std::pair<std::string, std::string>> context = {
+        { "threads", std::to_string(settings.numThreads) },
+        { "sse41", features.sse41 ? "true" : "false" },
+        { "avx2", features.avx2 ? "true" : "false" },
+        { "renderSize", std::to_string(settings.renderWidth) + "x" + std::to_string(settings.renderHeight) }
+    };
+
+    if (!runner.writeJSON(settings.jsonPath, context)) {
+        throw std::runtime_error("OUTPUT ERROR: Could not write " + settings.jsonPath + "!");
+    }
+
+    std::cout << "Wrote " << runner.getResults().size() << " results to " << settings.jsonPath << '\n';
+
+    return 0;
+}
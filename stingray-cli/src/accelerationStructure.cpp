@@ -0,0 +1,114 @@
+#include "accelerationStructure.h"
+
+namespace {
+    BVHType resolveBVHType(BVHType requested) {
+        const CPUFeatures& features = getCPUFeatures();
+
+        if (requested == BVHType::AUTO) {
+            requested = BVHType::BVH8;
+        }
+
+        if (requested == BVHType::BVH8 && !features.avx2) {
+            requested = BVHType::BVH4;
+        }
+
+        if (requested == BVHType::BVH4 && !features.sse41) {
+            requested = BVHType::BVH2;
+        }
+
+        return requested;
+    }
+}
+
+void AccelerationStructure::build(const std::vector<AABB>& primBounds, const BVHSettings& settings) {
+    m_BVH.build(primBounds, settings.builder, settings.threadPool);
+
+    m_ActiveType = resolveBVHType(settings.type);
+    m_Traversal = settings.traversal;
+    m_BVH4 = {};
+    m_BVH8 = {};
+    m_MotionBVH = {};
+    m_HasMotion = false;
+
+    if (m_ActiveType == BVHType::BVH4) {
+        m_BVH4.build(m_BVH);
+    }
+    else if (m_ActiveType == BVHType::BVH8) {
+        m_BVH8.build(m_BVH);
+    }
+
+    m_BuildSAHCost = m_BVH.computeAbsoluteSAHCost();
+    m_SAHCost = m_BuildSAHCost;
+}
+
+void AccelerationStructure::build(
+    const std::vector<AABB>& startBounds,
+    const std::vector<AABB>& endBounds,
+    const BVHSettings& settings) {
+
+    // Note: The topology comes from the bounds of the whole motion, which
+    // keeps primitives that end up close together in the same subtrees
+    std::vector<AABB> motionBounds = startBounds;
+
+    for (size_t i = 0; i < motionBounds.size(); ++i) {
+        motionBounds[i].grow(endBounds[i]);
+    }
+
+    m_BVH.build(motionBounds, settings.builder, settings.threadPool);
+
+    const std::vector<uint32_t>& primIndices = m_BVH.getPrimIndices();
+    std::vector<AABB> startSlotBounds(primIndices.size());
+    std::vector<AABB> endSlotBounds(primIndices.size());
+
+    for (size_t slot = 0; slot < primIndices.size(); ++slot) {
+        startSlotBounds[slot] = startBounds[primIndices[slot]];
+        endSlotBounds[slot] = endBounds[primIndices[slot]];
+    }
+
+    m_MotionBVH.build(m_BVH, startSlotBounds, endSlotBounds);
+    m_HasMotion = true;
+    m_ActiveType = BVHType::BVH2;
+    m_Traversal = BVHTraversal::STACK;
+    m_BVH4 = {};
+    m_BVH8 = {};
+
+    m_BuildSAHCost = m_BVH.computeAbsoluteSAHCost();
+    m_SAHCost = m_BuildSAHCost;
+}
+
+bool AccelerationStructure::refit(const std::vector<AABB>& slotBounds, const BVHSettings& settings) {
+    if (m_HasMotion) {
+        return true;
+    }
+
+    m_BVH.refit(slotBounds, settings.threadPool);
+
+    if (m_ActiveType == BVHType::BVH4) {
+        m_BVH4.refit(m_BVH);
+    }
+    else if (m_ActiveType == BVHType::BVH8) {
+        m_BVH8.refit(m_BVH);
+    }
+
+    m_SAHCost = m_BVH.computeAbsoluteSAHCost();
+
+    return m_SAHCost > m_BuildSAHCost * (1.0f + settings.rebuildThreshold);
+}
+
+AABB AccelerationStructure::getBounds() const {
+    if (m_BVH.isEmpty()) {
+        return {};
+    }
+
+    const BVHNode& root = m_BVH.getNodes()[0];
+
+    return { root.boundsMin, root.boundsMax };
+}
+
+AABB AccelerationStructure::getBoundsAt(float time) const {
+    if (!m_HasMotion || m_MotionBVH.isEmpty()) {
+        return getBounds();
+    }
+
+    return m_MotionBVH.getNodes()[0].boundsAt(time);
+}
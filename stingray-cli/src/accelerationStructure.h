@@ -0,0 +1,178 @@
+#pragma once
+
+#include "bvh.h"
+#include "motionBvh.h"
+#include "wideBvh.h"
+
+#include <vector>
+
+enum class BVHType : uint8_t {
+    AUTO, // Note: Widest BVH supported by the host CPU
+    BVH2,
+    BVH4, // Note: Requires SSE4.1
+    BVH8 // Note: Requires AVX2
+};
+
+struct BVHSettings {
+    BVHType type = BVHType::AUTO;
+    BVHTraversal traversal = BVHTraversal::STACK; // Note: Only affects BVH2
+    BVHBuilder builder = BVHBuilder::SAH;
+    ThreadPool* threadPool = nullptr; // Note: Builds in parallel when set
+
+    // Note: Relative SAH cost increase over the last build past which
+    // refitting owners rebuild instead
+    float rebuildThreshold = 0.3f;
+};
+
+// Note: Owns the binary BVH over a set of primitives, plus the wide BVH
+// collapsed from it when the requested type and the host CPU allow it. Used
+// by everything that needs to find primitives along a ray, i.e. the scene
+// itself and primitive containers such as SphereSoA
+class AccelerationStructure {
+public:
+    AccelerationStructure() = default;
+    ~AccelerationStructure() = default;
+
+    // Note: Primitives must be reordered by their owner to match
+    // getPrimIndices() after building, see BVH
+    void build(const std::vector<AABB>& primBounds, const BVHSettings& settings);
+
+    // Note: Builds a motion BVH over primitives that move linearly from
+    // their start to their end bounds during the shutter interval. Motion
+    // always uses binary nodes and cannot be refit, owners rebuild instead
+    void build(const std::vector<AABB>& startBounds, const std::vector<AABB>& endBounds, const BVHSettings& settings);
+
+    // Note: Refits the hierarchy after primitives moved, see BVH::refit().
+    // Returns true if the SAH cost has since grown past the rebuild
+    // threshold, in which case the owner should rebuild. Always true for a
+    // motion BVH
+    bool refit(const std::vector<AABB>& slotBounds, const BVHSettings& settings);
+
+    // Note: See BVH::intersect() for the callback signature
+    template<typename IntersectFunc>
+    bool intersect(const Ray& ray, float tMin, float tMax, IntersectFunc&& intersectPrims) const;
+
+    // Note: See BVH::occluded() for the callback signature
+    template<typename OccludedFunc>
+    bool occluded(const Ray& ray, float tMin, float tMax, OccludedFunc&& occludedPrims) const;
+
+    // Note: Bounds of the whole motion
+    AABB getBounds() const;
+
+    // Note: Bounds at the given shutter time, the same as getBounds()
+    // without motion
+    AABB getBoundsAt(float time) const;
+
+    // Note: SAH cost after the last refit relative to the last build, see
+    // BVH::computeAbsoluteSAHCost()
+    inline float getSAHCostRatio() const { return m_BuildSAHCost > 0.0f ? m_SAHCost / m_BuildSAHCost : 1.0f; }
+
+    inline const BVH& getBVH() const { return m_BVH; }
+    inline const std::vector<uint32_t>& getPrimIndices() const { return m_BVH.getPrimIndices(); }
+    inline BVHType getActiveType() const { return m_ActiveType; }
+    inline bool hasMotion() const { return m_HasMotion; }
+    inline int getActiveWidth() const {
+        return m_ActiveType == BVHType::BVH8 ? 8 : (m_ActiveType == BVHType::BVH4 ? 4 : 2);
+    }
+
+private:
+    BVH m_BVH;
+    WideBVH<4> m_BVH4;
+    WideBVH<8> m_BVH8;
+    BVHType m_ActiveType = BVHType::BVH2;
+    BVHTraversal m_Traversal = BVHTraversal::STACK;
+    MotionBVH m_MotionBVH;
+    bool m_HasMotion = false;
+    float m_BuildSAHCost = 0.0f;
+    float m_SAHCost = 0.0f;
+};
+
+// Note: The wide traversals are instantiated with the target attribute of
+// their instruction set, so that the node tests inline into them
+template<typename IntersectFunc>
+SRAY_TARGET_SSE41 bool intersectBVH4(
+    const WideBVH<4>& bvh,
+    const Ray& ray,
+    float tMin,
+    float tMax,
+    IntersectFunc&& intersectPrims) {
+
+    return bvh.intersect(ray, tMin, tMax, intersectPrims);
+}
+
+template<typename IntersectFunc>
+SRAY_TARGET_AVX2 bool intersectBVH8(
+    const WideBVH<8>& bvh,
+    const Ray& ray,
+    float tMin,
+    float tMax,
+    IntersectFunc&& intersectPrims) {
+
+    return bvh.intersect(ray, tMin, tMax, intersectPrims);
+}
+
+template<typename OccludedFunc>
+SRAY_TARGET_SSE41 bool occludedBVH4(
+    const WideBVH<4>& bvh,
+    const Ray& ray,
+    float tMin,
+    float tMax,
+    OccludedFunc&& occludedPrims) {
+
+    return bvh.occluded(ray, tMin, tMax, occludedPrims);
+}
+
+template<typename OccludedFunc>
+SRAY_TARGET_AVX2 bool occludedBVH8(
+    const WideBVH<8>& bvh,
+    const Ray& ray,
+    float tMin,
+    float tMax,
+    OccludedFunc&& occludedPrims) {
+
+    return bvh.occluded(ray, tMin, tMax, occludedPrims);
+}
+
+template<typename IntersectFunc>
+bool AccelerationStructure::intersect(const Ray& ray, float tMin, float tMax, IntersectFunc&& intersectPrims) const {
+    if (m_HasMotion) {
+        return m_MotionBVH.intersect(ray, tMin, tMax, intersectPrims);
+    }
+
+    switch (m_ActiveType) {
+    case BVHType::BVH8:
+        return intersectBVH8(m_BVH8, ray, tMin, tMax, intersectPrims);
+    case BVHType::BVH4:
+        return intersectBVH4(m_BVH4, ray, tMin, tMax, intersectPrims);
+    default:
+        break;
+    }
+
+    if (m_Traversal == BVHTraversal::STACKLESS) {
+        return m_BVH.intersectStackless(ray, tMin, tMax, intersectPrims);
+    }
+
+    return m_BVH.intersect(ray, tMin, tMax, intersectPrims);
+}
+
+template<typename OccludedFunc>
+bool AccelerationStructure::occluded(const Ray& ray, float tMin, float tMax, OccludedFunc&& occludedPrims) const {
+    if (m_HasMotion) {
+        return m_MotionBVH.occluded(ray, tMin, tMax, occludedPrims);
+    }
+
+    switch (m_ActiveType) {
+    case BVHType::BVH8:
+        return occludedBVH8(m_BVH8, ray, tMin, tMax, occludedPrims);
+    case BVHType::BVH4:
+        return occludedBVH4(m_BVH4, ray, tMin, tMax, occludedPrims);
+    default:
+        break;
+    }
+
+    if (m_Traversal == BVHTraversal::STACKLESS) {
+        return m_BVH.occludedStackless(ray, tMin, tMax, occludedPrims);
+    }
+
+    return m_BVH.occluded(ray, tMin, tMax, occludedPrims);
+}
@@ -0,0 +1,99 @@
+#include "accumulationBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+
+AccumulationBuffer::AccumulationBuffer(int width, int height) {
+    resize(width, height);
+}
+
+void AccumulationBuffer::resize(int width, int height) {
+    m_Width = width;
+    m_Height = height;
+    m_ColorSums.assign((size_t)width * height, Vec3{});
+    m_LuminanceSquareSums.assign((size_t)width * height, 0.0f);
+    m_SampleCounts.assign((size_t)width * height, 0);
+    m_AlbedoSums.assign((size_t)width * height, Vec3{});
+    m_NormalSums.assign((size_t)width * height, Vec3{});
+    m_DepthSums.assign((size_t)width * height, 0.0f);
+    m_ObjectIds.assign((size_t)width * height, -1);
+    m_PrimitiveIds.assign((size_t)width * height, -1);
+}
+
+void AccumulationBuffer::clear() {
+    std::fill(m_ColorSums.begin(), m_ColorSums.end(), Vec3{});
+    std::fill(m_LuminanceSquareSums.begin(), m_LuminanceSquareSums.end(), 0.0f);
+    std::fill(m_SampleCounts.begin(), m_SampleCounts.end(), 0);
+    std::fill(m_AlbedoSums.begin(), m_AlbedoSums.end(), Vec3{});
+    std::fill(m_NormalSums.begin(), m_NormalSums.end(), Vec3{});
+    std::fill(m_DepthSums.begin(), m_DepthSums.end(), 0.0f);
+    std::fill(m_ObjectIds.begin(), m_ObjectIds.end(), -1);
+    std::fill(m_PrimitiveIds.begin(), m_PrimitiveIds.end(), -1);
+}
+
+void AccumulationBuffer::resolve(uint32_t* const imageBuffer) const {
+    for (int y = 0; y < m_Height; ++y) {
+        for (int x = 0; x < m_Width; ++x) {
+            imageBuffer[(size_t)y * m_Width + x] = linearToHex(getMean(x, y));
+        }
+    }
+}
+
+double AccumulationBuffer::computeRMSE(const AccumulationBuffer& reference) const {
+    double squaredErrorSum = 0.0;
+
+    for (int y = 0; y < m_Height; ++y) {
+        for (int x = 0; x < m_Width; ++x) {
+            const Vec3 error = getMean(x, y) - reference.getMean(x, y);
+            squaredErrorSum += (double)dot(error, error);
+        }
+    }
+
+    return sqrt(squaredErrorSum / (3.0 * m_Width * m_Height));
+}
+
+void AccumulationBuffer::resolveSampleCounts(uint32_t* const imageBuffer, uint32_t maxSamples) const {
+    const float scale = 1.0f / std::max(maxSamples, 1u);
+
+    for (size_t i = 0; i < m_SampleCounts.size(); ++i) {
+        const float value = std::clamp(m_SampleCounts[i] * scale, 0.0f, 0.999f);
+        imageBuffer[i] = rgbToHex({ value, value, value });
+    }
+}
+
+void AccumulationBuffer::resolveGuide(GuideBuffer guide, uint32_t* const imageBuffer) const {
+    float maxDepth = 0.0f;
+
+    if (guide == GuideBuffer::DEPTH) {
+        for (int y = 0; y < m_Height; ++y) {
+            for (int x = 0; x < m_Width; ++x) {
+                maxDepth = std::max(maxDepth, getMeanFeatures(x, y).depth);
+            }
+        }
+    }
+
+    for (int y = 0; y < m_Height; ++y) {
+        for (int x = 0; x < m_Width; ++x) {
+            const SurfaceFeatures features = getMeanFeatures(x, y);
+            Vec3 color{};
+
+            switch (guide) {
+            case GuideBuffer::ALBEDO:
+                color = features.albedo;
+                break;
+            case GuideBuffer::NORMAL:
+                color = features.normal * 0.5f + Vec3{ 0.5f, 0.5f, 0.5f };
+                break;
+            case GuideBuffer::DEPTH:
+                color = Vec3{ 1.0f, 1.0f, 1.0f } * (maxDepth > 0.0f ? features.depth / maxDepth : 0.0f);
+                break;
+            }
+
+            color.x = std::clamp(color.x, 0.0f, 0.999f);
+            color.y = std::clamp(color.y, 0.0f, 0.999f);
+            color.z = std::clamp(color.z, 0.0f, 0.999f);
+
+            imageBuffer[(size_t)y * m_Width + x] = rgbToHex(color);
+        }
+    }
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "math/sray_math.h"
+
+#include <vector>
+
+// Note: Attributes of the surface seen by a primary ray, used to guide the
+// denoiser and written out as AOVs. Rays escaping to the sky record its color
+// as albedo, a zero normal, a depth of zero and ids of -1
+struct SurfaceFeatures {
+    Vec3 albedo = { 0.0f, 0.0f, 0.0f };
+    Vec3 normal = { 0.0f, 0.0f, 0.0f };
+    float depth = 0.0f;
+    int32_t objectId = -1;
+    int32_t primitiveId = -1;
+};
+
+enum class GuideBuffer : uint8_t {
+    ALBEDO,
+    NORMAL,
+    DEPTH
+};
+
+// Note: Samples taken for one pixel in a single pass. The sum of squared
+// luminances lets the buffer estimate the variance of every pixel
+struct PixelSamples {
+    Vec3 radianceSum = { 0.0f, 0.0f, 0.0f };
+    float luminanceSquareSum = 0.0f;
+    uint32_t sampleCount = 0;
+    Vec3 albedoSum = { 0.0f, 0.0f, 0.0f };
+    Vec3 normalSum = { 0.0f, 0.0f, 0.0f };
+    float depthSum = 0.0f;
+
+    // Note: Ids cannot be averaged, so those of the first sample are kept
+    int32_t objectId = -1;
+    int32_t primitiveId = -1;
+
+    inline void add(const Vec3& radiance, const SurfaceFeatures& features) {
+        const float sampleLuminance = luminance(radiance);
+
+        if (sampleCount == 0) {
+            objectId = features.objectId;
+            primitiveId = features.primitiveId;
+        }
+
+        radianceSum += radiance;
+        luminanceSquareSum += sampleLuminance * sampleLuminance;
+        ++sampleCount;
+
+        albedoSum += features.albedo;
+        normalSum += features.normal;
+        depthSum += features.depth;
+    }
+
+    inline PixelSamples& operator+=(const PixelSamples& other) {
+        if (sampleCount == 0) {
+            objectId = other.objectId;
+            primitiveId = other.primitiveId;
+        }
+
+        radianceSum += other.radianceSum;
+        luminanceSquareSum += other.luminanceSquareSum;
+        sampleCount += other.sampleCount;
+
+        albedoSum += other.albedoSum;
+        normalSum += other.normalSum;
+        depthSum += other.depthSum;
+
+        return *this;
+    }
+};
+
+// Note: Persistent HDR image holding the running sum of linear radiance and
+// the number of samples taken per pixel, so that samples can be added in any
+// number of passes and the image read out at any time. The first-hit surface
+// features are averaged the same way. This is the CPU counterpart of the
+// accumulation pass of stingray-gui
+class AccumulationBuffer {
+public:
+    AccumulationBuffer() = default;
+    AccumulationBuffer(int width, int height);
+    ~AccumulationBuffer() = default;
+
+    void resize(int width, int height);
+    void clear();
+
+    inline void add(int x, int y, const PixelSamples& samples) {
+        const size_t index = (size_t)y * m_Width + x;
+
+        if (m_SampleCounts[index] == 0) {
+            m_ObjectIds[index] = samples.objectId;
+            m_PrimitiveIds[index] = samples.primitiveId;
+        }
+
+        m_ColorSums[index] += samples.radianceSum;
+        m_LuminanceSquareSums[index] += samples.luminanceSquareSum;
+        m_SampleCounts[index] += samples.sampleCount;
+        m_AlbedoSums[index] += samples.albedoSum;
+        m_NormalSums[index] += samples.normalSum;
+        m_DepthSums[index] += samples.depthSum;
+    }
+
+    inline Vec3 getMean(int x, int y) const {
+        const size_t index = (size_t)y * m_Width + x;
+        const uint32_t sampleCount = m_SampleCounts[index];
+
+        return sampleCount > 0 ? m_ColorSums[index] / (float)sampleCount : Vec3{};
+    }
+
+    inline SurfaceFeatures getMeanFeatures(int x, int y) const {
+        const size_t index = (size_t)y * m_Width + x;
+        const uint32_t sampleCount = m_SampleCounts[index];
+
+        if (sampleCount == 0) {
+            return {};
+        }
+
+        const float scale = 1.0f / sampleCount;
+
+        return {
+            m_AlbedoSums[index] * scale,
+            m_NormalSums[index] * scale,
+            m_DepthSums[index] * scale,
+            m_ObjectIds[index],
+            m_PrimitiveIds[index]
+        };
+    }
+
+    // Note: Only the sums the adaptive sampler needs, the features are left empty
+    inline PixelSamples getSamples(int x, int y) const {
+        const size_t index = (size_t)y * m_Width + x;
+
+        PixelSamples samples{};
+        samples.radianceSum = m_ColorSums[index];
+        samples.luminanceSquareSum = m_LuminanceSquareSums[index];
+        samples.sampleCount = m_SampleCounts[index];
+
+        return samples;
+    }
+
+    inline uint32_t getSampleCount(int x, int y) const { return m_SampleCounts[(size_t)y * m_Width + x]; }
+    inline int getWidth() const { return m_Width; }
+    inline int getHeight() const { return m_Height; }
+
+    // Note: Root mean square error of the linear mean radiance against a
+    // reference buffer of the same size, over all pixels and channels
+    double computeRMSE(const AccumulationBuffer& reference) const;
+
+    // Note: Tone maps the current mean of every pixel into 8-bit RGBA
+    void resolve(uint32_t* const imageBuffer) const;
+
+    // Note: Grayscale map of the samples taken per pixel, white being maxSamples
+    void resolveSampleCounts(uint32_t* const imageBuffer, uint32_t maxSamples) const;
+
+    // Note: Visualization of a denoiser guide buffer. Normals are mapped from
+    // [-1, 1] to [0, 1] and depth is normalized by the largest depth in view
+    void resolveGuide(GuideBuffer guide, uint32_t* const imageBuffer) const;
+
+private:
+    int m_Width = 0;
+    int m_Height = 0;
+    std::vector<Vec3> m_ColorSums;
+    std::vector<float> m_LuminanceSquareSums;
+    std::vector<uint32_t> m_SampleCounts;
+    std::vector<Vec3> m_AlbedoSums;
+    std::vector<Vec3> m_NormalSums;
+    std::vector<float> m_DepthSums;
+    std::vector<int32_t> m_ObjectIds;
+    std::vector<int32_t> m_PrimitiveIds;
+};
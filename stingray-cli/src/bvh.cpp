@@ -0,0 +1,966 @@
+#include "bvh.h"
+#include "utility/threadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <numeric>
+
+namespace {
+    constexpr int NumBins = 16;
+    constexpr uint32_t MaxLeafSize = 8;
+    static_assert(MaxLeafSize <= 0xf, "Leaf primitive counts are packed into 4 bits");
+    constexpr float TraversalCost = 1.0f; // Note: Relative to one primitive test
+
+    // Note: Beyond this depth we stop trusting the SAH and split at the
+    // object median, which bounds the depth of the remaining subtree
+    constexpr uint32_t MaxSAHDepth = 96;
+
+    // Note: Morton code splits carry no cost estimate, so the LBVH stops
+    // at small leaves to keep their bounds tight
+    constexpr uint32_t LBVHLeafSize = 4;
+    constexpr uint32_t MortonBits = 10; // Note: Per axis, 30 bits in total
+    constexpr uint32_t RadixBits = 10;
+    constexpr uint32_t RadixBuckets = 1u << RadixBits;
+
+    // Note: Subtrees smaller than this are not worth a task of their own
+    constexpr uint32_t MinTaskSize = 4096;
+
+    // Note: Nodes at least this large are split by all workers together,
+    // before the subtrees below them are handed out as tasks. Up there a
+    // single node holds most of the primitives, so splitting it on one
+    // thread would leave the other workers idle
+    constexpr uint32_t ParallelSplitSize = 65536;
+
+    // Note: Marks a node of a build fragment that stands in for the root of
+    // another fragment, whose index is stored in the skip index
+    constexpr uint32_t FragmentLink = 0xffffffff;
+
+    struct Bin {
+        AABB bounds{};
+        uint32_t count = 0;
+    };
+
+    // Note: Node of a build fragment that stands in for the root of another
+    // fragment, along with the local index of its parent
+    struct FragmentLinkInfo {
+        uint32_t localIndex;
+        uint32_t parentIndex;
+        uint32_t fragmentIndex;
+    };
+
+    // Note: Part of the hierarchy built by a single task, in depth-first
+    // order. The skip index of an interior node holds the local index of
+    // its right child until the fragments are stitched together
+    struct BuildFragment {
+        std::vector<BVHNode> nodes;
+        std::vector<FragmentLinkInfo> links; // Note: In order of their local index
+        uint32_t depth = 0; // Note: Depth of the root in the whole hierarchy
+    };
+
+    struct BuildTask {
+        uint32_t first;
+        uint32_t count;
+        uint32_t depth;
+        BuildFragment* fragment;
+    };
+
+    inline int getBin(float centroid, float axisMin, float scale) {
+        return std::min(NumBins - 1, (int)((centroid - axisMin) * scale));
+    }
+
+    // Note: Evaluates every bin boundary of one axis, keeping the cheapest
+    // split over all axes so far in bestCost, bestAxis and bestSplit
+    void sweepBins(const Bin (&bins)[NumBins], uint32_t count, int axis, float* const bestCost, int* const bestAxis, int* const bestSplit) {
+        // Sweep from the right to gather the cost of every right-hand side,
+        // then from the left to evaluate the full split cost
+        float rightCosts[NumBins - 1]{};
+        AABB rightBounds{};
+        uint32_t rightCount = 0;
+
+        for (int b = NumBins - 1; b > 0; --b) {
+            rightBounds.grow(bins[b].bounds);
+            rightCount += bins[b].count;
+            rightCosts[b - 1] = rightCount > 0 ? rightBounds.surfaceArea() * rightCount : 0.0f;
+        }
+
+        AABB leftBounds{};
+        uint32_t leftCount = 0;
+
+        for (int b = 0; b < NumBins - 1; ++b) {
+            leftBounds.grow(bins[b].bounds);
+            leftCount += bins[b].count;
+
+            if (leftCount == 0 || leftCount == count) {
+                continue;
+            }
+
+            const float cost = leftBounds.surfaceArea() * leftCount + rightCosts[b];
+
+            if (cost < *bestCost) {
+                *bestCost = cost;
+                *bestAxis = axis;
+                *bestSplit = b;
+            }
+        }
+    }
+
+    // Note: Used when no SAH split was found, because either all centroids
+    // coincide or the tree is too deep. Splits at the object median along
+    // the widest axis and returns the size of the left part
+    uint32_t splitMedian(uint32_t* const begin, uint32_t count, const AABB& centroidBounds, const std::vector<Vec3>& centroids) {
+        const Vec3 extent = centroidBounds.extent();
+        const int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+        uint32_t* const middle = begin + count / 2;
+
+        std::nth_element(begin, middle, begin + count, [&](uint32_t a, uint32_t b) {
+            return centroids[a][axis] < centroids[b][axis];
+        });
+
+        return count / 2;
+    }
+
+    // Note: Decides how to split the primitives [first, first + count) with
+    // the binned SAH, partitions them accordingly and returns the size of
+    // the left part, or 0 if they should become a leaf. The bounds of the
+    // primitives are returned as well
+    uint32_t splitSAH(
+        uint32_t* const primIndices,
+        uint32_t first,
+        uint32_t count,
+        uint32_t depth,
+        const std::vector<AABB>& primBounds,
+        const std::vector<Vec3>& centroids,
+        AABB* const nodeBounds) {
+
+        AABB bounds{};
+        AABB centroidBounds{};
+
+        for (uint32_t i = first; i < first + count; ++i) {
+            bounds.grow(primBounds[primIndices[i]]);
+            centroidBounds.grow(centroids[primIndices[i]]);
+        }
+
+        *nodeBounds = bounds;
+
+        if (count == 1) {
+            return 0;
+        }
+
+        // Find the cheapest bin boundary over all three axes
+        int bestAxis = -1;
+        int bestSplit = 0;
+        float bestCost = Infinity;
+
+        for (int axis = 0; axis < 3 && depth < MaxSAHDepth; ++axis) {
+            const float axisMin = centroidBounds.min[axis];
+            const float axisExtent = centroidBounds.max[axis] - axisMin;
+
+            if (axisExtent <= 0.0f) {
+                continue;
+            }
+
+            Bin bins[NumBins]{};
+            const float scale = NumBins / axisExtent;
+
+            for (uint32_t i = first; i < first + count; ++i) {
+                const uint32_t primIndex = primIndices[i];
+                const int b = getBin(centroids[primIndex][axis], axisMin, scale);
+
+                bins[b].bounds.grow(primBounds[primIndex]);
+                bins[b].count++;
+            }
+
+            sweepBins(bins, count, axis, &bestCost, &bestAxis, &bestSplit);
+        }
+
+        uint32_t* const begin = primIndices + first;
+
+        if (bestAxis == -1) {
+            return (count <= MaxLeafSize) ? 0 : splitMedian(begin, count, centroidBounds, centroids);
+        }
+
+        const float splitCost = TraversalCost + bestCost / bounds.surfaceArea();
+
+        if (splitCost >= (float)count && count <= MaxLeafSize) {
+            return 0;
+        }
+
+        const float axisMin = centroidBounds.min[bestAxis];
+        const float scale = NumBins / (centroidBounds.max[bestAxis] - axisMin);
+
+        uint32_t* const middle = std::partition(begin, begin + count, [&](uint32_t primIndex) {
+            return getBin(centroids[primIndex][bestAxis], axisMin, scale) <= bestSplit;
+        });
+
+        return (uint32_t)(middle - begin);
+    }
+
+    // Note: splitSAH() for the large nodes near the root, with the bounds,
+    // the binning and the partition spread over the workers of the pool.
+    // Per-worker bins are merged exactly, so the split is the same as
+    // splitSAH() would make. The partition is stable rather than the
+    // reordering of std::partition(), through the scratch array
+    uint32_t splitSAHParallel(
+        uint32_t* const primIndices,
+        uint32_t* const scratch,
+        uint32_t first,
+        uint32_t count,
+        uint32_t depth,
+        const std::vector<AABB>& primBounds,
+        const std::vector<Vec3>& centroids,
+        ThreadPool* const threadPool,
+        AABB* const nodeBounds) {
+
+        const int numWorkers = threadPool->getNumThreads();
+        std::vector<AABB> workerBounds(numWorkers);
+        std::vector<AABB> workerCentroidBounds(numWorkers);
+
+        parallelFor(threadPool, count, [&](int worker, uint32_t begin, uint32_t end) {
+            AABB bounds{};
+            AABB centroidBounds{};
+
+            for (uint32_t i = first + begin; i < first + end; ++i) {
+                bounds.grow(primBounds[primIndices[i]]);
+                centroidBounds.grow(centroids[primIndices[i]]);
+            }
+
+            workerBounds[worker] = bounds;
+            workerCentroidBounds[worker] = centroidBounds;
+        });
+
+        AABB bounds{};
+        AABB centroidBounds{};
+
+        for (int worker = 0; worker < numWorkers; ++worker) {
+            bounds.grow(workerBounds[worker]);
+            centroidBounds.grow(workerCentroidBounds[worker]);
+        }
+
+        *nodeBounds = bounds;
+
+        if (count == 1) {
+            return 0;
+        }
+
+        // Note: All axes are binned in a single pass over the primitives
+        struct AxisBins {
+            Bin bins[3][NumBins]{};
+        };
+
+        float axisMins[3]{};
+        float scales[3]{};
+        bool binAxis[3]{};
+
+        for (int axis = 0; axis < 3; ++axis) {
+            const float axisExtent = centroidBounds.max[axis] - centroidBounds.min[axis];
+
+            axisMins[axis] = centroidBounds.min[axis];
+            scales[axis] = (axisExtent > 0.0f) ? NumBins / axisExtent : 0.0f;
+            binAxis[axis] = axisExtent > 0.0f && depth < MaxSAHDepth;
+        }
+
+        std::vector<AxisBins> workerBins(numWorkers);
+
+        parallelFor(threadPool, count, [&](int worker, uint32_t begin, uint32_t end) {
+            AxisBins& axisBins = workerBins[worker];
+
+            for (uint32_t i = first + begin; i < first + end; ++i) {
+                const uint32_t primIndex = primIndices[i];
+
+                for (int axis = 0; axis < 3; ++axis) {
+                    if (binAxis[axis]) {
+                        Bin& bin = axisBins.bins[axis][getBin(centroids[primIndex][axis], axisMins[axis], scales[axis])];
+
+                        bin.bounds.grow(primBounds[primIndex]);
+                        bin.count++;
+                    }
+                }
+            }
+        });
+
+        int bestAxis = -1;
+        int bestSplit = 0;
+        float bestCost = Infinity;
+
+        for (int axis = 0; axis < 3; ++axis) {
+            if (!binAxis[axis]) {
+                continue;
+            }
+
+            Bin bins[NumBins]{};
+
+            for (const AxisBins& axisBins : workerBins) {
+                for (int b = 0; b < NumBins; ++b) {
+                    bins[b].bounds.grow(axisBins.bins[axis][b].bounds);
+                    bins[b].count += axisBins.bins[axis][b].count;
+                }
+            }
+
+            sweepBins(bins, count, axis, &bestCost, &bestAxis, &bestSplit);
+        }
+
+        if (bestAxis == -1) {
+            return (count <= MaxLeafSize) ? 0 : splitMedian(primIndices + first, count, centroidBounds, centroids);
+        }
+
+        // Note: Every worker counts the left side of its chunk, after which
+        // the chunks are scattered to their own ranges of both sides
+        const auto goesLeft = [&](uint32_t primIndex) {
+            return getBin(centroids[primIndex][bestAxis], axisMins[bestAxis], scales[bestAxis]) <= bestSplit;
+        };
+
+        std::vector<uint32_t> leftOffsets(numWorkers);
+        std::vector<uint32_t> rightOffsets(numWorkers);
+
+        parallelFor(threadPool, count, [&](int worker, uint32_t begin, uint32_t end) {
+            uint32_t leftCount = 0;
+
+            for (uint32_t i = first + begin; i < first + end; ++i) {
+                leftCount += goesLeft(primIndices[i]) ? 1 : 0;
+            }
+
+            leftOffsets[worker] = leftCount;
+            rightOffsets[worker] = (end - begin) - leftCount;
+        });
+
+        uint32_t leftTotal = 0;
+
+        for (int worker = 0; worker < numWorkers; ++worker) {
+            const uint32_t leftCount = leftOffsets[worker];
+
+            leftOffsets[worker] = leftTotal;
+            leftTotal += leftCount;
+        }
+
+        uint32_t rightTotal = leftTotal;
+
+        for (int worker = 0; worker < numWorkers; ++worker) {
+            const uint32_t rightCount = rightOffsets[worker];
+
+            rightOffsets[worker] = rightTotal;
+            rightTotal += rightCount;
+        }
+
+        parallelFor(threadPool, count, [&](int worker, uint32_t begin, uint32_t end) {
+            uint32_t left = first + leftOffsets[worker];
+            uint32_t right = first + rightOffsets[worker];
+
+            for (uint32_t i = first + begin; i < first + end; ++i) {
+                const uint32_t primIndex = primIndices[i];
+                scratch[goesLeft(primIndex) ? left++ : right++] = primIndex;
+            }
+        });
+
+        parallelFor(threadPool, count, [&](int, uint32_t begin, uint32_t end) {
+            std::copy(scratch + first + begin, scratch + first + end, primIndices + first + begin);
+        });
+
+        return leftTotal;
+    }
+
+    // Note: Splits sorted Morton codes where the highest bit in which the
+    // codes of the range differ flips from 0 to 1 (Lauterbach et al. 2009),
+    // returning the size of the left part or 0 for a leaf
+    uint32_t splitMorton(const uint32_t* const mortonCodes, uint32_t first, uint32_t count) {
+        if (count <= LBVHLeafSize) {
+            return 0;
+        }
+
+        const uint32_t firstCode = mortonCodes[first];
+        const uint32_t lastCode = mortonCodes[first + count - 1];
+
+        if (firstCode == lastCode) {
+            return (count <= MaxLeafSize) ? 0 : count / 2;
+        }
+
+        const uint32_t splitBit = 1u << (31 - std::countl_zero(firstCode ^ lastCode));
+        const uint32_t* const split = std::partition_point(mortonCodes + first, mortonCodes + first + count,
+            [&](uint32_t code) { return (code & splitBit) == 0; });
+
+        return (uint32_t)(split - (mortonCodes + first));
+    }
+
+    // Spreads the lower 10 bits of value to every third bit
+    uint32_t expandBits(uint32_t value) {
+        value = (value * 0x00010001u) & 0xff0000ffu;
+        value = (value * 0x00000101u) & 0x0f00f00fu;
+        value = (value * 0x00000011u) & 0xc30c30c3u;
+        value = (value * 0x00000005u) & 0x49249249u;
+
+        return value;
+    }
+
+    // Note: Stable LSD radix sort of the keys, moving the values along.
+    // Every worker counts the digits of its chunk, and the histograms are
+    // then laid out bucket by bucket and worker by worker, so that each
+    // worker scatters its chunk to its own ranges without synchronization
+    void radixSort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values, ThreadPool* const threadPool) {
+        const uint32_t count = (uint32_t)keys.size();
+        const int numWorkers = threadPool ? threadPool->getNumThreads() : 1;
+
+        std::vector<uint32_t> sortedKeys(count);
+        std::vector<uint32_t> sortedValues(count);
+        std::vector<uint32_t> histograms((size_t)numWorkers * RadixBuckets);
+
+        for (uint32_t shift = 0; shift < 3 * MortonBits; shift += RadixBits) {
+            std::fill(histograms.begin(), histograms.end(), 0);
+
+            parallelFor(threadPool, count, [&](int worker, uint32_t begin, uint32_t end) {
+                uint32_t* const histogram = histograms.data() + (size_t)worker * RadixBuckets;
+
+                for (uint32_t i = begin; i < end; ++i) {
+                    histogram[(keys[i] >> shift) & (RadixBuckets - 1)]++;
+                }
+            });
+
+            uint32_t offset = 0;
+
+            for (uint32_t bucket = 0; bucket < RadixBuckets; ++bucket) {
+                for (int worker = 0; worker < numWorkers; ++worker) {
+                    uint32_t& entry = histograms[(size_t)worker * RadixBuckets + bucket];
+                    const uint32_t bucketCount = entry;
+
+                    entry = offset;
+                    offset += bucketCount;
+                }
+            }
+
+            parallelFor(threadPool, count, [&](int worker, uint32_t begin, uint32_t end) {
+                uint32_t* const offsets = histograms.data() + (size_t)worker * RadixBuckets;
+
+                for (uint32_t i = begin; i < end; ++i) {
+                    const uint32_t target = offsets[(keys[i] >> shift) & (RadixBuckets - 1)]++;
+
+                    sortedKeys[target] = keys[i];
+                    sortedValues[target] = values[i];
+                }
+            });
+
+            keys.swap(sortedKeys);
+            values.swap(sortedValues);
+        }
+    }
+
+    // Note: Builds the hierarchy over count primitives top-down, as tasks on
+    // the workers of the pool (or on the calling thread without one). Nodes
+    // of at least ParallelSplitSize primitives are first split on the
+    // calling thread with splitLarge(), which may use all workers, and their
+    // smaller children become tasks. A task hands its large right children
+    // to new tasks before descending left, each of which gets a fragment of
+    // its own. Both split functions have the signature
+    // uint32_t(uint32_t first, uint32_t count, uint32_t depth, AABB* const bounds),
+    // see splitSAH(). Returns the fragments, the first holding the root
+    template<typename SplitFunc, typename LargeSplitFunc>
+    std::vector<std::unique_ptr<BuildFragment>> buildFragments(
+        uint32_t primCount,
+        ThreadPool* const threadPool,
+        SplitFunc&& split,
+        LargeSplitFunc&& splitLarge) {
+
+        std::vector<std::unique_ptr<BuildFragment>> fragments;
+        std::vector<BuildTask> tasks;
+        std::mutex mutex;
+        std::condition_variable taskAvailable;
+        uint32_t pendingTasks = 0; // Note: Queued and running
+
+        fragments.push_back(std::make_unique<BuildFragment>());
+
+        const auto spawn = [&](uint32_t first, uint32_t count, uint32_t depth) {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            fragments.push_back(std::make_unique<BuildFragment>());
+            fragments.back()->depth = depth;
+            tasks.push_back({ first, count, depth, fragments.back().get() });
+            ++pendingTasks;
+            taskAvailable.notify_one();
+
+            return (uint32_t)(fragments.size() - 1);
+        };
+
+        const auto isTask = [&](uint32_t count) {
+            return threadPool != nullptr && count >= MinTaskSize && count < ParallelSplitSize;
+        };
+
+        const auto pushLink = [](BuildFragment& fragment, uint32_t parentIndex, uint32_t fragmentIndex) {
+            BVHNode link{};
+            link.primData = FragmentLink;
+            link.skipIndex = fragmentIndex;
+
+            fragment.links.push_back({ (uint32_t)fragment.nodes.size(), parentIndex, fragmentIndex });
+            fragment.nodes.push_back(link);
+        };
+
+        const auto buildNode = [&](auto& self, BuildFragment& fragment, uint32_t first, uint32_t count, uint32_t depth) -> void {
+            const uint32_t localIndex = (uint32_t)fragment.nodes.size();
+            fragment.nodes.emplace_back();
+
+            // Note: Tasks never get this many primitives, so these nodes are
+            // all split before the workers start on the tasks
+            const bool splitTogether = threadPool != nullptr && count >= ParallelSplitSize;
+
+            AABB bounds{};
+            const uint32_t leftCount = splitTogether ? splitLarge(first, count, depth, &bounds) : split(first, count, depth, &bounds);
+
+            fragment.nodes[localIndex].boundsMin = bounds.min;
+            fragment.nodes[localIndex].boundsMax = bounds.max;
+
+            if (leftCount == 0) {
+                fragment.nodes[localIndex].primData = (first << 4) | count;
+                return;
+            }
+
+            const uint32_t rightCount = count - leftCount;
+            const uint32_t rightFragment = isTask(rightCount) ? spawn(first + leftCount, rightCount, depth + 1) : 0;
+
+            if (splitTogether && isTask(leftCount)) {
+                pushLink(fragment, localIndex, spawn(first, leftCount, depth + 1));
+            }
+            else {
+                self(self, fragment, first, leftCount, depth + 1);
+            }
+
+            fragment.nodes[localIndex].skipIndex = (uint32_t)fragment.nodes.size();
+
+            if (rightFragment != 0) {
+                pushLink(fragment, localIndex, rightFragment);
+            }
+            else {
+                self(self, fragment, first + leftCount, rightCount, depth + 1);
+            }
+        };
+
+        const auto workerLoop = [&](int) {
+            while (true) {
+                BuildTask task{};
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    taskAvailable.wait(lock, [&]() { return !tasks.empty() || pendingTasks == 0; });
+
+                    if (tasks.empty()) {
+                        return;
+                    }
+
+                    task = tasks.back();
+                    tasks.pop_back();
+                }
+
+                buildNode(buildNode, *task.fragment, task.first, task.count, task.depth);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+
+                    if (--pendingTasks == 0) {
+                        taskAvailable.notify_all();
+                    }
+                }
+            }
+        };
+
+        if (threadPool != nullptr && primCount >= ParallelSplitSize) {
+            buildNode(buildNode, *fragments[0], 0, primCount, 0);
+        }
+        else {
+            tasks.push_back({ 0, primCount, 0, fragments[0].get() });
+            pendingTasks = 1;
+        }
+
+        if (threadPool != nullptr) {
+            threadPool->run(workerLoop);
+        }
+        else {
+            workerLoop(0);
+        }
+
+        return fragments;
+    }
+
+    // Note: Stitches the fragments into the final depth-first node array.
+    // Every link is replaced by the whole subtree of its fragment, so the
+    // expanded size of every fragment is summed up first. Fragments are
+    // always spawned after the fragment linking to them, which makes a
+    // backward pass enough for the sizes and a forward one enough for the
+    // offsets. The fragments are then copied into place concurrently,
+    // turning local indices into final ones
+    void joinFragments(
+        const std::vector<std::unique_ptr<BuildFragment>>& fragments,
+        ThreadPool* const threadPool,
+        std::vector<BVHNode>& nodes,
+        std::vector<BVHNodeInfo>& nodeInfos) {
+
+        const uint32_t fragmentCount = (uint32_t)fragments.size();
+        std::vector<uint32_t> expandedSizes(fragmentCount);
+
+        for (uint32_t f = fragmentCount; f-- > 0;) {
+            const BuildFragment& fragment = *fragments[f];
+            uint32_t size = (uint32_t)(fragment.nodes.size() - fragment.links.size());
+
+            for (const FragmentLinkInfo& link : fragment.links) {
+                size += expandedSizes[link.fragmentIndex];
+            }
+
+            expandedSizes[f] = size;
+        }
+
+        // Note: Offset of the root of every fragment and the final index of
+        // its parent. A local index moves by the expanded sizes of all links
+        // before it, minus the link nodes themselves
+        std::vector<uint32_t> offsets(fragmentCount, 0);
+        std::vector<uint32_t> rootParents(fragmentCount, 0);
+
+        for (uint32_t f = 0; f < fragmentCount; ++f) {
+            const std::vector<FragmentLinkInfo>& links = fragments[f]->links;
+
+            const auto toFinalIndex = [&](uint32_t localIndex) {
+                uint32_t index = offsets[f] + localIndex;
+
+                for (size_t i = 0; i < links.size() && links[i].localIndex < localIndex; ++i) {
+                    index += expandedSizes[links[i].fragmentIndex] - 1;
+                }
+
+                return index;
+            };
+
+            for (const FragmentLinkInfo& link : links) {
+                offsets[link.fragmentIndex] = toFinalIndex(link.localIndex);
+                rootParents[link.fragmentIndex] = toFinalIndex(link.parentIndex);
+            }
+        }
+
+        nodes.resize(expandedSizes[0]);
+        nodeInfos.resize(expandedSizes[0]);
+
+        const auto copyFragment = [&](uint32_t f) {
+            const BuildFragment& fragment = *fragments[f];
+            const uint32_t localCount = (uint32_t)fragment.nodes.size();
+            std::vector<uint32_t> finalIndices(localCount);
+            std::vector<uint32_t> subtreeEnds(localCount);
+            uint32_t nextIndex = offsets[f];
+
+            for (uint32_t i = 0; i < localCount; ++i) {
+                const BVHNode& node = fragment.nodes[i];
+                finalIndices[i] = nextIndex;
+                nextIndex += (node.primData == FragmentLink) ? expandedSizes[node.skipIndex] : 1;
+            }
+
+            // Note: Children come after their parent, so walking backwards
+            // finds the end of every right subtree before its parent needs it
+            for (uint32_t i = localCount; i-- > 0;) {
+                const BVHNode& node = fragment.nodes[i];
+
+                if (node.primData == FragmentLink) {
+                    subtreeEnds[i] = finalIndices[i] + expandedSizes[node.skipIndex];
+                }
+                else if (node.isLeaf()) {
+                    subtreeEnds[i] = finalIndices[i] + 1;
+                }
+                else {
+                    subtreeEnds[i] = subtreeEnds[node.skipIndex];
+                }
+            }
+
+            // Note: Depths are relative to the root of the fragment until the
+            // root depth is added, the local root being its own parent
+            std::vector<uint32_t> localParents(localCount, 0);
+            std::vector<uint32_t> localDepths(localCount, 0);
+
+            for (uint32_t i = 0; i < localCount; ++i) {
+                const BVHNode& node = fragment.nodes[i];
+
+                if (node.primData == FragmentLink) {
+                    continue;
+                }
+
+                const uint32_t nodeIndex = finalIndices[i];
+
+                nodes[nodeIndex] = node;
+                nodes[nodeIndex].skipIndex = subtreeEnds[i];
+                nodeInfos[nodeIndex] = {
+                    i == 0 ? rootParents[f] : finalIndices[localParents[i]],
+                    fragment.depth + localDepths[i]
+                };
+
+                if (!node.isLeaf()) {
+                    localParents[i + 1] = i;
+                    localParents[node.skipIndex] = i;
+                    localDepths[i + 1] = localDepths[i] + 1;
+                    localDepths[node.skipIndex] = localDepths[i] + 1;
+                }
+            }
+        };
+
+        if (threadPool == nullptr) {
+            for (uint32_t f = 0; f < fragmentCount; ++f) {
+                copyFragment(f);
+            }
+
+            return;
+        }
+
+        std::atomic<uint32_t> nextFragment = 0;
+
+        threadPool->run([&](int) {
+            for (uint32_t f = nextFragment++; f < fragmentCount; f = nextFragment++) {
+                copyFragment(f);
+            }
+        });
+    }
+}
+
+void BVH::build(const std::vector<AABB>& primBounds, BVHBuilder builder, ThreadPool* const threadPool) {
+    const uint32_t primCount = (uint32_t)primBounds.size();
+
+    m_Nodes.clear();
+    m_NodeInfos.clear();
+    m_PrimIndices.resize(primCount);
+    std::iota(m_PrimIndices.begin(), m_PrimIndices.end(), 0);
+
+    if (primCount == 0) {
+        return;
+    }
+
+    // Note: A single worker gains nothing from the task machinery
+    ThreadPool* const buildPool = (threadPool != nullptr && threadPool->getNumThreads() > 1) ? threadPool : nullptr;
+
+    std::vector<Vec3> centroids(primCount);
+
+    parallelFor(buildPool, primCount, [&](int, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            centroids[i] = primBounds[i].center();
+        }
+    });
+
+    m_Nodes.reserve(2 * (size_t)primCount - 1);
+    m_NodeInfos.reserve(2 * (size_t)primCount - 1);
+
+    if (builder == BVHBuilder::LBVH) {
+        buildLinear(primBounds, centroids, buildPool);
+    }
+    else if (buildPool != nullptr) {
+        buildParallelSAH(primBounds, centroids, buildPool);
+    }
+    else {
+        buildNode(0, primCount, 0, 0, primBounds, centroids);
+    }
+
+    m_Nodes.shrink_to_fit();
+    m_NodeInfos.shrink_to_fit();
+}
+
+float BVH::computeSAHCost() const {
+    if (m_Nodes.empty()) {
+        return 0.0f;
+    }
+
+    const float rootArea = AABB{ m_Nodes[0].boundsMin, m_Nodes[0].boundsMax }.surfaceArea();
+    const float cost = computeAbsoluteSAHCost();
+
+    return rootArea > 0.0f ? cost / rootArea : cost;
+}
+
+float BVH::computeAbsoluteSAHCost() const {
+    float cost = 0.0f;
+
+    for (const BVHNode& node : m_Nodes) {
+        const float area = AABB{ node.boundsMin, node.boundsMax }.surfaceArea();
+        cost += area * (node.isLeaf() ? (float)node.getPrimCount() : TraversalCost);
+    }
+
+    return cost;
+}
+
+void BVH::buildNode(
+    uint32_t first,
+    uint32_t count,
+    uint32_t parentIndex,
+    uint32_t depth,
+    const std::vector<AABB>& primBounds,
+    const std::vector<Vec3>& centroids) {
+
+    const uint32_t nodeIndex = (uint32_t)m_Nodes.size();
+    m_Nodes.emplace_back();
+    m_NodeInfos.push_back({ parentIndex, depth });
+
+    AABB bounds{};
+    const uint32_t leftCount = splitSAH(m_PrimIndices.data(), first, count, depth, primBounds, centroids, &bounds);
+
+    m_Nodes[nodeIndex].boundsMin = bounds.min;
+    m_Nodes[nodeIndex].boundsMax = bounds.max;
+
+    if (leftCount == 0) {
+        m_Nodes[nodeIndex].primData = (first << 4) | count;
+        m_Nodes[nodeIndex].skipIndex = nodeIndex + 1;
+        return;
+    }
+
+    // Note: The left child is emitted right after its parent, and the right
+    // child right after the whole left subtree
+    buildNode(first, leftCount, nodeIndex, depth + 1, primBounds, centroids);
+    buildNode(first + leftCount, count - leftCount, nodeIndex, depth + 1, primBounds, centroids);
+
+    m_Nodes[nodeIndex].skipIndex = (uint32_t)m_Nodes.size();
+}
+
+// Note: Makes the same splits as buildNode(), so the hierarchy is identical
+// to the serial build. Only the order of the primitives within a leaf may
+// differ, as the nodes near the root are partitioned stably by all workers
+void BVH::buildParallelSAH(const std::vector<AABB>& primBounds, const std::vector<Vec3>& centroids, ThreadPool* const threadPool) {
+    const uint32_t primCount = (uint32_t)primBounds.size();
+    std::vector<uint32_t> scratch(primCount >= ParallelSplitSize ? primCount : 0);
+
+    const auto fragments = buildFragments(primCount, threadPool,
+        [&](uint32_t first, uint32_t count, uint32_t depth, AABB* const bounds) {
+            return splitSAH(m_PrimIndices.data(), first, count, depth, primBounds, centroids, bounds);
+        },
+        [&](uint32_t first, uint32_t count, uint32_t depth, AABB* const bounds) {
+            return splitSAHParallel(m_PrimIndices.data(), scratch.data(), first, count, depth, primBounds, centroids, threadPool, bounds);
+        });
+
+    joinFragments(fragments, threadPool, m_Nodes, m_NodeInfos);
+}
+
+// Note: Linear BVH (Lauterbach et al. 2009). The primitives are sorted
+// along a Morton curve through the centroid bounds, after which every
+// split is a binary search for the highest differing bit of the codes
+void BVH::buildLinear(const std::vector<AABB>& primBounds, const std::vector<Vec3>& centroids, ThreadPool* const threadPool) {
+    const uint32_t primCount = (uint32_t)primBounds.size();
+    const int numWorkers = threadPool ? threadPool->getNumThreads() : 1;
+
+    std::vector<AABB> workerBounds(numWorkers);
+
+    parallelFor(threadPool, primCount, [&](int worker, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            workerBounds[worker].grow(centroids[i]);
+        }
+    });
+
+    AABB centroidBounds{};
+
+    for (const AABB& bounds : workerBounds) {
+        centroidBounds.grow(bounds);
+    }
+
+    const Vec3 extent = centroidBounds.extent();
+    const float gridSize = (float)((1u << MortonBits) - 1);
+    const Vec3 scale = {
+        extent.x > 0.0f ? gridSize / extent.x : 0.0f,
+        extent.y > 0.0f ? gridSize / extent.y : 0.0f,
+        extent.z > 0.0f ? gridSize / extent.z : 0.0f
+    };
+
+    std::vector<uint32_t> mortonCodes(primCount);
+
+    parallelFor(threadPool, primCount, [&](int, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            const Vec3 cell = (centroids[i] - centroidBounds.min) * scale;
+
+            mortonCodes[i] = (expandBits((uint32_t)cell.x) << 2) | (expandBits((uint32_t)cell.y) << 1) | expandBits((uint32_t)cell.z);
+        }
+    });
+
+    radixSort(mortonCodes, m_PrimIndices, threadPool);
+
+    const auto splitCodes = [&](uint32_t first, uint32_t count, uint32_t, AABB* const) {
+        return splitMorton(mortonCodes.data(), first, count);
+    };
+
+    // Note: A Morton split is a binary search, so the large nodes need no
+    // help from the workers
+    const auto fragments = buildFragments(primCount, threadPool, splitCodes, splitCodes);
+
+    joinFragments(fragments, threadPool, m_Nodes, m_NodeInfos);
+
+    // Note: The splits only looked at the codes, so the node bounds are
+    // computed bottom-up once the hierarchy is complete
+    std::vector<AABB> slotBounds(primCount);
+
+    parallelFor(threadPool, primCount, [&](int, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            slotBounds[i] = primBounds[m_PrimIndices[i]];
+        }
+    });
+
+    refit(slotBounds, threadPool);
+}
+
+void BVH::refit(const std::vector<AABB>& slotBounds, ThreadPool* const threadPool) {
+    const uint32_t nodeCount = (uint32_t)m_Nodes.size();
+
+    const auto refitNode = [&](uint32_t nodeIndex) {
+        BVHNode& node = m_Nodes[nodeIndex];
+        AABB bounds{};
+
+        if (node.isLeaf()) {
+            for (uint32_t slot = node.getFirstPrim(); slot < node.getFirstPrim() + node.getPrimCount(); ++slot) {
+                bounds.grow(slotBounds[slot]);
+            }
+        }
+        else {
+            const BVHNode& left = m_Nodes[nodeIndex + 1];
+            const BVHNode& right = m_Nodes[left.skipIndex];
+
+            bounds.grow(AABB{ left.boundsMin, left.boundsMax });
+            bounds.grow(AABB{ right.boundsMin, right.boundsMax });
+        }
+
+        node.boundsMin = bounds.min;
+        node.boundsMax = bounds.max;
+    };
+
+    // Note: Children are stored after their parent, so walking a subtree
+    // backwards visits both children of a node before the node itself
+    const auto refitSubtree = [&](uint32_t rootIndex) {
+        for (uint32_t i = m_Nodes[rootIndex].skipIndex; i-- > rootIndex;) {
+            refitNode(i);
+        }
+    };
+
+    if (threadPool == nullptr || threadPool->getNumThreads() == 1 || nodeCount < MinTaskSize) {
+        if (nodeCount > 0) {
+            refitSubtree(0);
+        }
+
+        return;
+    }
+
+    // Note: Every subtree occupies the contiguous range [node, skipIndex), so
+    // the tree is cut into subtrees of at most grainSize nodes, which are
+    // refit in parallel. The nodes above the cut are refit afterwards, in
+    // the reverse of the depth-first order they were found in
+    const uint32_t grainSize = std::max(MinTaskSize, nodeCount / (4 * (uint32_t)threadPool->getNumThreads()));
+    std::vector<uint32_t> subtreeRoots;
+    std::vector<uint32_t> topNodes;
+    std::vector<uint32_t> stack = { 0 };
+
+    while (!stack.empty()) {
+        const uint32_t nodeIndex = stack.back();
+        stack.pop_back();
+
+        const BVHNode& node = m_Nodes[nodeIndex];
+
+        if (node.skipIndex - nodeIndex <= grainSize) {
+            subtreeRoots.push_back(nodeIndex);
+        }
+        else {
+            topNodes.push_back(nodeIndex);
+            stack.push_back(m_Nodes[nodeIndex + 1].skipIndex);
+            stack.push_back(nodeIndex + 1);
+        }
+    }
+
+    std::atomic<uint32_t> nextSubtree = 0;
+
+    threadPool->run([&](int) {
+        for (uint32_t i = nextSubtree++; i < subtreeRoots.size(); i = nextSubtree++) {
+            refitSubtree(subtreeRoots[i]);
+        }
+    });
+
+    for (size_t i = topNodes.size(); i-- > 0;) {
+        refitNode(topNodes[i]);
+    }
+}
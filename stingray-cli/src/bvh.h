@@ -0,0 +1,325 @@
+#pragma once
+
+#include "renderStats.h"
+#include "math/sray_math.h"
+
+#include <utility>
+#include <vector>
+
+class ThreadPool;
+
+enum class BVHBuilder : uint8_t {
+    SAH, // Note: Top-down binned SAH, best traversal performance
+    LBVH // Note: Linear BVH over sorted Morton codes, fastest to build
+};
+
+enum class BVHTraversal : uint8_t {
+    STACK, // Note: Front-to-back ordered traversal with a small node stack
+    STACKLESS // Note: Fixed-order traversal following the skip links
+};
+
+// Note: Nodes are stored in depth-first order, so the left child of an
+// interior node always directly follows its parent. The skip index points
+// to the node following the whole subtree, which doubles as the right child
+// of the parent when read from a left child
+struct alignas(32) BVHNode {
+    Vec3 boundsMin{};
+    uint32_t skipIndex = 0;
+    Vec3 boundsMax{};
+    uint32_t primData = 0; // Note: (firstPrim << 4) | primCount for leaves, zero for interior nodes
+
+    inline bool isLeaf() const { return primData != 0; }
+    inline uint32_t getFirstPrim() const { return primData >> 4; }
+    inline uint32_t getPrimCount() const { return primData & 0xf; }
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVH nodes must stay 32 bytes to share cache lines in pairs");
+
+// Note: Build-time data, kept out of the node array so that traversal only
+// touches the 32 byte nodes
+struct BVHNodeInfo {
+    uint32_t parentIndex = 0;
+    uint32_t depth = 0;
+};
+
+// Note: Binned surface area heuristic (SAH) bounding volume hierarchy. The
+// hierarchy only knows about primitive bounds, intersecting the primitives
+// themselves is left to the callback passed to intersect(). Leaves reference
+// contiguous ranges of primitive slots, where slot i holds the primitive
+// getPrimIndices()[i], and owners are expected to reorder their primitives
+// to match after building
+class BVH {
+public:
+    BVH() = default;
+    ~BVH() = default;
+
+    // Note: With a thread pool of more than one thread, subtrees are built
+    // as tasks on its workers, and the LBVH also computes and sorts the
+    // Morton codes in parallel. Must not be called from a job of that pool
+    void build(
+        const std::vector<AABB>& primBounds,
+        BVHBuilder builder = BVHBuilder::SAH,
+        ThreadPool* const threadPool = nullptr
+    );
+
+    // Note: Recomputes the bounds of all nodes bottom-up after primitives
+    // moved, keeping the topology. The bounds are indexed by slot, i.e. in
+    // the order of the primitives after the owner reordered them. Disjoint
+    // subtrees are refit in parallel when a thread pool is given
+    void refit(const std::vector<AABB>& slotBounds, ThreadPool* const threadPool = nullptr);
+
+    // Note: The callback has the signature
+    // bool(uint32_t firstSlot, uint32_t slotCount, float& tMax), is invoked
+    // once per leaf, and should shrink tMax and return true when one of the
+    // primitives in the leaf is hit closer than tMax
+    template<typename IntersectFunc>
+    bool intersect(const Ray& ray, float tMin, float tMax, IntersectFunc&& intersectPrims) const;
+
+    template<typename IntersectFunc>
+    bool intersectStackless(const Ray& ray, float tMin, float tMax, IntersectFunc&& intersectPrims) const;
+
+    // Note: Any-hit query, the callback has the signature
+    // bool(uint32_t firstSlot, uint32_t slotCount) and should return true as
+    // soon as any primitive in the leaf is hit within (tMin, tMax). The
+    // traversal then ends immediately, so children are not sorted either
+    template<typename OccludedFunc>
+    bool occluded(const Ray& ray, float tMin, float tMax, OccludedFunc&& occludedPrims) const;
+
+    template<typename OccludedFunc>
+    bool occludedStackless(const Ray& ray, float tMin, float tMax, OccludedFunc&& occludedPrims) const;
+
+    // Note: Expected cost of a ray that hits the root, in primitive tests
+    float computeSAHCost() const;
+
+    // Note: Sum of the surface area times the cost over all nodes, which
+    // unlike computeSAHCost() does not improve when the root grows, and so
+    // compares the hierarchies of a moving scene
+    float computeAbsoluteSAHCost() const;
+
+    inline bool isEmpty() const { return m_Nodes.empty(); }
+    inline size_t getNodeCount() const { return m_Nodes.size(); }
+    inline const std::vector<BVHNode>& getNodes() const { return m_Nodes; }
+    inline const std::vector<BVHNodeInfo>& getNodeInfos() const { return m_NodeInfos; }
+    inline const std::vector<uint32_t>& getPrimIndices() const { return m_PrimIndices; }
+
+private:
+    struct StackEntry {
+        uint32_t nodeIndex;
+        float tNear;
+    };
+
+    static constexpr int MaxDepth = 128;
+
+    void buildNode(
+        uint32_t first,
+        uint32_t count,
+        uint32_t parentIndex,
+        uint32_t depth,
+        const std::vector<AABB>& primBounds,
+        const std::vector<Vec3>& centroids
+    );
+
+    void buildParallelSAH(const std::vector<AABB>& primBounds, const std::vector<Vec3>& centroids, ThreadPool* const threadPool);
+    void buildLinear(const std::vector<AABB>& primBounds, const std::vector<Vec3>& centroids, ThreadPool* const threadPool);
+
+    std::vector<BVHNode> m_Nodes;
+
+    // Cold data
+    std::vector<BVHNodeInfo> m_NodeInfos;
+    std::vector<uint32_t> m_PrimIndices;
+};
+
+inline float intersectNode(
+    const BVHNode& node,
+    const Vec3& origin,
+    const Vec3& invDir,
+    float tMin,
+    float tMax) {
+
+    return intersectAABB({ node.boundsMin, node.boundsMax }, origin, invDir, tMin, tMax);
+}
+
+template<typename IntersectFunc>
+bool BVH::intersect(const Ray& ray, float tMin, float tMax, IntersectFunc&& intersectPrims) const {
+    if (m_Nodes.empty()) {
+        return false;
+    }
+
+    const Vec3 invDir = safeInverse(ray.dir);
+    float closestT = tMax;
+    bool anyHit = false;
+
+    if (intersectNode(m_Nodes[0], ray.origin, invDir, tMin, closestT) == Infinity) {
+        return false;
+    }
+
+    StackEntry stack[MaxDepth];
+    int stackSize = 0;
+    uint32_t nodeIndex = 0;
+
+    while (true) {
+        const BVHNode& node = m_Nodes[nodeIndex];
+        SRAY_COUNT(bvhNodesVisited, 1);
+
+        if (node.isLeaf()) {
+            if (intersectPrims(node.getFirstPrim(), node.getPrimCount(), closestT)) {
+                anyHit = true;
+            }
+        }
+        else {
+            // Visit the nearest child first, so that closestT shrinks as
+            // early as possible and culls the farther subtree
+            uint32_t nearIndex = nodeIndex + 1;
+            uint32_t farIndex = m_Nodes[nearIndex].skipIndex;
+            float tNear = intersectNode(m_Nodes[nearIndex], ray.origin, invDir, tMin, closestT);
+            float tFar = intersectNode(m_Nodes[farIndex], ray.origin, invDir, tMin, closestT);
+
+            if (tFar < tNear) {
+                std::swap(nearIndex, farIndex);
+                std::swap(tNear, tFar);
+            }
+
+            if (tNear != Infinity) {
+                if (tFar != Infinity) {
+                    stack[stackSize++] = { farIndex, tFar };
+                }
+
+                nodeIndex = nearIndex;
+                continue;
+            }
+        }
+
+        // Pop the next subtree that can still contain a closer hit
+        while (stackSize > 0 && stack[stackSize - 1].tNear > closestT) {
+            --stackSize;
+        }
+
+        if (stackSize == 0) {
+            break;
+        }
+
+        nodeIndex = stack[--stackSize].nodeIndex;
+    }
+
+    return anyHit;
+}
+
+template<typename IntersectFunc>
+bool BVH::intersectStackless(const Ray& ray, float tMin, float tMax, IntersectFunc&& intersectPrims) const {
+    const Vec3 invDir = safeInverse(ray.dir);
+    const uint32_t nodeCount = (uint32_t)m_Nodes.size();
+    float closestT = tMax;
+    bool anyHit = false;
+    uint32_t nodeIndex = 0;
+
+    // Note: Without a stack the children are always visited in depth-first
+    // order, so the traversal state is just the current node and closestT
+    while (nodeIndex < nodeCount) {
+        const BVHNode& node = m_Nodes[nodeIndex];
+        SRAY_COUNT(bvhNodesVisited, 1);
+
+        if (intersectNode(node, ray.origin, invDir, tMin, closestT) == Infinity) {
+            nodeIndex = node.skipIndex;
+            continue;
+        }
+
+        if (!node.isLeaf()) {
+            ++nodeIndex;
+            continue;
+        }
+
+        if (intersectPrims(node.getFirstPrim(), node.getPrimCount(), closestT)) {
+            anyHit = true;
+        }
+
+        nodeIndex = node.skipIndex;
+    }
+
+    return anyHit;
+}
+
+template<typename OccludedFunc>
+bool BVH::occluded(const Ray& ray, float tMin, float tMax, OccludedFunc&& occludedPrims) const {
+    if (m_Nodes.empty()) {
+        return false;
+    }
+
+    const Vec3 invDir = safeInverse(ray.dir);
+
+    if (intersectNode(m_Nodes[0], ray.origin, invDir, tMin, tMax) == Infinity) {
+        return false;
+    }
+
+    uint32_t stack[MaxDepth];
+    int stackSize = 0;
+    uint32_t nodeIndex = 0;
+
+    while (true) {
+        const BVHNode& node = m_Nodes[nodeIndex];
+        SRAY_COUNT(bvhNodesVisited, 1);
+
+        if (node.isLeaf()) {
+            if (occludedPrims(node.getFirstPrim(), node.getPrimCount())) {
+                return true;
+            }
+        }
+        else {
+            const uint32_t leftIndex = nodeIndex + 1;
+            const uint32_t rightIndex = m_Nodes[leftIndex].skipIndex;
+            const bool hitLeft = intersectNode(m_Nodes[leftIndex], ray.origin, invDir, tMin, tMax) != Infinity;
+            const bool hitRight = intersectNode(m_Nodes[rightIndex], ray.origin, invDir, tMin, tMax) != Infinity;
+
+            if (hitLeft) {
+                if (hitRight) {
+                    stack[stackSize++] = rightIndex;
+                }
+
+                nodeIndex = leftIndex;
+                continue;
+            }
+
+            if (hitRight) {
+                nodeIndex = rightIndex;
+                continue;
+            }
+        }
+
+        if (stackSize == 0) {
+            break;
+        }
+
+        nodeIndex = stack[--stackSize];
+    }
+
+    return false;
+}
+
+template<typename OccludedFunc>
+bool BVH::occludedStackless(const Ray& ray, float tMin, float tMax, OccludedFunc&& occludedPrims) const {
+    const Vec3 invDir = safeInverse(ray.dir);
+    const uint32_t nodeCount = (uint32_t)m_Nodes.size();
+    uint32_t nodeIndex = 0;
+
+    while (nodeIndex < nodeCount) {
+        const BVHNode& node = m_Nodes[nodeIndex];
+        SRAY_COUNT(bvhNodesVisited, 1);
+
+        if (intersectNode(node, ray.origin, invDir, tMin, tMax) == Infinity) {
+            nodeIndex = node.skipIndex;
+            continue;
+        }
+
+        if (!node.isLeaf()) {
+            ++nodeIndex;
+            continue;
+        }
+
+        if (occludedPrims(node.getFirstPrim(), node.getPrimCount())) {
+            return true;
+        }
+
+        nodeIndex = node.skipIndex;
+    }
+
+    return false;
+}
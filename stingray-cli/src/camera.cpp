@@ -1,9 +1,19 @@
 #include "camera.h"
 #include "material.h"
+#include "utility/perfTimer.h"
 
 #include <algorithm>
 #include <limits>
-#include <thread>
+#include <vector>
+
+namespace {
+    // Note: Number of samples between two convergence checks of a pixel
+    constexpr uint32_t AdaptiveCheckInterval = 4;
+
+    // Note: Luminance below which the error is no longer measured relative to
+    // the mean, otherwise near-black pixels would never converge
+    constexpr float AdaptiveMinLuminance = 0.05f;
+}
 
 Camera::Camera(int width, int height) :
     imageWidth(width), imageHeight(height) {
@@ -11,27 +21,49 @@ Camera::Camera(int width, int height) :
     m_AspectRatio = (float)imageWidth / imageHeight;
 }
 
-void Camera::render(const Scene& scene, uint32_t* const imageBuffer) {
+void Camera::render(const Scene& scene, uint32_t* const imageBuffer, ThreadPool& threadPool) {
+    m_Accumulation.resize(imageWidth, imageHeight);
+    resetStats();
+
+    renderPass(scene, m_Accumulation, samplesPerPixel, threadPool);
+    m_Accumulation.resolve(imageBuffer);
+}
+
+void Camera::renderPass(
+    const Scene& scene,
+    AccumulationBuffer& accumulation,
+    int numSamples,
+    ThreadPool& threadPool,
+    Framebuffer* const framebuffer) {
+
     initialize();
+    m_NextRow = 0;
+    m_Framebuffer = framebuffer;
+
+    if (m_Framebuffer != nullptr) {
+        m_RowPixelsDone = std::make_unique<std::atomic<int>[]>(imageHeight);
 
-    std::vector<std::thread> threads(numThreads);
+        for (int y = 0; y < imageHeight; ++y) {
+            m_RowPixelsDone[y] = 0;
+        }
+    }
 
-    for (size_t i = 0; i < numThreads; ++i) {
-        threads[i] = std::thread(
-            &Camera::renderChunk,
-            this,
-            imageBuffer,
-            imageWidth,
-            imageHeight,
-            scene
-        );
+    if (measurePixelCosts && (m_CostMap.getWidth() != imageWidth || m_CostMap.getHeight() != imageHeight)) {
+        m_CostMap.resize(imageWidth, imageHeight);
     }
 
-    // Wait for all threads to finish execution
-    for (auto& thread : threads) {
-        if (thread.joinable()) {
-            thread.join();
-        }
+    if (scheduler == RenderScheduler::TILES) {
+        m_TileScheduler.reset(imageWidth, imageHeight, tileSize, threadPool.getNumThreads());
+    }
+
+    m_WorkerStats.assign(threadPool.getNumThreads(), RenderStats{});
+
+    threadPool.run([&](int workerIndex) {
+        renderChunk(workerIndex, accumulation, numSamples, scene);
+    });
+
+    for (const RenderStats& workerStats : m_WorkerStats) {
+        m_Stats += workerStats;
     }
 }
 
@@ -58,93 +90,426 @@ void Camera::initialize() {
     m_DefocusDiskY = m_V * defocusRadius;
 }
 
-void Camera::renderChunk(
-    uint32_t* const imageBuffer,
-    int imageWidth,
-    int imageHeight,
-    const Scene& scene) {
+void Camera::renderChunk(int workerIndex, AccumulationBuffer& accumulation, int numSamples, const Scene& scene) {
+    RenderStats& stats = m_WorkerStats[workerIndex];
+    bindRenderStats(&stats);
 
-    uint32_t seed = std::hash<std::thread::id>()(std::this_thread::get_id()) + 1;
+    // Note: The counters only advance on this worker while it renders the
+    // pixel, so their difference is the cost of that pixel alone
+    auto shadePixel = [&](int x, int y) {
+        if (!measurePixelCosts) {
+            return renderPixel(x, y, numSamples, accumulation.getSamples(x, y), scene, &stats);
+        }
 
-    while (true) {
-        // Determine which row the thread should process next
-        const int row = m_NextRow.fetch_add(1);
+#if SRAY_RENDER_COUNTERS
+        const uint64_t startTests = stats.intersectionTests;
+        const uint64_t startNodes = stats.bvhNodesVisited;
+#endif
+        const uint64_t startCycles = readCycleCounter();
 
-        if (row >= imageHeight) {
-            break;
+        const PixelSamples samples = renderPixel(x, y, numSamples, accumulation.getSamples(x, y), scene, &stats);
+
+        PixelCost cost{};
+        cost.cycles = readCycleCounter() - startCycles;
+#if SRAY_RENDER_COUNTERS
+        cost.intersectionTests = stats.intersectionTests - startTests;
+        cost.bvhNodesVisited = stats.bvhNodesVisited - startNodes;
+#endif
+        m_CostMap.add(x, y, cost);
+
+        return samples;
+    };
+
+    if (scheduler == RenderScheduler::ROWS) {
+        while (true) {
+            // Determine which row the thread should process next
+            const int row = m_NextRow.fetch_add(1);
+
+            if (row >= imageHeight) {
+                break;
+            }
+
+            for (int x = 0; x < imageWidth; ++x) {
+                accumulation.add(x, row, shadePixel(x, row));
+            }
+
+            completeRowPixels(accumulation, row, imageWidth);
         }
+    }
+    else {
+        // Note: Tiles are rendered into a thread-local buffer and added to
+        // the accumulation buffer row by row, so that threads never write to
+        // the same cache lines while rendering
+        std::vector<PixelSamples> tileBuffer((size_t)tileSize * tileSize);
+        Tile tile{};
+
+        while (m_TileScheduler.next(workerIndex, &tile)) {
+            const int tileWidth = tile.x1 - tile.x0;
+
+            for (int y = tile.y0; y < tile.y1; ++y) {
+                for (int x = tile.x0; x < tile.x1; ++x) {
+                    tileBuffer[(y - tile.y0) * tileWidth + (x - tile.x0)] = shadePixel(x, y);
+                }
+            }
 
-        for (int x = 0; x < imageWidth; ++x) {
-            Vec3 pixelColor = { 0.0f, 0.0f, 0.0f };
+            for (int y = tile.y0; y < tile.y1; ++y) {
+                for (int x = tile.x0; x < tile.x1; ++x) {
+                    accumulation.add(x, y, tileBuffer[(y - tile.y0) * tileWidth + (x - tile.x0)]);
+                }
 
-            for (int sample = 0; sample < samplesPerPixel; ++sample) {
-                const Ray ray = generateRay(x, row, &seed);
-                pixelColor += computeColor(ray, scene, maxDepth, &seed);
+                completeRowPixels(accumulation, y, tileWidth);
             }
+        }
+    }
 
-            const float scale = 1.0f / samplesPerPixel;
-            pixelColor *= scale;
+    bindRenderStats(nullptr);
+}
 
-            // Linear to Gamma space transform
-            pixelColor.x = linearToGamma(pixelColor.x);
-            pixelColor.y = linearToGamma(pixelColor.y);
-            pixelColor.z = linearToGamma(pixelColor.z);
+PixelSamples Camera::renderPixel(
+    int x,
+    int y,
+    int numSamples,
+    const PixelSamples& previousSamples,
+    const Scene& scene,
+    RenderStats* stats) const {
 
-            pixelColor.x = std::clamp(pixelColor.x, 0.0f, 0.999f);
-            pixelColor.y = std::clamp(pixelColor.y, 0.0f, 0.999f);
-            pixelColor.z = std::clamp(pixelColor.z, 0.0f, 0.999f);
+    PixelSamples samples{};
 
-            imageBuffer[row * imageWidth + x] = rgbToHex(pixelColor);
+    if (adaptiveSampling && hasConverged(previousSamples)) {
+        return samples;
+    }
+
+    for (int sample = 0; sample < numSamples; ++sample) {
+        // Note: Samples are numbered per pixel across all passes, so that
+        // every sample draws its own random numbers regardless of which
+        // thread renders it and how the image was split into passes
+        const uint32_t sampleIndex = previousSamples.sampleCount + samples.sampleCount;
+        Sampler sampler(samplerType, x, y, (uint32_t)(y * imageWidth + x), sampleIndex, seed);
+
+        const Ray ray = generateRay(x, y, &sampler);
+        SurfaceFeatures features{};
+
+        const Vec3 radiance = (integrator == Integrator::AMBIENT_OCCLUSION)
+            ? computeAmbientOcclusion(ray, scene, &sampler, stats, &features)
+            : computeColor(ray, scene, &sampler, stats, &features);
+        samples.add(radiance, features);
+
+        if (adaptiveSampling && samples.sampleCount % AdaptiveCheckInterval == 0) {
+            PixelSamples totalSamples = previousSamples;
+            totalSamples += samples;
+
+            if (hasConverged(totalSamples)) {
+                break;
+            }
         }
     }
+
+    stats->primaryRays += samples.sampleCount;
+
+    return samples;
 }
 
-Vec3 Camera::computeColor(const Ray& ray, const Scene& scene, int depth, uint32_t* seed) const {
-    HitData hit{};
+bool Camera::hasConverged(const PixelSamples& samples) const {
+    const uint32_t n = samples.sampleCount;
+
+    if (n < (uint32_t)std::max(minSamplesPerPixel, 2)) {
+        return false;
+    }
+
+    // Note: Unbiased sample variance of the luminance, from which follows
+    // the standard error of the pixel mean
+    const float mean = luminance(samples.radianceSum) / n;
+    const float variance = std::max(samples.luminanceSquareSum / n - mean * mean, 0.0f) * n / (n - 1);
+    const float standardError = sqrtf(variance / n);
+
+    return standardError <= adaptiveThreshold * std::max(mean, AdaptiveMinLuminance);
+}
+
+void Camera::completeRowPixels(const AccumulationBuffer& accumulation, int y, int pixelCount) {
+    if (m_Framebuffer == nullptr) {
+        return;
+    }
+
+    // Note: Whichever thread finishes the last pixels of a row resolves it,
+    // at which point no other thread writes to that row anymore
+    if (m_RowPixelsDone[y].fetch_add(pixelCount, std::memory_order_acq_rel) + pixelCount == imageWidth) {
+        resolveFramebufferRow(accumulation, y);
+    }
+}
+
+void Camera::resolveFramebufferRow(const AccumulationBuffer& accumulation, int y) {
+    Framebuffer& framebuffer = *m_Framebuffer;
+
+    // Note: Channels the framebuffer does not have are skipped
+    const auto writeChannel = [&](const char* name, const auto& value) {
+        const int channel = framebuffer.findChannel(name);
+
+        if (channel < 0) {
+            return;
+        }
+
+        if (framebuffer.getChannelType(channel) == ChannelType::UINT) {
+            uint32_t* const row = framebuffer.getUintRow(channel, y);
+
+            for (int x = 0; x < imageWidth; ++x) {
+                row[x] = (uint32_t)value(x);
+            }
+        }
+        else {
+            float* const row = framebuffer.getRow(channel, y);
+
+            for (int x = 0; x < imageWidth; ++x) {
+                row[x] = (float)value(x);
+            }
+        }
+    };
+
+    for (int i = 0; i < 3; ++i) {
+        const char* const beautyNames[3] = { AOVNames::BeautyR, AOVNames::BeautyG, AOVNames::BeautyB };
+        const char* const normalNames[3] = { AOVNames::NormalX, AOVNames::NormalY, AOVNames::NormalZ };
+        const char* const albedoNames[3] = { AOVNames::AlbedoR, AOVNames::AlbedoG, AOVNames::AlbedoB };
+
+        writeChannel(beautyNames[i], [&](int x) { return accumulation.getMean(x, y)[i]; });
+        writeChannel(normalNames[i], [&](int x) { return accumulation.getMeanFeatures(x, y).normal[i]; });
+        writeChannel(albedoNames[i], [&](int x) { return accumulation.getMeanFeatures(x, y).albedo[i]; });
+    }
 
-    if (depth <= 0) {
-        return { 0.0f, 0.0f, 0.0f };
+    writeChannel(AOVNames::Depth, [&](int x) { return accumulation.getMeanFeatures(x, y).depth; });
+    // Note: The ids keep their bits, so a pixel without a hit reads 0xffffffff
+    writeChannel(AOVNames::ObjectId, [&](int x) { return accumulation.getMeanFeatures(x, y).objectId; });
+    writeChannel(AOVNames::PrimitiveId, [&](int x) { return accumulation.getMeanFeatures(x, y).primitiveId; });
+    writeChannel(AOVNames::SampleCount, [&](int x) { return (float)accumulation.getSampleCount(x, y); });
+
+    if (framebuffer.rowListener) {
+        framebuffer.rowListener(framebuffer, y);
     }
+}
+
+Vec3 Camera::computeColor(
+    const Ray& primaryRay,
+    const Scene& scene,
+    Sampler* sampler,
+    RenderStats* stats,
+    SurfaceFeatures* const features) const {
+
+    Vec3 radiance = { 0.0f, 0.0f, 0.0f };
+    Vec3 throughput = { 1.0f, 1.0f, 1.0f };
+    Ray ray = primaryRay;
+    int pathLength = 0;
+
+    // Note: State of the previous bounce, needed to weight emission found by
+    // BSDF sampling against the light sample taken at the previous vertex
+    const bool sampleLights = nextEventEstimation && !scene.lights.isEmpty();
+    bool lastBounceSpecular = true;
+    float lastBsdfPdf = 0.0f;
+    Vec3 lastPosition{};
+
+    // Note: Guide buffers for the denoiser are recorded on the primary
+    // bounce. Mirrors and glass would otherwise hide everything reflected in
+    // them from the denoiser, so these record the first diffuse surface seen
+    // through them instead, tinted by the specular throughput
+    bool recordFeatures = true;
+    float pathDistance = 0.0f;
 
     // Note: Due to floating point rounding errors, we must add an
     // arbitrary value (epsilon) to the intersection point
     // in order to eliminate self-intersection
     const float epsilon = 0.001f;
-    if (scene.hit(ray, epsilon, std::numeric_limits<float>::infinity(), &hit)) {
+
+    while (true) {
+        if (pathLength >= maxDepth) {
+            stats->pathsTerminatedByMaxDepth++;
+            break;
+        }
+
+        HitRecord record{};
+        ++pathLength;
+
+        if (!scene.intersect(ray, epsilon, std::numeric_limits<float>::infinity(), &record)) {
+            const Vec3 unitDirection = normalize(ray.dir);
+            const float a = 0.5f * (unitDirection.y + 1.0f);
+            const Vec3 skyColor = skyIntensity * ((1.0f - a) * Vec3{ 1.0f, 1.0f, 1.0f } + a * Vec3{ 0.5f, 0.7f, 1.0f });
+
+            if (recordFeatures) {
+                features->albedo = throughput * skyColor;
+            }
+
+            radiance += throughput * skyColor;
+            stats->pathsEscaped++;
+            break;
+        }
+
+        // Note: Attributes are only computed for the final closest hit
+        HitData hit{};
+        scene.computeHitData(ray, record, &hit);
+        stats->attributeComputationsAvoided += record.candidateCount - 1;
+
+        const Material& material = scene.materials[hit.materialId];
+
+        pathDistance += hit.t * ray.dir.length();
+
+        if (pathLength == 1) {
+            features->objectId = (int32_t)scene.getObjectId(record);
+            features->primitiveId = (int32_t)scene.getPrimitiveId(record);
+        }
+
+        if (recordFeatures) {
+            features->albedo = throughput * material.getAlbedo();
+            features->normal = hit.normal;
+            features->depth = pathDistance;
+            recordFeatures = material.isSpecular();
+        }
+
+        // Note: Lights only emit from their front face
+        if (material.type == MaterialType::EMISSIVE && hit.frontFace) {
+            float misWeight = 1.0f;
+
+            if (sampleLights && !lastBounceSpecular) {
+                const float lightPdf = scene.lights.pdf(record.objectIndex, record.primId, lastPosition, hit.position);
+                misWeight = powerHeuristic(lastBsdfPdf, lightPdf);
+            }
+
+            radiance += throughput * material.getEmission() * misWeight;
+        }
+
+        // Note: Only the diffuse BSDF can be evaluated for an arbitrary
+        // direction, specular bounces are left to BSDF sampling alone. The
+        // light sample values are drawn on every bounce regardless, so that
+        // every bounce uses the same sampler dimensions whatever was hit
+        if (sampleLights) {
+            const float uSelect = sampler->get1D();
+            const Vec2 uLight = sampler->get2D();
+            LightSample lightSample{};
+
+            if (material.type == MaterialType::DIFFUSE && scene.lights.sample(hit.position, uSelect, uLight, &lightSample)) {
+                const float cosTheta = dot(hit.normal, lightSample.direction);
+
+                if (cosTheta > 0.0f) {
+                    const Ray shadowRay = { hit.position, lightSample.direction, ray.time };
+                    stats->occlusionRays++;
+
+                    // Note: The light itself must not occlude the sample, so the
+                    // search stops just short of the sampled point
+                    if (!scene.occluded(shadowRay, epsilon, lightSample.distance * (1.0f - 1e-4f))) {
+                        const float bsdfPdf = cosTheta * (1.0f / Pi);
+                        const Vec3 bsdf = material.getAlbedo() * (1.0f / Pi);
+                        const float misWeight = powerHeuristic(lightSample.pdf, bsdfPdf);
+
+                        radiance += throughput * bsdf * lightSample.emission * (cosTheta * misWeight / lightSample.pdf);
+                    }
+                }
+            }
+        }
+
         Ray scattered{};
         Vec3 attenuation{};
 
-        if (hit.material->scatter(ray, hit, &attenuation, &scattered, seed)) {
-            return attenuation * computeColor(scattered, scene, depth - 1, seed);
+        SRAY_COUNT(scatterCounts[(int)material.type], 1);
+
+        if (!material.scatter(ray, hit, &attenuation, &scattered, sampler)) {
+            stats->pathsAbsorbed++;
+            break;
         }
 
-        return { 0.0f, 0.0f, 0.0f };
+        throughput = throughput * attenuation;
+        ray = scattered;
+
+        lastBounceSpecular = material.isSpecular();
+        lastPosition = hit.position;
+
+        if (!lastBounceSpecular) {
+            lastBsdfPdf = fmaxf(dot(hit.normal, normalize(scattered.dir)), 0.0f) * (1.0f / Pi);
+        }
+
+        // Note: Russian roulette keeps the estimator unbiased by dividing the
+        // throughput of surviving paths by their survival probability
+        if (rouletteDepth >= 0 && pathLength >= rouletteDepth) {
+            const float survival = std::min(fmaxf(throughput.x, fmaxf(throughput.y, throughput.z)), 0.95f);
+
+            if (survival <= 0.0f || sampler->get1D() >= survival) {
+                stats->pathsTerminatedByRoulette++;
+                break;
+            }
+
+            throughput *= 1.0f / survival;
+        }
+    }
+
+    stats->secondaryRays += pathLength - 1;
+    stats->pathLengthHistogram[std::min(pathLength, RenderStats::PathLengthBins - 1)]++;
+
+    return radiance;
+}
+
+// Note: Cosine-weighted directions make the visibility of a single ray an
+// unbiased estimate of ambient occlusion, so every sample casts one
+// occlusion ray from the primary hit. There are no paths, so the path
+// statistics are left untouched
+Vec3 Camera::computeAmbientOcclusion(
+    const Ray& primaryRay,
+    const Scene& scene,
+    Sampler* sampler,
+    RenderStats* stats,
+    SurfaceFeatures* const features) const {
+
+    const float epsilon = 0.001f;
+    HitRecord record{};
+
+    if (!scene.intersect(primaryRay, epsilon, std::numeric_limits<float>::infinity(), &record)) {
+        features->albedo = { 1.0f, 1.0f, 1.0f };
+        return { 1.0f, 1.0f, 1.0f };
     }
 
-    const Vec3 unit_direction = normalize(ray.dir);
-    const float a = 0.5f * (unit_direction.y + 1.0f);
-    return (1.0f - a)* Vec3{ 1.0f, 1.0f, 1.0f } + a * Vec3{ 0.5f, 0.7f, 1.0f };
+    HitData hit{};
+    scene.computeHitData(primaryRay, record, &hit);
+    stats->attributeComputationsAvoided += record.candidateCount - 1;
+
+    features->albedo = { 1.0f, 1.0f, 1.0f };
+    features->normal = hit.normal;
+    features->depth = hit.t * primaryRay.dir.length();
+    features->objectId = (int32_t)scene.getObjectId(record);
+    features->primitiveId = (int32_t)scene.getPrimitiveId(record);
+
+    Vec3 direction = hit.normal + sampleUnitSphere(sampler->get2D());
+
+    // Note: Catch degenerate directions, like the diffuse material does
+    if (direction.isNearZero()) {
+        direction = hit.normal;
+    }
+
+    const Ray aoRay = { hit.position, direction, primaryRay.time };
+    stats->occlusionRays++;
+
+    // Note: The ray direction is not normalized, so the distance is scaled
+    const float tMax = aoDistance / direction.length();
+
+    return scene.occluded(aoRay, epsilon, tMax) ? Vec3{ 0.0f, 0.0f, 0.0f } : Vec3{ 1.0f, 1.0f, 1.0f };
 }
 
-Ray Camera::generateRay(int x, int y, uint32_t* seed) const {
+Ray Camera::generateRay(int x, int y, Sampler* sampler) const {
     const Vec3 pixelCenter = m_PixelTopLeft + (x * m_PixelDeltaX) + (y * m_PixelDeltaY);
-    const Vec3 pixelSample = pixelCenter + pixelSampleSquare(seed);
+    const Vec3 pixelSample = pixelCenter + pixelSampleSquare(sampler);
 
-    const Vec3 rayOrigin = (defocusAngle > 0.0f) ? defocusDiskSample(seed) : position;
+    const Vec3 rayOrigin = (defocusAngle > 0.0f) ? defocusDiskSample(sampler) : position;
     const Vec3 rayDir = pixelSample - rayOrigin;
 
-    return { rayOrigin, rayDir };
+    // Note: Without motion blur no dimension is spent on the time, so that
+    // still renders keep their samples
+    const float rayTime = motionBlur ? sampler->get1D() : 0.0f;
+
+    return { rayOrigin, rayDir, rayTime };
 }
 
-Vec3 Camera::pixelSampleSquare(uint32_t* seed) const {
-    const float x = -0.5f + randomFloat(seed);
-    const float y = -0.5f + randomFloat(seed);
+Vec3 Camera::pixelSampleSquare(Sampler* sampler) const {
+    const Vec2 u = sampler->get2D();
+    const float x = -0.5f + u.x;
+    const float y = -0.5f + u.y;
 
     return x * m_PixelDeltaX + y * m_PixelDeltaY;
 }
 
-Vec3 Camera::defocusDiskSample(uint32_t* seed) const {
-    const Vec3 p = randomVec3InUnitDisk(seed);
+Vec3 Camera::defocusDiskSample(Sampler* sampler) const {
+    const Vec3 p = sampleUnitDisk(sampler->get2D());
 
     return position + (p.x * m_DefocusDiskX) + (p.y * m_DefocusDiskY);
 }
@@ -1,9 +1,28 @@
 #pragma once
 
+#include "accumulationBuffer.h"
+#include "costMap.h"
+#include "framebuffer.h"
+#include "renderStats.h"
+#include "sampler.h"
 #include "scene.h"
+#include "tileScheduler.h"
 #include "math/sray_math.h"
+#include "utility/threadPool.h"
 
 #include <atomic>
+#include <memory>
+#include <vector>
+
+enum class RenderScheduler : uint8_t {
+    ROWS, // Note: Whole rows handed out through a shared counter
+    TILES // Note: Morton ordered tiles with per-thread queues and work stealing
+};
+
+enum class Integrator : uint8_t {
+    PATH,
+    AMBIENT_OCCLUSION // Note: Fraction of the hemisphere above the primary hit left unoccluded within aoDistance
+};
 
 class Camera {
 public:
@@ -21,25 +40,101 @@ public:
     int imageHeight = 128;
     int samplesPerPixel = 100;
     int maxDepth = 10;
-    int numThreads = 1;
+    int rouletteDepth = 5; // Note: Path length after which Russian roulette may end paths, negative disables it
+    RenderScheduler scheduler = RenderScheduler::TILES;
+    int tileSize = 16;
+    SamplerType samplerType = SamplerType::SOBOL;
+    uint32_t seed = 0; // Note: Renders with the same seed are bit-identical
+    float skyIntensity = 1.0f;
+
+    // Note: Next event estimation samples a light at every diffuse hit and
+    // combines it with hitting lights by BSDF sampling through multiple
+    // importance sampling. Disabling it leaves only the BSDF strategy
+    bool nextEventEstimation = true;
+
+    // Note: Samples a shutter time in [0, 1] for every camera ray. Moving
+    // primitives are at their start position at 0 and at their end at 1
+    bool motionBlur = false;
+
+    Integrator integrator = Integrator::PATH;
+    float aoDistance = 1.0f;
 
-    void render(const Scene& scene, uint32_t* const imageBuffer);
+    // Note: With adaptive sampling a pixel stops taking samples once the
+    // standard error of its mean luminance falls below adaptiveThreshold
+    // relative to the mean. samplesPerPixel becomes the upper bound
+    bool adaptiveSampling = false;
+    int minSamplesPerPixel = 16;
+    float adaptiveThreshold = 0.02f;
+
+    // Note: Measures the cost of every pixel into a cost map, summed over
+    // passes like the statistics. The cycles include sampling and shading,
+    // not just traversal
+    bool measurePixelCosts = false;
+
+    // Note: Renders samplesPerPixel samples on every worker of the pool,
+    // which all share the same scene. Can be called repeatedly on the same camera
+    void render(const Scene& scene, uint32_t* const imageBuffer, ThreadPool& threadPool);
+
+    // Note: Progressive rendering, adds numSamples more samples to every
+    // pixel of the accumulation buffer, which must match the image size.
+    // The image can be read out between passes with AccumulationBuffer::resolve().
+    // If a framebuffer is given, every row is resolved into its AOV channels
+    // as soon as all of its pixels are done with the pass
+    void renderPass(
+        const Scene& scene,
+        AccumulationBuffer& accumulation,
+        int numSamples,
+        ThreadPool& threadPool,
+        Framebuffer* const framebuffer = nullptr
+    );
+
+    // Note: Statistics and pixel costs accumulated over all passes since the
+    // last reset, render() resets them itself
+    inline const RenderStats& getStats() const { return m_Stats; }
+    inline const CostMap& getCostMap() const { return m_CostMap; }
+    inline void resetStats() { m_Stats = {}; m_CostMap.clear(); }
 
 private:
     void initialize();
-    void renderChunk(
-        uint32_t* const imageBuffer,
-        int imageWidth,
-        int imageHeight,
-        const Scene& scene
-    );
+    void renderChunk(int workerIndex, AccumulationBuffer& accumulation, int numSamples, const Scene& scene);
+    PixelSamples renderPixel(
+        int x,
+        int y,
+        int numSamples,
+        const PixelSamples& previousSamples,
+        const Scene& scene,
+        RenderStats* stats
+    ) const;
+    bool hasConverged(const PixelSamples& samples) const;
+    void completeRowPixels(const AccumulationBuffer& accumulation, int y, int pixelCount);
+    void resolveFramebufferRow(const AccumulationBuffer& accumulation, int y);
 
-    Vec3 computeColor(const Ray& ray, const Scene& scene, int depth, uint32_t* seed) const;
-    Ray generateRay(int x, int y, uint32_t* seed) const;
-    Vec3 pixelSampleSquare(uint32_t* seed) const;
-    Vec3 defocusDiskSample(uint32_t* seed) const;
+    Vec3 computeColor(
+        const Ray& primaryRay,
+        const Scene& scene,
+        Sampler* sampler,
+        RenderStats* stats,
+        SurfaceFeatures* const features
+    ) const;
+    Vec3 computeAmbientOcclusion(
+        const Ray& primaryRay,
+        const Scene& scene,
+        Sampler* sampler,
+        RenderStats* stats,
+        SurfaceFeatures* const features
+    ) const;
+    Ray generateRay(int x, int y, Sampler* sampler) const;
+    Vec3 pixelSampleSquare(Sampler* sampler) const;
+    Vec3 defocusDiskSample(Sampler* sampler) const;
 
     std::atomic<int> m_NextRow{ 0 };
+    TileScheduler m_TileScheduler{};
+    AccumulationBuffer m_Accumulation{};
+    Framebuffer* m_Framebuffer = nullptr;
+    std::unique_ptr<std::atomic<int>[]> m_RowPixelsDone;
+    RenderStats m_Stats{};
+    std::vector<RenderStats> m_WorkerStats; // Note: One block per worker, merged into m_Stats after every pass
+    CostMap m_CostMap{};
     float m_AspectRatio = 1.0f;
     Vec3 m_PixelDeltaX{};
     Vec3 m_PixelDeltaY{};
@@ -0,0 +1,92 @@
+#include "costMap.h"
+#include "math/sray_math.h"
+
+#include <algorithm>
+
+namespace {
+    constexpr float HeatmapPercentile = 0.99f;
+
+    uint64_t getCost(const PixelCost& cost, CostMetric metric) {
+        switch (metric) {
+        case CostMetric::CYCLES:
+            return cost.cycles;
+        case CostMetric::INTERSECTION_TESTS:
+            return cost.intersectionTests;
+        case CostMetric::BVH_NODES:
+            return cost.bvhNodesVisited;
+        }
+
+        return 0;
+    }
+
+    Vec3 heatColor(float value) {
+        const Vec3 ramp[] = {
+            { 0.0f, 0.0f, 0.0f },
+            { 0.0f, 0.0f, 1.0f },
+            { 1.0f, 0.0f, 0.0f },
+            { 1.0f, 1.0f, 0.0f },
+            { 1.0f, 1.0f, 1.0f }
+        };
+        constexpr int LastStop = (int)(sizeof(ramp) / sizeof(ramp[0])) - 1;
+
+        const float position = std::clamp(value, 0.0f, 1.0f) * LastStop;
+        const int stop = std::min((int)position, LastStop - 1);
+        const float t = position - stop;
+
+        return (1.0f - t) * ramp[stop] + t * ramp[stop + 1];
+    }
+}
+
+void CostMap::resize(int width, int height) {
+    m_Width = width;
+    m_Height = height;
+    m_Costs.assign((size_t)width * height, PixelCost{});
+}
+
+void CostMap::clear() {
+    std::fill(m_Costs.begin(), m_Costs.end(), PixelCost{});
+}
+
+double CostMap::getMean(CostMetric metric) const {
+    if (m_Costs.empty()) {
+        return 0.0;
+    }
+
+    double sum = 0.0;
+
+    for (const PixelCost& cost : m_Costs) {
+        sum += (double)getCost(cost, metric);
+    }
+
+    return sum / m_Costs.size();
+}
+
+uint64_t CostMap::resolve(CostMetric metric, uint32_t* const imageBuffer) const {
+    if (m_Costs.empty()) {
+        return 0;
+    }
+
+    std::vector<uint64_t> sortedCosts(m_Costs.size());
+
+    for (size_t i = 0; i < m_Costs.size(); ++i) {
+        sortedCosts[i] = getCost(m_Costs[i], metric);
+    }
+
+    const size_t percentileIndex = (size_t)((sortedCosts.size() - 1) * HeatmapPercentile);
+    std::nth_element(sortedCosts.begin(), sortedCosts.begin() + percentileIndex, sortedCosts.end());
+
+    const uint64_t whiteCost = std::max<uint64_t>(sortedCosts[percentileIndex], 1);
+    const float scale = 1.0f / (float)whiteCost;
+
+    for (size_t i = 0; i < m_Costs.size(); ++i) {
+        Vec3 color = heatColor((float)getCost(m_Costs[i], metric) * scale);
+
+        color.x = std::min(color.x, 0.999f);
+        color.y = std::min(color.y, 0.999f);
+        color.z = std::min(color.z, 0.999f);
+
+        imageBuffer[i] = rgbToHex(color);
+    }
+
+    return whiteCost;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Note: What rendering a pixel cost, summed over all of its samples. The
+// intersection tests and BVH node visits are only counted with
+// SRAY_RENDER_COUNTERS, otherwise they stay zero
+struct PixelCost {
+    uint64_t cycles = 0;
+    uint64_t intersectionTests = 0;
+    uint64_t bvhNodesVisited = 0;
+};
+
+enum class CostMetric : uint8_t {
+    CYCLES,
+    INTERSECTION_TESTS,
+    BVH_NODES
+};
+
+// Note: Per-pixel render cost, written out as false color heatmaps to find
+// the regions that dominate the render time. Like the accumulation buffer
+// it sums over any number of passes
+class CostMap {
+public:
+    CostMap() = default;
+    ~CostMap() = default;
+
+    void resize(int width, int height);
+    void clear();
+
+    // Note: Every pixel is rendered by a single worker per pass, so workers
+    // never add to the same pixel at the same time
+    inline void add(int x, int y, const PixelCost& cost) {
+        PixelCost& pixel = m_Costs[(size_t)y * m_Width + x];
+
+        pixel.cycles += cost.cycles;
+        pixel.intersectionTests += cost.intersectionTests;
+        pixel.bvhNodesVisited += cost.bvhNodesVisited;
+    }
+
+    double getMean(CostMetric metric) const;
+
+    // Note: Maps the cost to a black-blue-red-yellow-white ramp. The ramp is
+    // scaled to the 99th percentile rather than the maximum, so that a few
+    // extreme pixels do not squash the rest of the image into black. Returns
+    // the cost shown as white
+    uint64_t resolve(CostMetric metric, uint32_t* const imageBuffer) const;
+
+    inline bool isEmpty() const { return m_Costs.empty(); }
+    inline int getWidth() const { return m_Width; }
+    inline int getHeight() const { return m_Height; }
+
+private:
+    int m_Width = 0;
+    int m_Height = 0;
+    std::vector<PixelCost> m_Costs;
+};
@@ -0,0 +1,336 @@
+#include "denoiser.h"
+
+#include "utility/cpuFeatures.h"
+
+#include <algorithm>
+
+#if SRAY_X64
+    #include <immintrin.h>
+#endif
+
+namespace {
+    constexpr int KernelRadius = 2;
+    constexpr float Kernel[2 * KernelRadius + 1] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+    // Note: Keeps the relative depth weight finite for sky pixels of zero depth
+    constexpr float MinDepthSigmaSq = 1e-8f;
+
+    // Note: Guide planes shared by the scalar and the SIMD filter
+    struct GuideArrays {
+        const float* albedoR;
+        const float* albedoG;
+        const float* albedoB;
+        const float* normalX;
+        const float* normalY;
+        const float* normalZ;
+        const float* depth;
+        const float* invDepthSigmaSq;
+    };
+
+    struct FilterParams {
+        int width;
+        int height;
+        int step;
+        float invColorSigmaSq;
+        float invNormalSigmaSq;
+        float invAlbedoSigmaSq;
+    };
+
+    // Note: exp(x) for x <= 0, split into 2^floor(t) * 2^fract(t) with a
+    // polynomial for the fractional part. The AVX2 version below follows the
+    // same steps, but with fused multiply-adds, and sums the exponent of a
+    // tap in another order. The two paths therefore agree to a few ulps, not
+    // bit for bit, which is far below what the filter can show
+    inline float expNegative(float x) {
+        const float t = std::max(x, -87.0f) * 1.44269504f;
+        const float whole = floorf(t);
+        const float f = t - whole;
+        const float p = 1.0f + f * (0.69314718f + f * (0.24022650f + f * (0.05550411f + f * (0.00961813f + f * 0.00133336f))));
+
+        return ldexpf(p, (int)whole);
+    }
+
+    void filterPixelsScalar(
+        const FilterParams& params,
+        const GuideArrays& guides,
+        const float* const inputR,
+        const float* const inputG,
+        const float* const inputB,
+        float* const outputR,
+        float* const outputG,
+        float* const outputB,
+        int y,
+        int xBegin,
+        int xEnd) {
+
+        for (int x = xBegin; x < xEnd; ++x) {
+            const size_t p = (size_t)y * params.width + x;
+
+            float sumR = 0.0f;
+            float sumG = 0.0f;
+            float sumB = 0.0f;
+            float sumWeight = 0.0f;
+
+            for (int dy = -KernelRadius; dy <= KernelRadius; ++dy) {
+                const int qy = y + dy * params.step;
+
+                if (qy < 0 || qy >= params.height) {
+                    continue;
+                }
+
+                for (int dx = -KernelRadius; dx <= KernelRadius; ++dx) {
+                    const int qx = x + dx * params.step;
+
+                    if (qx < 0 || qx >= params.width) {
+                        continue;
+                    }
+
+                    const size_t q = (size_t)qy * params.width + qx;
+
+                    const float dr = inputR[p] - inputR[q];
+                    const float dg = inputG[p] - inputG[q];
+                    const float db = inputB[p] - inputB[q];
+                    const float dnx = guides.normalX[p] - guides.normalX[q];
+                    const float dny = guides.normalY[p] - guides.normalY[q];
+                    const float dnz = guides.normalZ[p] - guides.normalZ[q];
+                    const float dar = guides.albedoR[p] - guides.albedoR[q];
+                    const float dag = guides.albedoG[p] - guides.albedoG[q];
+                    const float dab = guides.albedoB[p] - guides.albedoB[q];
+                    const float dz = guides.depth[p] - guides.depth[q];
+
+                    const float exponent =
+                        (dr * dr + dg * dg + db * db) * params.invColorSigmaSq +
+                        (dnx * dnx + dny * dny + dnz * dnz) * params.invNormalSigmaSq +
+                        (dar * dar + dag * dag + dab * dab) * params.invAlbedoSigmaSq +
+                        dz * dz * guides.invDepthSigmaSq[p];
+
+                    const float weight = Kernel[dx + KernelRadius] * Kernel[dy + KernelRadius] * expNegative(-exponent);
+
+                    sumR += weight * inputR[q];
+                    sumG += weight * inputG[q];
+                    sumB += weight * inputB[q];
+                    sumWeight += weight;
+                }
+            }
+
+            // Note: The center tap always has full weight, so sumWeight > 0
+            const float invSumWeight = 1.0f / sumWeight;
+
+            outputR[p] = sumR * invSumWeight;
+            outputG[p] = sumG * invSumWeight;
+            outputB[p] = sumB * invSumWeight;
+        }
+    }
+
+#if SRAY_X64
+    SRAY_TARGET_AVX2 inline __m256 expNegativeAVX2(__m256 x) {
+        const __m256 t = _mm256_mul_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.0f)), _mm256_set1_ps(1.44269504f));
+        const __m256 whole = _mm256_floor_ps(t);
+        const __m256 f = _mm256_sub_ps(t, whole);
+
+        __m256 p = _mm256_set1_ps(0.00133336f);
+        p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(0.00961813f));
+        p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(0.05550411f));
+        p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(0.24022650f));
+        p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(0.69314718f));
+        p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.0f));
+
+        // Note: Scales by 2^whole by adding it to the exponent bits
+        const __m256i exponent = _mm256_slli_epi32(_mm256_cvtps_epi32(whole), 23);
+        return _mm256_castsi256_ps(_mm256_add_epi32(_mm256_castps_si256(p), exponent));
+    }
+
+    SRAY_TARGET_AVX2 inline __m256 squaredDistanceAVX2(
+        const float* const a,
+        const float* const b,
+        const float* const c,
+        size_t p,
+        size_t q) {
+
+        const __m256 da = _mm256_sub_ps(_mm256_loadu_ps(a + p), _mm256_loadu_ps(a + q));
+        const __m256 db = _mm256_sub_ps(_mm256_loadu_ps(b + p), _mm256_loadu_ps(b + q));
+        const __m256 dc = _mm256_sub_ps(_mm256_loadu_ps(c + p), _mm256_loadu_ps(c + q));
+
+        return _mm256_fmadd_ps(da, da, _mm256_fmadd_ps(db, db, _mm256_mul_ps(dc, dc)));
+    }
+
+    // Note: Filters 8 horizontally adjacent pixels per iteration. The caller
+    // guarantees that every horizontal tap of [xBegin, xEnd) is in the image
+    SRAY_TARGET_AVX2 void filterPixelsAVX2(
+        const FilterParams& params,
+        const GuideArrays& guides,
+        const float* const inputR,
+        const float* const inputG,
+        const float* const inputB,
+        float* const outputR,
+        float* const outputG,
+        float* const outputB,
+        int y,
+        int xBegin,
+        int xEnd) {
+
+        const __m256 invColorSigmaSq = _mm256_set1_ps(params.invColorSigmaSq);
+        const __m256 invNormalSigmaSq = _mm256_set1_ps(params.invNormalSigmaSq);
+        const __m256 invAlbedoSigmaSq = _mm256_set1_ps(params.invAlbedoSigmaSq);
+        const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+        for (int x = xBegin; x + 8 <= xEnd; x += 8) {
+            const size_t p = (size_t)y * params.width + x;
+            const __m256 depthP = _mm256_loadu_ps(guides.depth + p);
+            const __m256 invDepthSigmaSq = _mm256_loadu_ps(guides.invDepthSigmaSq + p);
+
+            __m256 sumR = _mm256_setzero_ps();
+            __m256 sumG = _mm256_setzero_ps();
+            __m256 sumB = _mm256_setzero_ps();
+            __m256 sumWeight = _mm256_setzero_ps();
+
+            for (int dy = -KernelRadius; dy <= KernelRadius; ++dy) {
+                const int qy = y + dy * params.step;
+
+                if (qy < 0 || qy >= params.height) {
+                    continue;
+                }
+
+                for (int dx = -KernelRadius; dx <= KernelRadius; ++dx) {
+                    const size_t q = (size_t)qy * params.width + x + dx * params.step;
+
+                    const __m256 dz = _mm256_sub_ps(depthP, _mm256_loadu_ps(guides.depth + q));
+
+                    __m256 exponent = _mm256_mul_ps(dz, _mm256_mul_ps(dz, invDepthSigmaSq));
+                    exponent = _mm256_fmadd_ps(
+                        squaredDistanceAVX2(inputR, inputG, inputB, p, q), invColorSigmaSq, exponent);
+                    exponent = _mm256_fmadd_ps(
+                        squaredDistanceAVX2(guides.normalX, guides.normalY, guides.normalZ, p, q), invNormalSigmaSq, exponent);
+                    exponent = _mm256_fmadd_ps(
+                        squaredDistanceAVX2(guides.albedoR, guides.albedoG, guides.albedoB, p, q), invAlbedoSigmaSq, exponent);
+
+                    const __m256 kernelWeight = _mm256_set1_ps(Kernel[dx + KernelRadius] * Kernel[dy + KernelRadius]);
+                    const __m256 weight = _mm256_mul_ps(kernelWeight, expNegativeAVX2(_mm256_xor_ps(exponent, signMask)));
+
+                    sumR = _mm256_fmadd_ps(weight, _mm256_loadu_ps(inputR + q), sumR);
+                    sumG = _mm256_fmadd_ps(weight, _mm256_loadu_ps(inputG + q), sumG);
+                    sumB = _mm256_fmadd_ps(weight, _mm256_loadu_ps(inputB + q), sumB);
+                    sumWeight = _mm256_add_ps(sumWeight, weight);
+                }
+            }
+
+            const __m256 invSumWeight = _mm256_div_ps(_mm256_set1_ps(1.0f), sumWeight);
+
+            _mm256_storeu_ps(outputR + p, _mm256_mul_ps(sumR, invSumWeight));
+            _mm256_storeu_ps(outputG + p, _mm256_mul_ps(sumG, invSumWeight));
+            _mm256_storeu_ps(outputB + p, _mm256_mul_ps(sumB, invSumWeight));
+        }
+    }
+#endif
+}
+
+void Denoiser::denoise(const AccumulationBuffer& accumulation, Vec3* const outputBuffer, ThreadPool& threadPool) {
+    m_Width = accumulation.getWidth();
+    m_Height = accumulation.getHeight();
+    m_UseAVX2 = getCPUFeatures().avx2;
+
+    const size_t pixelCount = (size_t)m_Width * m_Height;
+
+    for (int i = 0; i < 3; ++i) {
+        m_Color[0][i].resize(pixelCount);
+        m_Color[1][i].resize(pixelCount);
+        m_Albedo[i].resize(pixelCount);
+        m_Normal[i].resize(pixelCount);
+    }
+
+    m_Depth.resize(pixelCount);
+    m_InvDepthSigmaSq.resize(pixelCount);
+
+    parallelRows(threadPool, [&](int y) { loadRow(accumulation, y); });
+
+    // Note: The color planes are ping-ponged between iterations
+    int input = 0;
+    float invColorSigmaSq = 1.0f / (colorSigma * colorSigma);
+
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        const Planes inputPlanes = { m_Color[input][0].data(), m_Color[input][1].data(), m_Color[input][2].data() };
+        const Planes outputPlanes = { m_Color[1 - input][0].data(), m_Color[1 - input][1].data(), m_Color[1 - input][2].data() };
+        const int step = 1 << iteration;
+
+        parallelRows(threadPool, [&](int y) { filterRow(y, step, invColorSigmaSq, inputPlanes, outputPlanes); });
+
+        input = 1 - input;
+        invColorSigmaSq *= 4.0f;
+    }
+
+    for (size_t i = 0; i < pixelCount; ++i) {
+        outputBuffer[i] = { m_Color[input][0][i], m_Color[input][1][i], m_Color[input][2][i] };
+    }
+}
+
+void Denoiser::loadRow(const AccumulationBuffer& accumulation, int y) {
+    const float depthSigmaSq = depthSigma * depthSigma;
+
+    for (int x = 0; x < m_Width; ++x) {
+        const size_t index = (size_t)y * m_Width + x;
+        const Vec3 color = accumulation.getMean(x, y);
+        const SurfaceFeatures features = accumulation.getMeanFeatures(x, y);
+
+        for (int i = 0; i < 3; ++i) {
+            m_Color[0][i][index] = color[i];
+            m_Albedo[i][index] = features.albedo[i];
+            m_Normal[i][index] = features.normal[i];
+        }
+
+        m_Depth[index] = features.depth;
+        m_InvDepthSigmaSq[index] = 1.0f / std::max(depthSigmaSq * features.depth * features.depth, MinDepthSigmaSq);
+    }
+}
+
+void Denoiser::filterRow(int y, int step, float invColorSigmaSq, const Planes& input, const Planes& output) const {
+    const FilterParams params = {
+        m_Width,
+        m_Height,
+        step,
+        invColorSigmaSq,
+        1.0f / (normalSigma * normalSigma),
+        1.0f / (albedoSigma * albedoSigma)
+    };
+
+    const GuideArrays guides = {
+        m_Albedo[0].data(), m_Albedo[1].data(), m_Albedo[2].data(),
+        m_Normal[0].data(), m_Normal[1].data(), m_Normal[2].data(),
+        m_Depth.data(), m_InvDepthSigmaSq.data()
+    };
+
+    int simdBegin = 0;
+    int simdEnd = 0;
+
+#if SRAY_X64
+    if (m_UseAVX2) {
+        // Note: Pixels whose outermost taps stay inside the row are filtered 8
+        // at a time, the borders fall back to the scalar filter
+        const int border = KernelRadius * step;
+        const int simdWidth = std::max(m_Width - 2 * border, 0) / 8 * 8;
+
+        simdBegin = std::min(border, m_Width);
+        simdEnd = simdBegin + simdWidth;
+
+        filterPixelsAVX2(params, guides, input.r, input.g, input.b, output.r, output.g, output.b, y, simdBegin, simdEnd);
+    }
+#endif
+
+    filterPixelsScalar(params, guides, input.r, input.g, input.b, output.r, output.g, output.b, y, 0, simdBegin);
+    filterPixelsScalar(params, guides, input.r, input.g, input.b, output.r, output.g, output.b, y, simdEnd, m_Width);
+}
+
+void Denoiser::parallelRows(ThreadPool& threadPool, const std::function<void(int)>& rowJob) {
+    m_NextRow = 0;
+
+    threadPool.run([&](int workerIndex) {
+        while (true) {
+            const int row = m_NextRow.fetch_add(1);
+
+            if (row >= m_Height) {
+                break;
+            }
+
+            rowJob(row);
+        }
+    });
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "accumulationBuffer.h"
+#include "math/sray_math.h"
+#include "utility/threadPool.h"
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+// Note: Edge-avoiding À-trous wavelet filter (Dammertz et al. 2010) applied
+// to the mean radiance of an accumulation buffer. Every iteration convolves
+// the image with a 5x5 B3-spline kernel whose taps are spread 2^i pixels
+// apart, and weights each tap by how similar its color and first-hit albedo,
+// normal and depth are to those of the center pixel, so that edges survive
+// while the noise in between is smoothed out
+class Denoiser {
+public:
+    Denoiser() = default;
+    ~Denoiser() = default;
+
+    int iterations = 5;
+    float colorSigma = 0.6f; // Note: Halved after every iteration
+    float normalSigma = 0.3f;
+    float albedoSigma = 0.1f;
+    float depthSigma = 0.05f; // Note: Relative to the depth of the center pixel
+
+    // Note: Writes the filtered linear radiance of every pixel to outputBuffer,
+    // rows being distributed over the workers of the pool
+    void denoise(const AccumulationBuffer& accumulation, Vec3* const outputBuffer, ThreadPool& threadPool);
+
+private:
+    struct Planes {
+        float* r;
+        float* g;
+        float* b;
+    };
+
+    void loadRow(const AccumulationBuffer& accumulation, int y);
+    void filterRow(int y, int step, float invColorSigmaSq, const Planes& input, const Planes& output) const;
+    void parallelRows(ThreadPool& threadPool, const std::function<void(int)>& rowJob);
+
+    int m_Width = 0;
+    int m_Height = 0;
+    bool m_UseAVX2 = false;
+    std::atomic<int> m_NextRow{ 0 };
+
+    // Note: Planar storage so that 8 horizontally adjacent pixels can be
+    // loaded into a single AVX register
+    std::vector<float> m_Color[2][3];
+    std::vector<float> m_Albedo[3];
+    std::vector<float> m_Normal[3];
+    std::vector<float> m_Depth;
+    std::vector<float> m_InvDepthSigmaSq;
+};
@@ -0,0 +1,48 @@
+#include "framebuffer.h"
+
+Framebuffer::Framebuffer(int width, int height) :
+    m_Width(width), m_Height(height) {}
+
+int Framebuffer::addChannel(const std::string& name, ChannelType type) {
+    const int existing = findChannel(name);
+
+    if (existing >= 0) {
+        return existing;
+    }
+
+    const size_t pixelCount = (type == ChannelType::FLOAT) ? (size_t)m_Width * m_Height : 0;
+
+    m_ChannelNames.push_back(name);
+    m_ChannelTypes.push_back(type);
+    m_Channels.emplace_back(pixelCount, 0.0f);
+    m_UintChannels.emplace_back((size_t)m_Width * m_Height - pixelCount, 0u);
+
+    return (int)m_ChannelNames.size() - 1;
+}
+
+void Framebuffer::addStandardChannels() {
+    const char* const names[] = {
+        AOVNames::BeautyR, AOVNames::BeautyG, AOVNames::BeautyB,
+        AOVNames::Depth,
+        AOVNames::NormalX, AOVNames::NormalY, AOVNames::NormalZ,
+        AOVNames::AlbedoR, AOVNames::AlbedoG, AOVNames::AlbedoB,
+        AOVNames::SampleCount
+    };
+
+    for (const char* name : names) {
+        addChannel(name);
+    }
+
+    addChannel(AOVNames::ObjectId, ChannelType::UINT);
+    addChannel(AOVNames::PrimitiveId, ChannelType::UINT);
+}
+
+int Framebuffer::findChannel(const std::string& name) const {
+    for (size_t i = 0; i < m_ChannelNames.size(); ++i) {
+        if (m_ChannelNames[i] == name) {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Note: Names of the arbitrary output variables (AOVs) the camera knows how
+// to fill. Channels with any other name are left untouched by the renderer
+namespace AOVNames {
+    constexpr const char* BeautyR = "R";
+    constexpr const char* BeautyG = "G";
+    constexpr const char* BeautyB = "B";
+    constexpr const char* Depth = "Z";
+    constexpr const char* NormalX = "N.X";
+    constexpr const char* NormalY = "N.Y";
+    constexpr const char* NormalZ = "N.Z";
+    constexpr const char* AlbedoR = "albedo.R";
+    constexpr const char* AlbedoG = "albedo.G";
+    constexpr const char* AlbedoB = "albedo.B";
+    constexpr const char* ObjectId = "objectId";
+    constexpr const char* PrimitiveId = "primId";
+    constexpr const char* SampleCount = "sampleCount";
+}
+
+// Note: Ids are stored as integers, as floats cannot represent them all
+enum class ChannelType {
+    FLOAT,
+    UINT
+};
+
+// Note: Image made of any number of named float or uint32_t channels, each
+// stored as its own plane so that a row of a channel is contiguous in
+// memory. The camera resolves a row into every channel as soon as the row
+// is complete and then notifies the row listener, so that rows can be
+// streamed out while the rest of the image is still rendering
+class Framebuffer {
+public:
+    Framebuffer(int width, int height);
+    ~Framebuffer() = default;
+
+    // Note: Called from render threads, each row by exactly one thread per pass
+    std::function<void(const Framebuffer& framebuffer, int y)> rowListener;
+
+    int addChannel(const std::string& name, ChannelType type = ChannelType::FLOAT);
+    void addStandardChannels();
+
+    // Note: Returns -1 if there is no channel with the given name
+    int findChannel(const std::string& name) const;
+
+    // Note: Only valid for float channels
+    inline float* getRow(int channel, int y) { return m_Channels[channel].data() + (size_t)y * m_Width; }
+    inline const float* getRow(int channel, int y) const { return m_Channels[channel].data() + (size_t)y * m_Width; }
+
+    // Note: Only valid for uint channels
+    inline uint32_t* getUintRow(int channel, int y) { return m_UintChannels[channel].data() + (size_t)y * m_Width; }
+    inline const uint32_t* getUintRow(int channel, int y) const { return m_UintChannels[channel].data() + (size_t)y * m_Width; }
+
+    inline int getChannelCount() const { return (int)m_ChannelNames.size(); }
+    inline const std::string& getChannelName(int channel) const { return m_ChannelNames[channel]; }
+    inline ChannelType getChannelType(int channel) const { return m_ChannelTypes[channel]; }
+    inline const std::vector<std::string>& getChannelNames() const { return m_ChannelNames; }
+    inline int getWidth() const { return m_Width; }
+    inline int getHeight() const { return m_Height; }
+
+private:
+    int m_Width = 0;
+    int m_Height = 0;
+    std::vector<std::string> m_ChannelNames;
+    std::vector<ChannelType> m_ChannelTypes;
+    std::vector<std::vector<float>> m_Channels; // Note: Empty for uint channels
+    std::vector<std::vector<uint32_t>> m_UintChannels; // Note: Empty for float channels
+};
@@ -0,0 +1,418 @@
+#include "gltfLoader.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Note: Only geometry and material factors are needed, so the image
+// decoders are left out. The stb_image_write implementation of the CLI
+// lives in main.cpp
+#define TINYGLTF_IMPLEMENTATION
+#define TINYGLTF_NO_STB_IMAGE
+#define TINYGLTF_NO_STB_IMAGE_WRITE
+#define TINYGLTF_NO_EXTERNAL_IMAGE
+#include "tiny_gltf.h"
+
+namespace {
+    // Note: Column-major like glTF itself, in double precision so that deep
+    // node hierarchies do not accumulate rounding errors
+    struct Matrix4 {
+        double m[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+
+        inline double& at(int row, int column) { return m[column * 4 + row]; }
+        inline double at(int row, int column) const { return m[column * 4 + row]; }
+
+        inline Matrix4 operator*(const Matrix4& other) const {
+            Matrix4 result{};
+
+            for (int row = 0; row < 4; ++row) {
+                for (int column = 0; column < 4; ++column) {
+                    double sum = 0.0;
+
+                    for (int k = 0; k < 4; ++k) {
+                        sum += at(row, k) * other.at(k, column);
+                    }
+
+                    result.at(row, column) = sum;
+                }
+            }
+
+            return result;
+        }
+
+        inline Vec3 transformPoint(const Vec3& p) const {
+            return {
+                (float)(at(0, 0) * p.x + at(0, 1) * p.y + at(0, 2) * p.z + at(0, 3)),
+                (float)(at(1, 0) * p.x + at(1, 1) * p.y + at(1, 2) * p.z + at(1, 3)),
+                (float)(at(2, 0) * p.x + at(2, 1) * p.y + at(2, 2) * p.z + at(2, 3))
+            };
+        }
+
+        // Note: Normals transform with the cofactor matrix of the upper 3x3,
+        // which is the inverse transpose scaled by the determinant
+        inline Vec3 transformNormal(const Vec3& n) const {
+            const auto cofactor = [&](int row, int column) {
+                const int r0 = (row + 1) % 3;
+                const int r1 = (row + 2) % 3;
+                const int c0 = (column + 1) % 3;
+                const int c1 = (column + 2) % 3;
+
+                return at(r0, c0) * at(r1, c1) - at(r0, c1) * at(r1, c0);
+            };
+
+            const double sign = (determinant3x3() < 0.0) ? -1.0 : 1.0;
+            const Vec3 transformed = {
+                (float)(sign * (cofactor(0, 0) * n.x + cofactor(0, 1) * n.y + cofactor(0, 2) * n.z)),
+                (float)(sign * (cofactor(1, 0) * n.x + cofactor(1, 1) * n.y + cofactor(1, 2) * n.z)),
+                (float)(sign * (cofactor(2, 0) * n.x + cofactor(2, 1) * n.y + cofactor(2, 2) * n.z))
+            };
+            const float length = transformed.length();
+
+            return (length > 0.0f) ? transformed / length : transformed;
+        }
+
+        inline double determinant3x3() const {
+            return at(0, 0) * (at(1, 1) * at(2, 2) - at(1, 2) * at(2, 1)) -
+                at(0, 1) * (at(1, 0) * at(2, 2) - at(1, 2) * at(2, 0)) +
+                at(0, 2) * (at(1, 0) * at(2, 1) - at(1, 1) * at(2, 0));
+        }
+    };
+
+    Matrix4 getLocalTransform(const tinygltf::Node& node) {
+        Matrix4 local{};
+
+        if (node.matrix.size() == 16) {
+            for (int i = 0; i < 16; ++i) {
+                local.m[i] = node.matrix[i];
+            }
+
+            return local;
+        }
+
+        // Note: T * R * S, the rotation being a unit quaternion (x, y, z, w)
+        if (node.rotation.size() == 4) {
+            const double x = node.rotation[0];
+            const double y = node.rotation[1];
+            const double z = node.rotation[2];
+            const double w = node.rotation[3];
+
+            local.at(0, 0) = 1.0 - 2.0 * (y * y + z * z);
+            local.at(0, 1) = 2.0 * (x * y - z * w);
+            local.at(0, 2) = 2.0 * (x * z + y * w);
+            local.at(1, 0) = 2.0 * (x * y + z * w);
+            local.at(1, 1) = 1.0 - 2.0 * (x * x + z * z);
+            local.at(1, 2) = 2.0 * (y * z - x * w);
+            local.at(2, 0) = 2.0 * (x * z - y * w);
+            local.at(2, 1) = 2.0 * (y * z + x * w);
+            local.at(2, 2) = 1.0 - 2.0 * (x * x + y * y);
+        }
+
+        if (node.scale.size() == 3) {
+            for (int row = 0; row < 3; ++row) {
+                for (int column = 0; column < 3; ++column) {
+                    local.at(row, column) *= node.scale[column];
+                }
+            }
+        }
+
+        if (node.translation.size() == 3) {
+            local.at(0, 3) = node.translation[0];
+            local.at(1, 3) = node.translation[1];
+            local.at(2, 3) = node.translation[2];
+        }
+
+        return local;
+    }
+
+    double getExtensionNumber(const tinygltf::ExtensionMap& extensions, const char* extension, const char* key, double fallback) {
+        const auto search = extensions.find(extension);
+
+        if (search == extensions.end() || !search->second.Has(key) || !search->second.Get(key).IsNumber()) {
+            return fallback;
+        }
+
+        return search->second.Get(key).GetNumberAsDouble();
+    }
+
+    // Note: Emissive and transmissive materials map to the respective CLI
+    // material. Metals need the metallic factor alone to say so, as a
+    // metallic-roughness texture cannot be sampled here
+    Material convertMaterial(const tinygltf::Material& gltfMaterial) {
+        const tinygltf::PbrMetallicRoughness& pbr = gltfMaterial.pbrMetallicRoughness;
+        const Vec3 baseColor = { (float)pbr.baseColorFactor[0], (float)pbr.baseColorFactor[1], (float)pbr.baseColorFactor[2] };
+
+        const float emissiveStrength = (float)getExtensionNumber(
+            gltfMaterial.extensions, "KHR_materials_emissive_strength", "emissiveStrength", 1.0);
+        const Vec3 emission = emissiveStrength * Vec3{
+            (float)gltfMaterial.emissiveFactor[0], (float)gltfMaterial.emissiveFactor[1], (float)gltfMaterial.emissiveFactor[2] };
+
+        if (luminance(emission) > 0.0f) {
+            return EmissiveMaterial(emission);
+        }
+
+        if (getExtensionNumber(gltfMaterial.extensions, "KHR_materials_transmission", "transmissionFactor", 0.0) > 0.5) {
+            return DielectricMaterial((float)getExtensionNumber(gltfMaterial.extensions, "KHR_materials_ior", "ior", 1.5));
+        }
+
+        if (pbr.metallicFactor >= 0.5 && pbr.metallicRoughnessTexture.index < 0) {
+            return MetalMaterial(baseColor, (float)pbr.roughnessFactor);
+        }
+
+        return DiffuseMaterial(baseColor);
+    }
+
+    // Note: Throws unless index refers to one of count elements
+    void validateIndex(int index, size_t count, const char* what) {
+        if (index < 0 || (size_t)index >= count) {
+            throw std::runtime_error("GLTF ERROR: " + std::string(what) + " index " + std::to_string(index) + " out of range!");
+        }
+    }
+
+    // Note: Checks that all elements of the accessor lie within its buffer
+    // view and the view within its buffer, so that reading the accessor can
+    // never run past the end of the loaded data
+    void validateAccessor(const tinygltf::Model& model, const tinygltf::Accessor& accessor, size_t elementSize) {
+        validateIndex(accessor.bufferView, model.bufferViews.size(), "Buffer view");
+        const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+
+        validateIndex(bufferView.buffer, model.buffers.size(), "Buffer");
+        const size_t bufferSize = model.buffers[bufferView.buffer].data.size();
+
+        if (bufferView.byteOffset > bufferSize || bufferView.byteLength > bufferSize - bufferView.byteOffset) {
+            throw std::runtime_error("GLTF ERROR: Buffer view exceeds its buffer!");
+        }
+
+        const int stride = accessor.ByteStride(bufferView);
+
+        if (stride <= 0 || (size_t)stride < elementSize) {
+            throw std::runtime_error("GLTF ERROR: Invalid byte stride of an accessor!");
+        }
+
+        if (accessor.count == 0) {
+            return;
+        }
+
+        // Note: The last element only needs elementSize bytes, not a full stride
+        const size_t viewSize = bufferView.byteLength;
+        const bool fits = accessor.byteOffset <= viewSize && elementSize <= viewSize - accessor.byteOffset &&
+            accessor.count - 1 <= (viewSize - accessor.byteOffset - elementSize) / (size_t)stride;
+
+        if (!fits) {
+            throw std::runtime_error("GLTF ERROR: Accessor exceeds its buffer view!");
+        }
+    }
+
+    // Note: Reads a float vector attribute, respecting the stride of its buffer view
+    Vec3 readVec3(const tinygltf::Model& model, const tinygltf::Accessor& accessor, size_t index) {
+        const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+        const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
+        const size_t stride = (size_t)accessor.ByteStride(bufferView);
+        const unsigned char* const data = buffer.data.data() + bufferView.byteOffset + accessor.byteOffset + index * stride;
+
+        float values[3];
+        memcpy(values, data, sizeof(values));
+
+        return { values[0], values[1], values[2] };
+    }
+
+    uint32_t readIndex(const tinygltf::Model& model, const tinygltf::Accessor& accessor, size_t index) {
+        const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+        const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
+        const size_t stride = (size_t)accessor.ByteStride(bufferView);
+        const unsigned char* const data = buffer.data.data() + bufferView.byteOffset + accessor.byteOffset + index * stride;
+
+        switch (accessor.componentType) {
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+            return data[0];
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+            uint16_t value = 0;
+            memcpy(&value, data, sizeof(value));
+            return value;
+        }
+        default: {
+            uint32_t value = 0;
+            memcpy(&value, data, sizeof(value));
+            return value;
+        }
+        }
+    }
+
+    bool isFloatVec3(const tinygltf::Accessor& accessor) {
+        return accessor.type == TINYGLTF_TYPE_VEC3 && accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT &&
+            accessor.bufferView >= 0 && !accessor.sparse.isSparse;
+    }
+
+    void loadPrimitive(
+        const tinygltf::Model& model,
+        const tinygltf::Primitive& primitive,
+        const Matrix4& transform,
+        MaterialId materialId,
+        TriangleMesh* const mesh) {
+
+        const auto positionSearch = primitive.attributes.find("POSITION");
+
+        if (positionSearch == primitive.attributes.end()) {
+            return;
+        }
+
+        validateIndex(positionSearch->second, model.accessors.size(), "Accessor");
+        const tinygltf::Accessor& positions = model.accessors[positionSearch->second];
+
+        if (!isFloatVec3(positions)) {
+            throw std::runtime_error("GLTF ERROR: Vertex positions must be uncompressed float vectors!");
+        }
+
+        validateAccessor(model, positions, sizeof(Vec3));
+
+        const auto normalSearch = primitive.attributes.find("NORMAL");
+        const tinygltf::Accessor* normals = nullptr;
+
+        if (normalSearch != primitive.attributes.end()) {
+            validateIndex(normalSearch->second, model.accessors.size(), "Accessor");
+
+            if (isFloatVec3(model.accessors[normalSearch->second])) {
+                normals = &model.accessors[normalSearch->second];
+                validateAccessor(model, *normals, sizeof(Vec3));
+
+                if (normals->count < positions.count) {
+                    throw std::runtime_error("GLTF ERROR: Fewer vertex normals than positions!");
+                }
+            }
+        }
+
+        const uint32_t baseVertex = (uint32_t)mesh->getVertexCount();
+
+        for (size_t i = 0; i < positions.count; ++i) {
+            const Vec3 position = transform.transformPoint(readVec3(model, positions, i));
+            const Vec3 normal = normals ? transform.transformNormal(readVec3(model, *normals, i)) : Vec3{};
+
+            mesh->addVertex(position, normal);
+        }
+
+        // Note: Mirroring transforms flip the winding, which is restored so
+        // that front faces stay front faces
+        const bool flipWinding = transform.determinant3x3() < 0.0;
+        const tinygltf::Accessor* indices = nullptr;
+
+        if (primitive.indices >= 0) {
+            validateIndex(primitive.indices, model.accessors.size(), "Accessor");
+            indices = &model.accessors[primitive.indices];
+
+            const int componentType = indices->componentType;
+            const bool isIndexType = componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE ||
+                componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT || componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+
+            if (indices->type != TINYGLTF_TYPE_SCALAR || !isIndexType || indices->sparse.isSparse) {
+                throw std::runtime_error("GLTF ERROR: Vertex indices must be uncompressed unsigned integers!");
+            }
+
+            validateAccessor(model, *indices, (size_t)tinygltf::GetComponentSizeInBytes(componentType));
+        }
+
+        const size_t indexCount = indices ? indices->count : positions.count;
+
+        for (size_t i = 0; i + 2 < indexCount; i += 3) {
+            uint32_t i0 = indices ? readIndex(model, *indices, i + 0) : (uint32_t)(i + 0);
+            uint32_t i1 = indices ? readIndex(model, *indices, i + 1) : (uint32_t)(i + 1);
+            uint32_t i2 = indices ? readIndex(model, *indices, i + 2) : (uint32_t)(i + 2);
+
+            if (flipWinding) {
+                std::swap(i1, i2);
+            }
+
+            if (i0 >= positions.count || i1 >= positions.count || i2 >= positions.count) {
+                throw std::runtime_error("GLTF ERROR: Vertex index out of range!");
+            }
+
+            mesh->addTriangle(baseVertex + i0, baseVertex + i1, baseVertex + i2, materialId);
+        }
+    }
+
+    // Note: Images are never decoded, the loader only has to accept them
+    bool skipImage(tinygltf::Image*, const int, std::string*, std::string*, int, int, const unsigned char*, int, void*) {
+        return true;
+    }
+}
+
+void loadGLTF(const std::string& path, MaterialTable& materials, TriangleMesh* const mesh) {
+    tinygltf::TinyGLTF loader{};
+    tinygltf::Model model{};
+    std::string error = "";
+    std::string warning = "";
+
+    loader.SetImageLoader(&skipImage, nullptr);
+
+    const bool isBinary = path.size() >= 4 && path.compare(path.size() - 4, 4, ".glb") == 0;
+    const bool loaded = isBinary ?
+        loader.LoadBinaryFromFile(&model, &error, &warning, path) :
+        loader.LoadASCIIFromFile(&model, &error, &warning, path);
+
+    if (!loaded) {
+        throw std::runtime_error("GLTF ERROR: Failed to load " + path + ": " + error);
+    }
+
+    std::vector<MaterialId> materialIds(model.materials.size());
+
+    for (size_t i = 0; i < model.materials.size(); ++i) {
+        materialIds[i] = materials.add(convertMaterial(model.materials[i]));
+    }
+
+    // Note: Primitives without a material use the glTF default material
+    const MaterialId defaultMaterial = materials.add(DiffuseMaterial({ 1.0f, 1.0f, 1.0f }));
+
+    if (model.scenes.empty()) {
+        throw std::runtime_error("GLTF ERROR: " + path + " contains no scene!");
+    }
+
+    const int sceneIndex = (model.defaultScene >= 0) ? model.defaultScene : 0;
+    validateIndex(sceneIndex, model.scenes.size(), "Scene");
+    const tinygltf::Scene& scene = model.scenes[sceneIndex];
+
+    // Depth-first traversal of the node hierarchy, accumulating transforms
+    // Note: The hierarchy has to be a forest, so a node reached twice means
+    // either a cycle, which would never end, or a node with several parents
+    std::vector<std::pair<int, Matrix4>> stack{};
+    std::vector<bool> visited(model.nodes.size(), false);
+
+    for (const int root : scene.nodes) {
+        stack.push_back({ root, Matrix4{} });
+    }
+
+    while (!stack.empty()) {
+        const auto [nodeIndex, parentTransform] = stack.back();
+        stack.pop_back();
+
+        validateIndex(nodeIndex, model.nodes.size(), "Node");
+
+        if (visited[nodeIndex]) {
+            throw std::runtime_error("GLTF ERROR: Node " + std::to_string(nodeIndex) + " is reached more than once, the node hierarchy must be a forest!");
+        }
+
+        visited[nodeIndex] = true;
+
+        const tinygltf::Node& node = model.nodes[nodeIndex];
+        const Matrix4 transform = parentTransform * getLocalTransform(node);
+
+        if (node.mesh >= 0) {
+            validateIndex(node.mesh, model.meshes.size(), "Mesh");
+
+            for (const tinygltf::Primitive& primitive : model.meshes[node.mesh].primitives) {
+                if (primitive.mode != TINYGLTF_MODE_TRIANGLES && primitive.mode != -1) {
+                    continue;
+                }
+
+                if (primitive.material >= 0) {
+                    validateIndex(primitive.material, materialIds.size(), "Material");
+                }
+
+                const MaterialId materialId = (primitive.material >= 0) ? materialIds[primitive.material] : defaultMaterial;
+                loadPrimitive(model, primitive, transform, materialId, mesh);
+            }
+        }
+
+        for (const int child : node.children) {
+            stack.push_back({ child, transform });
+        }
+    }
+}
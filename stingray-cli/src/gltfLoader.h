@@ -0,0 +1,12 @@
+#pragma once
+
+#include "material.h"
+#include "triangleMesh.h"
+
+#include <string>
+
+// Note: Appends all triangle primitives of the default scene of a glTF file
+// (.gltf or .glb) to the mesh, in world space with the node transforms
+// applied. Every glTF material is added to the material table as the
+// closest material the CLI has, textures are ignored. Throws on failure
+void loadGLTF(const std::string& path, MaterialTable& materials, TriangleMesh* const mesh);
@@ -1,13 +1,26 @@
 #pragma once
 
+#include "accelerationStructure.h"
+#include "light.h"
+#include "material.h"
 #include "math/sray_math.h"
 
-class Material;
+// Note: Compact result of a closest-hit search. Traversal only records the
+// distance and which primitive was hit, the full HitData is reconstructed
+// once for the final hit through Hittable::computeHitData()
+struct HitRecord {
+    float t = 0.0f;
+    uint32_t primId = 0;
+    float u = 0.0f; // Note: Barycentric coordinates, for triangle primitives
+    float v = 0.0f;
+    uint32_t objectIndex = 0; // Note: Set by the scene
+    uint32_t candidateCount = 0; // Note: Number of closer hits found during the search
+};
 
 struct HitData {
     Vec3 position{};
     Vec3 normal{};
-    Material* material = nullptr;
+    MaterialId materialId = 0;
     float t = 0.0f;
     bool frontFace = false;
 
@@ -22,5 +35,54 @@ public:
     Hittable() = default;
     virtual ~Hittable() = default;
 
-    virtual bool hit(const Ray& ray, float tMin, float tMax, HitData* const hitData) const = 0;
+    // Note: Called by Scene::build() before the bounds are queried, so that
+    // primitive containers can build their own acceleration structure
+    virtual void build(const BVHSettings& settings) {}
+
+    // Note: Called by Scene::update() after primitives moved. Containers
+    // refit their acceleration structure, or rebuild it once refitting has
+    // degraded it past settings.rebuildThreshold. Returns true on a rebuild
+    virtual bool update(const BVHSettings& settings) { return false; }
+
+    // Note: Finds the closest hit within (tMin, tMax), only filling in the
+    // distance and primitive of the record
+    virtual bool intersect(const Ray& ray, float tMin, float tMax, HitRecord* const record) const = 0;
+    virtual void computeHitData(const Ray& ray, const HitRecord& record, HitData* const hitData) const = 0;
+
+    // Note: record.primId is the BVH leaf slot of the primitive, which
+    // changes with every build. Returns the index the primitive was added
+    // with instead, which stays the same across builds
+    virtual uint32_t getPrimitiveId(const HitRecord& record) const { return record.primId; }
+
+    // Note: Whether anything is hit within (tMin, tMax), stopping at the
+    // first hit found and computing no attributes. Used by shadow and
+    // ambient occlusion rays
+    virtual bool occluded(const Ray& ray, float tMin, float tMax) const = 0;
+
+    // Note: Bounds of the whole motion for moving objects
+    virtual AABB boundingBox() const = 0;
+
+    // Note: Bounds at a shutter time in [0, 1]. Objects move linearly in
+    // between, so the bounds at 0 and 1 are all a motion BVH needs
+    virtual AABB boundingBoxAt(float time) const { return boundingBox(); }
+    virtual bool isMoving() const { return false; }
+
+    // Note: Appends a light for every primitive with an emissive material.
+    // Called by Scene::build() once the objects are in their final order
+    virtual void collectLights(
+        const MaterialTable& materials,
+        uint32_t objectIndex,
+        std::vector<Light>* const lights) const {}
+
+    inline bool hit(const Ray& ray, float tMin, float tMax, HitData* const hitData) const {
+        HitRecord record{};
+
+        if (!intersect(ray, tMin, tMax, &record)) {
+            return false;
+        }
+
+        computeHitData(ray, record, hitData);
+
+        return true;
+    }
 };
@@ -0,0 +1,134 @@
+#include "instance.h"
+
+#include <utility>
+
+Instance::Instance(const Hittable* object, const Transform& objectToWorld) :
+    m_Object(object),
+    m_ObjectToWorld(objectToWorld),
+    m_WorldToObject(objectToWorld.inverse()),
+    m_EndObjectToWorld(objectToWorld) {}
+
+Instance::Instance(const Hittable* object, const Transform& startObjectToWorld, const Transform& endObjectToWorld) :
+    m_Object(object),
+    m_ObjectToWorld(startObjectToWorld),
+    m_WorldToObject(startObjectToWorld.inverse()),
+    m_EndObjectToWorld(endObjectToWorld),
+    m_HasMotion(true) {}
+
+void Instance::setTransform(const Transform& objectToWorld) {
+    m_ObjectToWorld = objectToWorld;
+    m_WorldToObject = objectToWorld.inverse();
+    m_EndObjectToWorld = objectToWorld;
+    m_HasMotion = false;
+}
+
+void Instance::setTransform(const Transform& startObjectToWorld, const Transform& endObjectToWorld) {
+    m_ObjectToWorld = startObjectToWorld;
+    m_WorldToObject = startObjectToWorld.inverse();
+    m_EndObjectToWorld = endObjectToWorld;
+    m_HasMotion = true;
+}
+
+// Note: A moving object inside a moving instance moves along a curve, so
+// both ends then bound the whole motion of the object, which keeps the
+// interpolated bounds conservative
+void Instance::build(const BVHSettings& settings) {
+    if (m_HasMotion) {
+        m_StartBounds = transformBounds(m_ObjectToWorld, m_Object->boundingBox());
+        m_EndBounds = transformBounds(m_EndObjectToWorld, m_Object->boundingBox());
+    }
+    else {
+        m_StartBounds = transformBounds(m_ObjectToWorld, m_Object->boundingBoxAt(0.0f));
+        m_EndBounds = transformBounds(m_ObjectToWorld, m_Object->boundingBoxAt(1.0f));
+    }
+
+    m_Bounds = m_StartBounds;
+    m_Bounds.grow(m_EndBounds);
+}
+
+// Note: Also picks up changes of the shared object, once its owner has
+// updated it
+bool Instance::update(const BVHSettings& settings) {
+    build(settings);
+
+    return false;
+}
+
+bool Instance::intersect(const Ray& ray, float tMin, float tMax, HitRecord* const record) const {
+    return m_Object->intersect(toObjectSpace(ray), tMin, tMax, record);
+}
+
+void Instance::computeHitData(const Ray& ray, const HitRecord& record, HitData* const hitData) const {
+    Transform motionWorldToObject{};
+    const Transform* worldToObject = &m_WorldToObject;
+
+    if (m_HasMotion) {
+        motionWorldToObject = getMotionWorldToObject(ray.time);
+        worldToObject = &motionWorldToObject;
+    }
+
+    m_Object->computeHitData(toObjectSpace(ray, *worldToObject), record, hitData);
+
+    // Note: The inverse transpose keeps the sign of dot(dir, normal), so the
+    // normal still faces the ray and frontFace stays valid, even for
+    // mirroring transforms
+    hitData->position = ray.at(record.t);
+    hitData->normal = normalize(worldToObject->transformTransposed(hitData->normal));
+}
+
+bool Instance::occluded(const Ray& ray, float tMin, float tMax) const {
+    return m_Object->occluded(toObjectSpace(ray), tMin, tMax);
+}
+
+AABB Instance::boundingBox() const {
+    return m_Bounds;
+}
+
+AABB Instance::boundingBoxAt(float time) const {
+    return lerpBounds(m_StartBounds, m_EndBounds, time);
+}
+
+// Note: Moving instances are left to BSDF sampling, see Sphere::collectLights()
+void Instance::collectLights(const MaterialTable& materials, uint32_t objectIndex, std::vector<Light>* const lights) const {
+    if (m_HasMotion) {
+        return;
+    }
+
+    const size_t firstLight = lights->size();
+    m_Object->collectLights(materials, objectIndex, lights);
+
+    // Note: Triangles transform exactly, but a mirroring transform flips
+    // their winding, which is undone to keep the emitting side. Spheres only
+    // stay spheres under a similarity transform, under any other transform
+    // they become ellipsoids, which are left to BSDF sampling like moving
+    // spheres are
+    const float determinant = m_ObjectToWorld.determinant();
+    float scale = 1.0f;
+    const bool keepSpheres = m_ObjectToWorld.isSimilarity(&scale);
+    size_t lightCount = firstLight;
+
+    for (size_t i = firstLight; i < lights->size(); ++i) {
+        Light light = (*lights)[i];
+
+        if (light.shape == LightShape::TRIANGLE) {
+            for (Vec3& vertex : light.vertices) {
+                vertex = m_ObjectToWorld.transformPoint(vertex);
+            }
+
+            if (determinant < 0.0f) {
+                std::swap(light.vertices[1], light.vertices[2]);
+            }
+        }
+        else if (keepSpheres) {
+            light.center = m_ObjectToWorld.transformPoint(light.center);
+            light.radius *= scale;
+        }
+        else {
+            continue;
+        }
+
+        (*lights)[lightCount++] = light;
+    }
+
+    lights->resize(lightCount);
+}
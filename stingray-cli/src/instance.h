@@ -0,0 +1,63 @@
+#pragma once
+
+#include "hittable.h"
+
+// Note: Placement of a shared object in the scene, the CPU counterpart of a
+// TLAS instance in stingray-gui. The object (usually a TriangleMesh or
+// SphereSoA with its own BVH) is the bottom-level acceleration structure,
+// and the scene BVH over the instance bounds is the top-level one. Rays are
+// moved into object space instead of the object into world space, so any
+// number of instances share the object's primitives and BVH. The direction
+// is transformed without normalizing it, so that hit distances are the same
+// in both spaces. A moving instance interpolates between a start and an end
+// transform over the shutter interval
+class Instance final : public Hittable {
+public:
+    Instance(const Hittable* object, const Transform& objectToWorld);
+    Instance(const Hittable* object, const Transform& startObjectToWorld, const Transform& endObjectToWorld);
+    ~Instance() = default;
+
+    inline const Hittable* getObject() const { return m_Object; }
+    inline const Transform& getTransform() const { return m_ObjectToWorld; }
+
+    // Note: Only takes effect in traversal after update() or build(). Also
+    // stops the instance from moving
+    void setTransform(const Transform& objectToWorld);
+    void setTransform(const Transform& startObjectToWorld, const Transform& endObjectToWorld);
+
+    // Note: Only computes the world bounds. The shared object is not built
+    // here, its owner builds it once before the scene is built
+    void build(const BVHSettings& settings) override;
+    bool update(const BVHSettings& settings) override;
+    bool intersect(const Ray& ray, float tMin, float tMax, HitRecord* const record) const override;
+    void computeHitData(const Ray& ray, const HitRecord& record, HitData* const hitData) const override;
+    inline uint32_t getPrimitiveId(const HitRecord& record) const override { return m_Object->getPrimitiveId(record); }
+    bool occluded(const Ray& ray, float tMin, float tMax) const override;
+    AABB boundingBox() const override;
+    AABB boundingBoxAt(float time) const override;
+    inline bool isMoving() const override { return m_HasMotion || m_Object->isMoving(); }
+    void collectLights(const MaterialTable& materials, uint32_t objectIndex, std::vector<Light>* const lights) const override;
+
+private:
+    // Note: Moving instances invert the interpolated transform for every ray
+    inline Transform getMotionWorldToObject(float time) const {
+        return lerpTransform(m_ObjectToWorld, m_EndObjectToWorld, time).inverse();
+    }
+
+    inline Ray toObjectSpace(const Ray& ray, const Transform& worldToObject) const {
+        return { worldToObject.transformPoint(ray.origin), worldToObject.transformVector(ray.dir), ray.time };
+    }
+
+    inline Ray toObjectSpace(const Ray& ray) const {
+        return m_HasMotion ? toObjectSpace(ray, getMotionWorldToObject(ray.time)) : toObjectSpace(ray, m_WorldToObject);
+    }
+
+    const Hittable* m_Object = nullptr;
+    Transform m_ObjectToWorld{};
+    Transform m_WorldToObject{};
+    Transform m_EndObjectToWorld{};
+    bool m_HasMotion = false;
+    AABB m_Bounds{};
+    AABB m_StartBounds{};
+    AABB m_EndBounds{};
+};
@@ -0,0 +1,193 @@
+#include "light.h"
+
+#include <algorithm>
+
+namespace {
+    inline uint64_t primitiveKey(uint32_t objectIndex, uint32_t primId) {
+        return ((uint64_t)objectIndex << 32) | primId;
+    }
+
+    inline float surfaceArea(const Light& light) {
+        if (light.shape == LightShape::TRIANGLE) {
+            return 0.5f * cross(light.vertices[1] - light.vertices[0], light.vertices[2] - light.vertices[0]).length();
+        }
+
+        return 4.0f * Pi * light.radius * light.radius;
+    }
+}
+
+void LightList::build(std::vector<Light>&& lights) {
+    m_Lights = std::move(lights);
+    m_SelectionCDF.resize(m_Lights.size());
+    m_SelectionPdf.resize(m_Lights.size());
+    m_LightIndices.clear();
+
+    float totalPower = 0.0f;
+
+    for (size_t i = 0; i < m_Lights.size(); ++i) {
+        const Light& light = m_Lights[i];
+
+        m_SelectionPdf[i] = luminance(light.emission) * surfaceArea(light);
+        totalPower += m_SelectionPdf[i];
+        m_SelectionCDF[i] = totalPower;
+
+        m_LightIndices[primitiveKey(light.objectIndex, light.primId)] = (uint32_t)i;
+    }
+
+    // Note: Lights that emit nothing cannot be sampled
+    if (totalPower <= 0.0f) {
+        m_Lights.clear();
+        m_SelectionCDF.clear();
+        m_SelectionPdf.clear();
+        m_LightIndices.clear();
+        return;
+    }
+
+    for (size_t i = 0; i < m_Lights.size(); ++i) {
+        m_SelectionPdf[i] /= totalPower;
+        m_SelectionCDF[i] /= totalPower;
+    }
+}
+
+bool LightList::sample(const Vec3& position, float uSelect, const Vec2& u, LightSample* const lightSample) const {
+    if (m_Lights.empty()) {
+        return false;
+    }
+
+    const size_t index = std::min(
+        (size_t)(std::upper_bound(m_SelectionCDF.begin(), m_SelectionCDF.end(), uSelect) - m_SelectionCDF.begin()),
+        m_Lights.size() - 1
+    );
+
+    const Light& light = m_Lights[index];
+
+    const bool sampled = (light.shape == LightShape::TRIANGLE) ?
+        sampleTriangle(light, position, u, lightSample) :
+        sampleSphere(light, position, u, lightSample);
+
+    if (!sampled) {
+        return false;
+    }
+
+    lightSample->emission = light.emission;
+    lightSample->pdf = m_SelectionPdf[index] * lightSample->pdf;
+
+    return lightSample->pdf > 0.0f;
+}
+
+bool LightList::sampleSphere(const Light& light, const Vec3& position, const Vec2& u, LightSample* const lightSample) const {
+    const Vec3 toCenter = light.center - position;
+    const float distanceSq = dot(toCenter, toCenter);
+    const float radiusSq = light.radius * light.radius;
+
+    // Note: Points inside a light cannot see it as a cone
+    if (distanceSq <= radiusSq) {
+        return false;
+    }
+
+    // Sample a direction uniformly within the cone subtended by the sphere
+    // Note: 1 - cos(thetaMax) is computed as sin^2 / (1 + cos), which stays
+    // accurate for small and distant lights
+    const float sinThetaMaxSq = radiusSq / distanceSq;
+    const float cosThetaMax = sqrtf(fmaxf(0.0f, 1.0f - sinThetaMaxSq));
+    const float oneMinusCosThetaMax = sinThetaMaxSq / (1.0f + cosThetaMax);
+    const float cosTheta = 1.0f - u.x * oneMinusCosThetaMax;
+    const float sinTheta = sqrtf(fmaxf(0.0f, 1.0f - cosTheta * cosTheta));
+    const float phi = 2.0f * Pi * u.y;
+
+    const float distance = sqrtf(distanceSq);
+    const Vec3 w = toCenter / distance;
+    const Vec3 a = (fabsf(w.x) > 0.9f) ? Vec3{ 0.0f, 1.0f, 0.0f } : Vec3{ 1.0f, 0.0f, 0.0f };
+    const Vec3 v = normalize(cross(w, a));
+    const Vec3 uAxis = cross(w, v);
+
+    const Vec3 direction = normalize(
+        (sinTheta * cosf(phi)) * uAxis + (sinTheta * sinf(phi)) * v + cosTheta * w);
+
+    // Distance to the near side of the sphere along the sampled direction
+    const float b = dot(direction, toCenter);
+    const float discriminant = fmaxf(0.0f, b * b - (distanceSq - radiusSq));
+
+    lightSample->direction = direction;
+    lightSample->distance = b - sqrtf(discriminant);
+    lightSample->pdf = 1.0f / coneSolidAngle(light, position);
+
+    return true;
+}
+
+// Note: Uniform in area through the square root warp of the barycentrics,
+// converted to solid angle at position
+bool LightList::sampleTriangle(const Light& light, const Vec3& position, const Vec2& u, LightSample* const lightSample) const {
+    const float su = sqrtf(u.x);
+    const Vec3 lightPosition = (1.0f - su) * light.vertices[0] +
+        (su * (1.0f - u.y)) * light.vertices[1] + (su * u.y) * light.vertices[2];
+
+    const float density = triangleDensity(light, position, lightPosition);
+
+    if (density <= 0.0f) {
+        return false;
+    }
+
+    const Vec3 toLight = lightPosition - position;
+    const float distance = toLight.length();
+
+    lightSample->direction = toLight / distance;
+    lightSample->distance = distance;
+    lightSample->pdf = density;
+
+    return true;
+}
+
+float LightList::pdf(uint32_t objectIndex, uint32_t primId, const Vec3& position, const Vec3& lightPosition) const {
+    const auto search = m_LightIndices.find(primitiveKey(objectIndex, primId));
+
+    if (search == m_LightIndices.end()) {
+        return 0.0f;
+    }
+
+    const Light& light = m_Lights[search->second];
+
+    if (light.shape == LightShape::TRIANGLE) {
+        return m_SelectionPdf[search->second] * triangleDensity(light, position, lightPosition);
+    }
+
+    const float solidAngle = coneSolidAngle(light, position);
+
+    return solidAngle > 0.0f ? m_SelectionPdf[search->second] / solidAngle : 0.0f;
+}
+
+float LightList::coneSolidAngle(const Light& light, const Vec3& position) const {
+    const Vec3 toCenter = light.center - position;
+    const float distanceSq = dot(toCenter, toCenter);
+    const float radiusSq = light.radius * light.radius;
+
+    if (distanceSq <= radiusSq) {
+        return 0.0f;
+    }
+
+    const float sinThetaMaxSq = radiusSq / distanceSq;
+    const float cosThetaMax = sqrtf(fmaxf(0.0f, 1.0f - sinThetaMaxSq));
+
+    return 2.0f * Pi * sinThetaMaxSq / (1.0f + cosThetaMax);
+}
+
+// Note: Solid angle density of sampling lightPosition uniformly on the
+// triangle, 0 if position sees the side that does not emit
+float LightList::triangleDensity(const Light& light, const Vec3& position, const Vec3& lightPosition) const {
+    const Vec3 normal = cross(light.vertices[1] - light.vertices[0], light.vertices[2] - light.vertices[0]);
+    const float normalLength = normal.length();
+    const Vec3 toLight = lightPosition - position;
+    const float distanceSq = dot(toLight, toLight);
+
+    if (normalLength <= 0.0f || distanceSq <= 0.0f) {
+        return 0.0f;
+    }
+
+    const float cosLight = -dot(normal, toLight) / (normalLength * sqrtf(distanceSq));
+
+    if (cosLight <= 0.0f) {
+        return 0.0f;
+    }
+
+    return distanceSq / (0.5f * normalLength * cosLight);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "math/sray_math.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+enum class LightShape : uint8_t {
+    SPHERE,
+    TRIANGLE
+};
+
+// Note: Emissive primitive that can be sampled directly, either a sphere
+// given by its center and radius or a triangle given by its vertices
+struct Light {
+    Vec3 center{};
+    float radius = 0.0f;
+    Vec3 emission{};
+    uint32_t objectIndex = 0; // Note: Identify the primitive in the scene, as in HitRecord
+    uint32_t primId = 0;
+    LightShape shape = LightShape::SPHERE;
+    Vec3 vertices[3]{}; // Note: Triangles emit from the side their winding faces
+};
+
+struct LightSample {
+    Vec3 direction{}; // Note: Unit length
+    float distance = 0.0f; // Note: Distance to the sampled point on the light
+    Vec3 emission{};
+    float pdf = 0.0f; // Note: Solid angle density, including the light selection probability
+};
+
+// Note: All lights of a scene. Lights are selected in proportion to their
+// emitted power. A point on a selected sphere is then sampled uniformly
+// within the cone it subtends, so that the sample density does not depend
+// on how far away the light is, while triangles are sampled uniformly by area
+class LightList {
+public:
+    LightList() = default;
+    ~LightList() = default;
+
+    void build(std::vector<Light>&& lights);
+
+    bool sample(const Vec3& position, float uSelect, const Vec2& u, LightSample* const lightSample) const;
+
+    // Note: Density with which sample() would have chosen the direction from
+    // position towards lightPosition on the light primitive, 0 if it is not
+    // a light
+    float pdf(uint32_t objectIndex, uint32_t primId, const Vec3& position, const Vec3& lightPosition) const;
+
+    inline bool isEmpty() const { return m_Lights.empty(); }
+    inline size_t size() const { return m_Lights.size(); }
+
+private:
+    // Note: Both fill in the direction, distance and the solid angle density
+    // of the sample without the light selection probability
+    bool sampleSphere(const Light& light, const Vec3& position, const Vec2& u, LightSample* const lightSample) const;
+    bool sampleTriangle(const Light& light, const Vec3& position, const Vec2& u, LightSample* const lightSample) const;
+
+    float coneSolidAngle(const Light& light, const Vec3& position) const;
+    float triangleDensity(const Light& light, const Vec3& position, const Vec3& lightPosition) const;
+
+    std::vector<Light> m_Lights;
+    std::vector<float> m_SelectionCDF;
+    std::vector<float> m_SelectionPdf;
+    std::unordered_map<uint64_t, uint32_t> m_LightIndices;
+};
@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <cstdio>
+#include <memory>
 #include <iostream>
 #include <stdexcept>
 #include <string>
@@ -9,21 +13,85 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "vendor/stb_image_write.h"
 
+#include "accumulationBuffer.h"
 #include "camera.h"
+#include "denoiser.h"
+#include "framebuffer.h"
+#include "gltfLoader.h"
+#include "instance.h"
 #include "material.h"
 #include "scene.h"
 #include "sphere.h"
+#include "sphereSoA.h"
+#include "triangleMesh.h"
 #include "math/sray_math.h"
+#include "utility/exrWriter.h"
 #include "utility/perfTimer.h"
+#include "utility/threadPool.h"
 
 struct Settings {
     int numThreads = 1;
+    int numSpheres = 100;
+    bool stacklessTraversal = false;
+    BVHType bvhType = BVHType::AUTO;
+    BVHBuilder bvhBuilder = BVHBuilder::SAH;
+    bool compareBuilders = false;
+    int rouletteDepth = 5;
+    RenderScheduler scheduler = RenderScheduler::TILES;
+    int tileSize = 16;
+    int passSamples = 0; // Note: Samples per progressive pass, 0 renders everything in one pass
+    int samplesPerPixel = 100;
+    bool adaptiveSampling = false;
+    float adaptiveThreshold = 0.02f;
+    int minSamplesPerPixel = 16;
+    bool writeSampleCountMap = false;
+    bool writeCostHeatmaps = false;
+    bool denoise = false;
+    bool writeGuideBuffers = false;
+    std::string exrPath = ""; // Note: Empty disables the AOV output
+    SamplerType samplerType = SamplerType::SOBOL;
+    double samplerComparisonBudget = 0.0; // Note: Milliseconds per sampler, 0 disables the comparison
+    bool lampScene = false; // Note: Night sky lit by a single small lamp, where direct light sampling matters most
+    bool nextEventEstimation = true;
+    float aoDistance = 0.0f; // Note: Renders ambient occlusion instead of path tracing when positive
+    std::string gltfPath = ""; // Note: Renders this model instead of the sphere scene when set
+    int numInstances = 0; // Note: Copies of the random spheres or the model, 0 adds them without instancing
+    int numFrames = 0; // Note: Renders an animation with this many frames instead of a still image when positive
+    float rebuildThreshold = 0.3f;
+    float shutter = 0.0f; // Note: Open shutter in frame intervals of the animation, positive renders motion blur
 };
 
 // Note: All argument params either support 1 or 0 input entries
 // in this implementation
 const std::unordered_map<std::string, bool> argParamsAcceptInput = {
-    { "-t", true }
+    { "-t", true },
+    { "-n", true },
+    { "-stackless", false },
+    { "-bvh", true },
+    { "-builder", true },
+    { "-buildcompare", false },
+    { "-rr", true },
+    { "-s", true },
+    { "-ts", true },
+    { "-p", true },
+    { "-spp", true },
+    { "-adaptive", true },
+    { "-minspp", true },
+    { "-sppmap", false },
+    { "-heatmap", false },
+    { "-denoise", false },
+    { "-guides", false },
+    { "-exr", true },
+    { "-sampler", true },
+    { "-rmse", true },
+    { "-lamp", false },
+    { "-nonee", false },
+    { "-ao", true },
+    { "-gltf", true },
+    { "-instances", true },
+    { "-frames", true },
+    { "-rebuild", true },
+    { "-shutter", true }
 };
 
 void parseArgsToSettings(int argc, char* argv[], Settings& settings) {
@@ -59,6 +127,250 @@ void parseArgsToSettings(int argc, char* argv[], Settings& settings) {
             settings.numThreads = std::stoi(args[i]);
             std::cout << "Setting thread count to: " << args[i] << '\n';
 
+            currArg = "";
+        }
+        else if (currArg == "-n" && currArgParamCounter == 0) {
+            settings.numSpheres = std::stoi(args[i]);
+            std::cout << "Setting random sphere count to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-bvh" && currArgParamCounter == 0) {
+            const int width = std::stoi(args[i]);
+
+            if (width != 2 && width != 4 && width != 8) {
+                throw std::runtime_error("INPUT ERROR: BVH width must be 2, 4 or 8!");
+            }
+
+            settings.bvhType = (width == 2) ? BVHType::BVH2 : (width == 4 ? BVHType::BVH4 : BVHType::BVH8);
+            std::cout << "Requesting BVH width: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-builder" && currArgParamCounter == 0) {
+            if (args[i] == "sah") {
+                settings.bvhBuilder = BVHBuilder::SAH;
+            }
+            else if (args[i] == "lbvh") {
+                settings.bvhBuilder = BVHBuilder::LBVH;
+            }
+            else {
+                throw std::runtime_error("INPUT ERROR: BVH builder must be either sah or lbvh!");
+            }
+
+            std::cout << "Setting BVH builder to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-buildcompare") {
+            settings.compareBuilders = true;
+            std::cout << "Comparing BVH builders\n";
+
+            currArg = "";
+        }
+        else if (currArg == "-rr" && currArgParamCounter == 0) {
+            settings.rouletteDepth = std::stoi(args[i]);
+            std::cout << "Setting Russian roulette depth to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-s" && currArgParamCounter == 0) {
+            if (args[i] == "rows") {
+                settings.scheduler = RenderScheduler::ROWS;
+            }
+            else if (args[i] == "tiles") {
+                settings.scheduler = RenderScheduler::TILES;
+            }
+            else {
+                throw std::runtime_error("INPUT ERROR: Scheduler must be either rows or tiles!");
+            }
+
+            std::cout << "Setting scheduler to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-ts" && currArgParamCounter == 0) {
+            settings.tileSize = std::stoi(args[i]);
+
+            if (settings.tileSize <= 0) {
+                throw std::runtime_error("INPUT ERROR: Tile size must be positive!");
+            }
+
+            std::cout << "Setting tile size to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-p" && currArgParamCounter == 0) {
+            settings.passSamples = std::stoi(args[i]);
+
+            if (settings.passSamples <= 0) {
+                throw std::runtime_error("INPUT ERROR: Samples per pass must be positive!");
+            }
+
+            std::cout << "Rendering progressively with samples per pass: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-spp" && currArgParamCounter == 0) {
+            settings.samplesPerPixel = std::stoi(args[i]);
+
+            if (settings.samplesPerPixel <= 0) {
+                throw std::runtime_error("INPUT ERROR: Samples per pixel must be positive!");
+            }
+
+            std::cout << "Setting samples per pixel to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-adaptive" && currArgParamCounter == 0) {
+            settings.adaptiveSampling = true;
+            settings.adaptiveThreshold = std::stof(args[i]);
+
+            if (settings.adaptiveThreshold <= 0.0f) {
+                throw std::runtime_error("INPUT ERROR: Adaptive sampling threshold must be positive!");
+            }
+
+            std::cout << "Using adaptive sampling with relative error threshold: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-minspp" && currArgParamCounter == 0) {
+            settings.minSamplesPerPixel = std::stoi(args[i]);
+            std::cout << "Setting minimum adaptive samples per pixel to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-sppmap") {
+            settings.writeSampleCountMap = true;
+            std::cout << "Writing sample count map to samples.png\n";
+
+            currArg = "";
+        }
+        else if (currArg == "-heatmap") {
+            settings.writeCostHeatmaps = true;
+            std::cout << "Writing per-pixel cost heatmaps to heatmap_*.png\n";
+
+            currArg = "";
+        }
+        else if (currArg == "-exr" && currArgParamCounter == 0) {
+            settings.exrPath = args[i];
+            std::cout << "Writing AOVs to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-sampler" && currArgParamCounter == 0) {
+            if (args[i] == "random") {
+                settings.samplerType = SamplerType::RANDOM;
+            }
+            else if (args[i] == "sobol") {
+                settings.samplerType = SamplerType::SOBOL;
+            }
+            else if (args[i] == "bluenoise") {
+                settings.samplerType = SamplerType::BLUE_NOISE;
+            }
+            else {
+                throw std::runtime_error("INPUT ERROR: Sampler must be random, sobol or bluenoise!");
+            }
+
+            std::cout << "Setting sampler to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-rmse" && currArgParamCounter == 0) {
+            settings.samplerComparisonBudget = std::stod(args[i]);
+            std::cout << "Comparing samplers at equal time, ms per sampler: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-denoise") {
+            settings.denoise = true;
+            std::cout << "Writing denoised image to denoised.png\n";
+
+            currArg = "";
+        }
+        else if (currArg == "-guides") {
+            settings.writeGuideBuffers = true;
+            std::cout << "Writing denoiser guide buffers to albedo.png, normal.png and depth.png\n";
+
+            currArg = "";
+        }
+        else if (currArg == "-lamp") {
+            settings.lampScene = true;
+            std::cout << "Lighting the scene with a lamp under a night sky\n";
+
+            currArg = "";
+        }
+        else if (currArg == "-nonee") {
+            settings.nextEventEstimation = false;
+            std::cout << "Disabling next event estimation\n";
+
+            currArg = "";
+        }
+        else if (currArg == "-ao" && currArgParamCounter == 0) {
+            settings.aoDistance = std::stof(args[i]);
+
+            if (settings.aoDistance <= 0.0f) {
+                throw std::runtime_error("INPUT ERROR: Ambient occlusion distance must be positive!");
+            }
+
+            std::cout << "Rendering ambient occlusion with distance: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-gltf" && currArgParamCounter == 0) {
+            settings.gltfPath = args[i];
+            std::cout << "Loading glTF model: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-instances" && currArgParamCounter == 0) {
+            settings.numInstances = std::stoi(args[i]);
+
+            if (settings.numInstances < 0) {
+                throw std::runtime_error("INPUT ERROR: Instance count must not be negative!");
+            }
+
+            std::cout << "Setting instance count to: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-frames" && currArgParamCounter == 0) {
+            settings.numFrames = std::stoi(args[i]);
+
+            if (settings.numFrames <= 0) {
+                throw std::runtime_error("INPUT ERROR: Frame count must be positive!");
+            }
+
+            std::cout << "Rendering animation frames: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-rebuild" && currArgParamCounter == 0) {
+            settings.rebuildThreshold = std::stof(args[i]);
+
+            if (settings.rebuildThreshold < 0.0f) {
+                throw std::runtime_error("INPUT ERROR: Rebuild threshold must not be negative!");
+            }
+
+            std::cout << "Rebuilding refit BVHs past a relative SAH cost increase of: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-shutter" && currArgParamCounter == 0) {
+            settings.shutter = std::stof(args[i]);
+
+            if (settings.shutter <= 0.0f) {
+                throw std::runtime_error("INPUT ERROR: Shutter interval must be positive!");
+            }
+
+            std::cout << "Rendering motion blur over a shutter of frame intervals: " << args[i] << '\n';
+
+            currArg = "";
+        }
+        else if (currArg == "-stackless") {
+            settings.stacklessTraversal = true;
+            std::cout << "Using stackless BVH traversal\n";
+
             currArg = "";
         }
     }
@@ -66,6 +378,211 @@ void parseArgsToSettings(int argc, char* argv[], Settings& settings) {
     if (currArgParamCounter != 0) {
         std::cout << "Args missing\n";
     }
+
+    // Note: Only the binary BVH has a stackless traversal, the wide BVHs
+    // always traverse with a stack
+    if (settings.stacklessTraversal) {
+        if (settings.bvhType == BVHType::BVH4 || settings.bvhType == BVHType::BVH8) {
+            throw std::runtime_error("INPUT ERROR: Stackless traversal requires a BVH width of 2!");
+        }
+
+        settings.bvhType = BVHType::BVH2;
+        std::cout << "Stackless traversal forces a BVH width of 2\n";
+    }
+}
+
+// Note: Placement of a copy on the grid of -instances
+struct InstancePlacement {
+    Vec3 position{};
+    float angle = 0.0f;
+    float scale = 1.0f;
+};
+
+// Note: Scales the object and rotates it about the vertical axis through the
+// center of its bounds, then moves it to its place on the grid
+Transform makeInstanceTransform(const InstancePlacement& placement, const Vec3& objectCenter, float spin) {
+    return Transform::translation(placement.position) * Transform::rotationY(placement.angle + spin)
+        * Transform::scaling({ placement.scale, placement.scale, placement.scale })
+        * Transform::translation({ -objectCenter.x, 0.0f, -objectCenter.z });
+}
+
+// Note: Motion of the -frames animation. The random spheres bounce and are
+// swirled around the origin, faster near the center, so that they keep
+// changing neighbours and a refit BVH degrades over time. Instances spin in
+// place like on a turntable. With an open shutter everything moves linearly
+// from where it is at the start to where it is at the end of the shutter
+// interval, so that a single render shows the motion blurred
+struct Animation {
+    static constexpr float FrameRate = 24.0f;
+    static constexpr float SwirlSpeed = 1.0f; // Note: Radians per second at the origin, a fifth of that at swirlRadius
+    static constexpr float BounceHeight = 0.5f;
+    static constexpr float SpinSpeed = 0.5f; // Note: Radians per second
+
+    SphereSoA* spheres = nullptr;
+    std::vector<Vec3> sphereRestCenters; // Note: Indexed by sphere id
+    float swirlRadius = 1.0f;
+    std::vector<Instance>* instances = nullptr;
+    std::vector<InstancePlacement> instancePlacements;
+    Vec3 objectCenter{};
+
+    Vec3 getSphereCenter(uint32_t id, float time) const {
+        const Vec3& rest = sphereRestCenters[id];
+        const float radius = sqrtf(rest.x * rest.x + rest.z * rest.z);
+        const float angle = time * SwirlSpeed / (1.0f + 4.0f * radius / swirlRadius);
+        const float phase = pcgHash(id) * (1.0f / 4294967296.0f);
+        const float bounce = BounceHeight * fabsf(sinf(Pi * (2.0f * time + phase)));
+
+        return {
+            rest.x * cosf(angle) - rest.z * sinf(angle),
+            rest.y + bounce,
+            rest.x * sinf(angle) + rest.z * cosf(angle)
+        };
+    }
+
+    // Note: The shutter is in seconds, zero places everything without motion
+    void apply(float time, float shutter) const {
+        for (uint32_t id = 0; id < (uint32_t)sphereRestCenters.size(); ++id) {
+            if (shutter > 0.0f) {
+                spheres->setCenter(id, getSphereCenter(id, time), getSphereCenter(id, time + shutter));
+            }
+            else {
+                spheres->setCenter(id, getSphereCenter(id, time));
+            }
+        }
+
+        for (size_t i = 0; i < instancePlacements.size(); ++i) {
+            const Transform start = makeInstanceTransform(instancePlacements[i], objectCenter, time * SpinSpeed);
+
+            if (shutter > 0.0f) {
+                (*instances)[i].setTransform(
+                    start, makeInstanceTransform(instancePlacements[i], objectCenter, (time + shutter) * SpinSpeed));
+            }
+            else {
+                (*instances)[i].setTransform(start);
+            }
+        }
+    }
+};
+
+// Note: Renders a high sample count reference and then gives every sampler
+// the same time budget, printing the error each reaches against the reference.
+// The reference gets ReferenceBudgetScale times the budget of a sampler, but
+// the noise left in it still adds its variance to every measured squared
+// error. It is therefore rendered as two independent halves, whose squared
+// difference is four times the variance of their average, and that variance
+// is subtracted from every squared error
+void compareSamplers(Camera& camera, const Scene& scene, ThreadPool& threadPool, double budget) {
+    constexpr double ReferenceBudgetScale = 16.0;
+    constexpr int ReferencePassSamples = 16;
+    const SamplerType samplerTypes[] = { SamplerType::RANDOM, SamplerType::SOBOL, SamplerType::BLUE_NOISE };
+    const char* const samplerNames[] = { "random", "sobol", "bluenoise" };
+
+    AccumulationBuffer reference(camera.imageWidth, camera.imageHeight);
+    AccumulationBuffer referenceHalf(camera.imageWidth, camera.imageHeight);
+    AccumulationBuffer accumulation(camera.imageWidth, camera.imageHeight);
+    PerfTimer timer{};
+
+    // Note: The reference halves use their own seeds, so that they share no
+    // samples with each other or with the measured renders. The second half
+    // takes as many samples as the first did in its time
+    camera.samplerType = SamplerType::RANDOM;
+    camera.seed = 1;
+    double referenceTime = 0.0;
+    int halfSamples = 0;
+
+    while (referenceTime < 0.5 * ReferenceBudgetScale * budget) {
+        timer.begin();
+        camera.renderPass(scene, reference, ReferencePassSamples, threadPool);
+        timer.end();
+
+        referenceTime += timer.getElapsedTime();
+        halfSamples += ReferencePassSamples;
+    }
+
+    camera.seed = 2;
+    camera.renderPass(scene, referenceHalf, halfSamples, threadPool);
+    camera.seed = 0;
+
+    const double halfDifference = reference.computeRMSE(referenceHalf);
+    const double referenceVariance = 0.25 * halfDifference * halfDifference;
+
+    for (int y = 0; y < camera.imageHeight; ++y) {
+        for (int x = 0; x < camera.imageWidth; ++x) {
+            reference.add(x, y, referenceHalf.getSamples(x, y));
+        }
+    }
+
+    std::cout << "Reference rendered at " << 2 * halfSamples << " spp, its noise of RMSE "
+        << sqrt(referenceVariance) << " is subtracted from every error\n";
+
+    for (int i = 0; i < 3; ++i) {
+        camera.samplerType = samplerTypes[i];
+
+        // Note: Warm-up pass, so that one-time setup is not part of the budget
+        camera.renderPass(scene, accumulation, 1, threadPool);
+        accumulation.clear();
+
+        double elapsed = 0.0;
+        int samplesTaken = 0;
+
+        while (elapsed < budget) {
+            timer.begin();
+            camera.renderPass(scene, accumulation, 1, threadPool);
+            timer.end();
+
+            elapsed += timer.getElapsedTime();
+            ++samplesTaken;
+        }
+
+        const double rmse = accumulation.computeRMSE(reference);
+
+        std::cout << samplerNames[i] << ": " << samplesTaken << " spp in " << elapsed << " ms, RMSE "
+            << sqrt(std::max(rmse * rmse - referenceVariance, 0.0)) << '\n';
+
+        accumulation.clear();
+    }
+}
+
+// Note: Builds the BVH over the primitives with every builder, serially and
+// on the thread pool, and prints the build time and SAH cost of each. Build
+// times include computing the primitive bounds and reordering the primitives
+void compareBuilders(
+    Hittable* const primitives,
+    const AccelerationStructure& accel,
+    BVHSettings settings,
+    ThreadPool& threadPool) {
+
+    struct BuilderConfig {
+        const char* name;
+        BVHBuilder builder;
+        ThreadPool* threadPool;
+    };
+
+    const BuilderConfig configs[] = {
+        { "serial binned SAH", BVHBuilder::SAH, nullptr },
+        { "parallel binned SAH", BVHBuilder::SAH, &threadPool },
+        { "serial LBVH", BVHBuilder::LBVH, nullptr },
+        { "parallel LBVH", BVHBuilder::LBVH, &threadPool }
+    };
+
+    // Note: Every build reorders the primitives, which makes them coherent
+    // in memory and speeds up later builds. An untimed build first gives
+    // all timed builds the same input order
+    primitives->build(settings);
+
+    PerfTimer timer{};
+
+    for (const BuilderConfig& config : configs) {
+        settings.builder = config.builder;
+        settings.threadPool = config.threadPool;
+
+        timer.begin();
+        primitives->build(settings);
+        timer.end();
+
+        std::cout << config.name << ": " << timer.getElapsedTime() << " ms, " << accel.getBVH().getNodeCount()
+            << " binary nodes, SAH cost " << accel.getBVH().computeSAHCost() << '\n';
+    }
 }
 
 int main(int argc, char* argv[]) {
@@ -86,64 +603,442 @@ int main(int argc, char* argv[]) {
 
     std::vector<uint32_t> pixels(width * height, 0xff000000); // black background
 
+    ThreadPool threadPool(settings.numThreads);
     Scene m_Scene{};
     Camera m_Camera(width, height);
 
     // Materials
-    DiffuseMaterial materialGround({ 0.3f, 0.3f, 0.3f });
-    DiffuseMaterial materialCenter({ 0.4f, 0.2f, 0.1f });
-    DielectricMaterial materialLeft(1.5f);
-    MetalMaterial materialRight({ 0.7f, 0.6f, 0.5f }, 0.0f);
+    const MaterialId materialGround = m_Scene.materials.add(DiffuseMaterial({ 0.3f, 0.3f, 0.3f }));
+    const MaterialId materialCenter = m_Scene.materials.add(DiffuseMaterial({ 0.4f, 0.2f, 0.1f }));
+    const MaterialId materialLeft = m_Scene.materials.add(DielectricMaterial(1.5f));
+    const MaterialId materialRight = m_Scene.materials.add(MetalMaterial({ 0.7f, 0.6f, 0.5f }, 0.0f));
 
     // Scene
-    Sphere left(Vec3{ 0.0f, 1.0f, 0.0f }, 1.0f, &materialLeft);
-    Sphere center(Vec3{ -4.0f, 1.0f, 0.0f }, 1.0f, &materialCenter);
-    Sphere right(Vec3{ 4.0f, 1.0f, 0.0f }, 1.0f, &materialRight);
-    Sphere ground(Vec3{ 0.0f, -1000.0f, 0.0f }, 1000.0f, &materialGround);
+    Sphere left(Vec3{ 0.0f, 1.0f, 0.0f }, 1.0f, materialLeft);
+    Sphere center(Vec3{ -4.0f, 1.0f, 0.0f }, 1.0f, materialCenter);
+    Sphere right(Vec3{ 4.0f, 1.0f, 0.0f }, 1.0f, materialRight);
+    Sphere ground(Vec3{ 0.0f, -1000.0f, 0.0f }, 1000.0f, materialGround);
+
+    const bool sphereScene = settings.gltfPath.empty();
+
+    if (sphereScene) {
+        m_Scene.add(&ground);
+        m_Scene.add(&center);
+        m_Scene.add(&left);
+        m_Scene.add(&right);
+    }
 
-    m_Scene.add(&ground);
-    m_Scene.add(&center);
-    m_Scene.add(&left);
-    m_Scene.add(&right);
+    const MaterialId materialLamp = m_Scene.materials.add(EmissiveMaterial({ 40.0f, 34.0f, 26.0f }));
+    Sphere lamp(Vec3{ 2.0f, 3.5f, 2.5f }, 0.3f, materialLamp);
+
+    if (settings.lampScene) {
+        m_Scene.add(&lamp);
+        m_Camera.skyIntensity = 0.02f;
+    }
 
     // Randomize spheres
-    std::vector<DiffuseMaterial> sphereMaterials{};
-    sphereMaterials.reserve(100);
-    std::vector<Sphere> spheres{};
-    spheres.reserve(100);
+    // Note: The spread grows with the sphere count so that the density of
+    // the default 100 sphere scene is preserved when scaling it up
+    const size_t numSpheres = sphereScene ? (size_t)settings.numSpheres : 0;
+    const float spread = 7.0f * sqrtf(numSpheres / 100.0f);
+
+    m_Scene.materials.reserve(m_Scene.materials.size() + numSpheres);
+
+    SphereSoA spheres{};
+    spheres.reserve(numSpheres);
 
-    uint32_t seed = 123456789;
+    Animation animation{};
+    animation.spheres = &spheres;
+    animation.swirlRadius = fmaxf(spread, 1.0f);
 
-    for (size_t i = 0; i < 100; ++i) {
-        DiffuseMaterial material({ randomFloat(&seed), randomFloat(&seed), randomFloat(&seed) });
-        sphereMaterials.push_back(material);
+    RandomStream sceneRandom(123456789);
 
-        const Vec3 p = { randomFloat(-7.0f, 7.0f, &seed), 0.2f, randomFloat(-7.0f, 7.0f, &seed) };
+    for (size_t i = 0; i < numSpheres; ++i) {
+        const MaterialId material = m_Scene.materials.add(
+            DiffuseMaterial({ randomFloat(&sceneRandom), randomFloat(&sceneRandom), randomFloat(&sceneRandom) }));
 
-        Sphere sphere(p, 0.2f, &sphereMaterials[i]);
-        spheres.push_back(sphere);
+        const Vec3 p = { randomFloat(-spread, spread, &sceneRandom), 0.2f, randomFloat(-spread, spread, &sceneRandom) };
 
-        m_Scene.add(&spheres[i]);
+        spheres.add(p, 0.2f, material);
+
+        if (settings.numFrames > 0 || settings.shutter > 0.0f) {
+            animation.sphereRestCenters.push_back(p);
+        }
+    }
+
+    TriangleMesh mesh{};
+
+    if (!sphereScene) {
+        PerfTimer loadTimer{};
+        loadTimer.begin();
+        loadGLTF(settings.gltfPath, m_Scene.materials, &mesh);
+        loadTimer.end();
+
+        std::cout << "Loaded " << mesh.getTriangleCount() << " triangles and " << mesh.getVertexCount()
+            << " vertices in " << loadTimer.getElapsedTime() << " ms\n";
+    }
+
+    m_Scene.bvhSettings.type = settings.bvhType;
+    m_Scene.bvhSettings.traversal = settings.stacklessTraversal ? BVHTraversal::STACKLESS : BVHTraversal::STACK;
+    m_Scene.bvhSettings.builder = settings.bvhBuilder;
+    m_Scene.bvhSettings.threadPool = &threadPool;
+    m_Scene.bvhSettings.rebuildThreshold = settings.rebuildThreshold;
+
+    // Note: The model spins like on a turntable in animations and motion
+    // blurred stills, for which it has to be an instance
+    if ((settings.numFrames > 0 || settings.shutter > 0.0f) && !sphereScene && settings.numInstances == 0) {
+        settings.numInstances = 1;
+    }
+
+    // Note: With -instances the random spheres or the model are built once
+    // as a bottom-level BVH and placed many times on a grid, every copy
+    // randomly rotated and scaled. The scene BVH over the instances is then
+    // the top-level one
+    Hittable* const primitives = sphereScene ? static_cast<Hittable*>(&spheres) : &mesh;
+    const size_t primitiveCount = sphereScene ? spheres.size() : mesh.getTriangleCount();
+    const AccelerationStructure& primitiveAccel = sphereScene ?
+        spheres.getAccelerationStructure() : mesh.getAccelerationStructure();
+
+    if (settings.compareBuilders) {
+        compareBuilders(primitives, primitiveAccel, m_Scene.bvhSettings, threadPool);
+    }
+
+    std::vector<Instance> instances;
+    AABB sceneBounds = sphereScene ? AABB{} : mesh.computeVertexBounds();
+    PerfTimer blasTimer{};
+
+    if (settings.numInstances > 0) {
+        if (primitiveCount == 0) {
+            throw std::runtime_error("INPUT ERROR: There are no primitives to instance!");
+        }
+
+        blasTimer.begin();
+        primitives->build(m_Scene.bvhSettings);
+        blasTimer.end();
+
+        const AABB objectBounds = primitives->boundingBox();
+        const Vec3 objectCenter = objectBounds.center();
+        const Vec3 objectExtent = objectBounds.extent();
+
+        // Note: The diagonal keeps rotated copies from overlapping
+        const float spacing = 1.2f * sqrtf(objectExtent.x * objectExtent.x + objectExtent.z * objectExtent.z);
+        const int gridSize = (int)ceilf(sqrtf((float)settings.numInstances));
+        const float gridOffset = 0.5f * (gridSize - 1);
+
+        instances.reserve(settings.numInstances);
+        sceneBounds = AABB{};
+
+        animation.instances = &instances;
+        animation.objectCenter = objectCenter;
+
+        for (int i = 0; i < settings.numInstances; ++i) {
+            InstancePlacement placement{};
+            placement.position = { (i % gridSize - gridOffset) * spacing, 0.0f, (i / gridSize - gridOffset) * spacing };
+            placement.angle = randomFloat(0.0f, 2.0f * Pi, &sceneRandom);
+            placement.scale = randomFloat(0.8f, 1.2f, &sceneRandom);
+
+            const Transform objectToWorld = makeInstanceTransform(placement, objectCenter, 0.0f);
+
+            instances.emplace_back(primitives, objectToWorld);
+            animation.instancePlacements.push_back(placement);
+            sceneBounds.grow(transformBounds(objectToWorld, objectBounds));
+        }
+
+        for (Instance& instance : instances) {
+            m_Scene.add(&instance);
+        }
+    }
+    else {
+        m_Scene.add(primitives);
     }
 
     m_Camera.maxDepth = 50;
+    m_Camera.rouletteDepth = settings.rouletteDepth;
     m_Camera.position = { 13.0f, 2.0f, 3.0f };
     m_Camera.lookAt = { 0.0f, 0.0f, 0.0f };
     m_Camera.up = { 0.0f, 1.0f, 0.0f };
     m_Camera.verticalFOV = toRadians(20.0f);
     m_Camera.defocusAngle = toRadians(0.0f);
     m_Camera.focusDistance = 10.0f;
-    m_Camera.samplesPerPixel = 100;
-    m_Camera.numThreads = settings.numThreads;
+    m_Camera.samplesPerPixel = settings.samplesPerPixel;
+    m_Camera.adaptiveSampling = settings.adaptiveSampling;
+    m_Camera.measurePixelCosts = settings.writeCostHeatmaps;
+    m_Camera.adaptiveThreshold = settings.adaptiveThreshold;
+    m_Camera.minSamplesPerPixel = settings.minSamplesPerPixel;
+    m_Camera.scheduler = settings.scheduler;
+    m_Camera.tileSize = settings.tileSize;
+    m_Camera.samplerType = settings.samplerType;
+    m_Camera.nextEventEstimation = settings.nextEventEstimation;
+    m_Camera.motionBlur = settings.shutter > 0.0f;
+
+    // Note: Models come in any size, so the camera is placed to fit the
+    // bounding sphere of the model into the view, looking at it from the front
+    if (!sphereScene) {
+        const Vec3 boundsCenter = sceneBounds.center();
+        const float boundsRadius = 0.5f * sceneBounds.extent().length();
+        const float distance = boundsRadius / sinf(0.5f * m_Camera.verticalFOV);
+
+        m_Camera.lookAt = boundsCenter;
+        m_Camera.position = boundsCenter + distance * normalize(Vec3{ 0.3f, 0.25f, 1.0f });
+        m_Camera.focusDistance = distance;
+    }
+
+    if (settings.aoDistance > 0.0f) {
+        m_Camera.integrator = Integrator::AMBIENT_OCCLUSION;
+        m_Camera.aoDistance = settings.aoDistance;
+    }
+
+    // Note: A still with motion blur shows the first frame of the animation
+    const float shutterTime = settings.shutter / Animation::FrameRate;
+
+    if (shutterTime > 0.0f && settings.numFrames == 0) {
+        animation.apply(0.0f, shutterTime);
+
+        if (!instances.empty()) {
+            primitives->build(m_Scene.bvhSettings);
+        }
+    }
 
     PerfTimer timer{};
     timer.begin();
-    m_Camera.render(m_Scene, pixels.data());
+    m_Scene.build();
     timer.end();
 
-    std::cout << timer.getElapsedTime() << '\n';
+    const double primitiveBuildTime = instances.empty() ? timer.getElapsedTime() : blasTimer.getElapsedTime();
 
-    stbi_write_png("image.png", width, height, 4, pixels.data(), width * 4);
+    std::cout << "BVH" << primitiveAccel.getActiveWidth() << " build time: " << primitiveBuildTime << " ms ("
+        << primitiveAccel.getBVH().getNodeCount() << " binary nodes over the " << (sphereScene ? "random spheres" : "triangles")
+        << ", SAH cost " << primitiveAccel.getBVH().computeSAHCost() << ")\n";
+
+    if (!instances.empty()) {
+        std::cout << "TLAS build time: " << timer.getElapsedTime() << " ms (" << m_Scene.getAccelerationStructure().getBVH().getNodeCount()
+            << " binary nodes over " << instances.size() << " instances, " << primitiveCount * instances.size()
+            << " instanced primitives sharing one BLAS of " << primitiveCount << ")\n";
+    }
+
+    if (settings.samplerComparisonBudget > 0.0) {
+        compareSamplers(m_Camera, m_Scene, threadPool, settings.samplerComparisonBudget);
+        return 0;
+    }
+
+    // Note: Every frame of an animation moves the scene and brings the BVHs
+    // up to date by refitting them, or by rebuilding those that refitting
+    // has degraded too far, before it is written to its own numbered image
+    if (settings.numFrames > 0) {
+        AccumulationBuffer accumulation(width, height);
+        Hittable* const sharedObject = instances.empty() ? nullptr : primitives;
+        double refitTime = 0.0;
+        double rebuildTime = 0.0;
+        int rebuildCount = 0;
+
+        for (int frame = 0; frame < settings.numFrames; ++frame) {
+            animation.apply(frame / Animation::FrameRate, shutterTime);
+
+            // Note: Instances only see the changes of the shared object once
+            // its owner has updated it
+            timer.begin();
+            bool rebuilt = (sharedObject != nullptr) && sharedObject->update(m_Scene.bvhSettings);
+            rebuilt |= m_Scene.update();
+            timer.end();
+
+            const double updateTime = timer.getElapsedTime();
+            (rebuilt ? rebuildTime : refitTime) += updateTime;
+            rebuildCount += rebuilt ? 1 : 0;
+
+            timer.begin();
+            accumulation.clear();
+            m_Camera.renderPass(m_Scene, accumulation, m_Camera.samplesPerPixel, threadPool);
+            timer.end();
+
+            char framePath[32];
+            snprintf(framePath, sizeof(framePath), "frame_%04d.png", frame);
+
+            accumulation.resolve(pixels.data());
+            stbi_write_png(framePath, width, height, 4, pixels.data(), width * 4);
+
+            std::cout << "Frame " << frame << ": BVH " << (rebuilt ? "rebuild " : "refit ") << updateTime
+                << " ms (SAH cost " << 100.0f * primitiveAccel.getSAHCostRatio() << "% of the last build, top level "
+                << 100.0f * m_Scene.getAccelerationStructure().getSAHCostRatio() << "%), render " << timer.getElapsedTime() << " ms\n";
+        }
+
+        const int refitCount = settings.numFrames - rebuildCount;
+
+        std::cout << "Average BVH refit: " << (refitCount > 0 ? refitTime / refitCount : 0.0) << " ms over " << refitCount
+            << " frames, average rebuild: " << (rebuildCount > 0 ? rebuildTime / rebuildCount : 0.0) << " ms over "
+            << rebuildCount << " frames\n";
+
+        return 0;
+    }
+
+    // Note: Without -p the image is rendered in a single pass. Otherwise it
+    // is refined in passes of a few samples each and written out after every
+    // pass, so an early preview is available long before the final image
+    const int samplesPerPass = (settings.passSamples > 0) ? settings.passSamples : m_Camera.samplesPerPixel;
+    AccumulationBuffer accumulation(width, height);
+    int samplesTaken = 0;
+    double renderTime = 0.0;
+
+    // Note: HDR beauty and the other AOVs are streamed to the EXR file row by
+    // row while rendering, every pass overwriting the rows of the previous one
+    std::unique_ptr<Framebuffer> framebuffer{};
+    ExrWriter exrWriter{};
+    std::atomic<bool> exrWriteFailed = false; // Note: Set by the row listener on any render thread
+
+    if (!settings.exrPath.empty()) {
+        framebuffer = std::make_unique<Framebuffer>(width, height);
+        framebuffer->addStandardChannels();
+
+        std::vector<ExrPixelType> channelTypes(framebuffer->getChannelCount());
+
+        for (int channel = 0; channel < framebuffer->getChannelCount(); ++channel) {
+            const bool isUint = framebuffer->getChannelType(channel) == ChannelType::UINT;
+            channelTypes[channel] = isUint ? ExrPixelType::UINT : ExrPixelType::FLOAT;
+        }
+
+        if (!exrWriter.open(settings.exrPath, width, height, framebuffer->getChannelNames(), channelTypes)) {
+            throw std::runtime_error("OUTPUT ERROR: Could not open " + settings.exrPath + " for writing!");
+        }
+
+        framebuffer->rowListener = [&](const Framebuffer& fb, int y) {
+            std::vector<const void*> channelRows(fb.getChannelCount());
+
+            for (int channel = 0; channel < fb.getChannelCount(); ++channel) {
+                if (fb.getChannelType(channel) == ChannelType::UINT) {
+                    channelRows[channel] = fb.getUintRow(channel, y);
+                }
+                else {
+                    channelRows[channel] = fb.getRow(channel, y);
+                }
+            }
+
+            if (!exrWriter.writeRow(y, channelRows.data())) {
+                exrWriteFailed = true;
+            }
+        };
+    }
+
+    m_Camera.resetStats();
+
+    while (samplesTaken < m_Camera.samplesPerPixel) {
+        const int passSamples = std::min(samplesPerPass, m_Camera.samplesPerPixel - samplesTaken);
+
+        timer.begin();
+        m_Camera.renderPass(m_Scene, accumulation, passSamples, threadPool, framebuffer.get());
+        timer.end();
+
+        renderTime += timer.getElapsedTime();
+        samplesTaken += passSamples;
+
+        accumulation.resolve(pixels.data());
+        stbi_write_png("image.png", width, height, 4, pixels.data(), width * 4);
+
+        if (settings.passSamples > 0) {
+            std::cout << "Pass done: " << samplesTaken << '/' << m_Camera.samplesPerPixel << " spp ("
+                << renderTime << " ms)\n";
+        }
+    }
+
+    if (!exrWriter.close() || exrWriteFailed) {
+        throw std::runtime_error("OUTPUT ERROR: Could not write " + settings.exrPath + "!");
+    }
+
+    const RenderStats& stats = m_Camera.getStats();
+
+    std::cout << "Render time: " << renderTime << " ms\n";
+    std::cout << "Primary rays: " << stats.primaryRays / (renderTime * 1000.0) << " Mrays/s\n";
+    std::cout << "Total rays: " << (stats.primaryRays + stats.secondaryRays + stats.occlusionRays) / (renderTime * 1000.0)
+        << " Mrays/s (" << stats.occlusionRays << " occlusion rays)\n";
+
+    if (settings.adaptiveSampling) {
+        const double pixelCount = (double)width * height;
+
+        std::cout << "Average samples per pixel: " << stats.primaryRays / pixelCount << " of "
+            << m_Camera.samplesPerPixel << " (" << 100.0 * (1.0 - stats.primaryRays / (pixelCount * m_Camera.samplesPerPixel))
+            << "% of the sample budget saved)\n";
+    }
+
+    std::cout << "Hit attribute computations avoided: " << stats.attributeComputationsAvoided << '\n';
+    std::cout << "Average path length: " << stats.getAveragePathLength() << " (escaped: "
+        << stats.pathsEscaped << ", absorbed: " << stats.pathsAbsorbed << ", roulette: "
+        << stats.pathsTerminatedByRoulette << ", max depth: " << stats.pathsTerminatedByMaxDepth << ")\n";
+
+#if SRAY_RENDER_COUNTERS
+    const uint64_t totalRays = stats.primaryRays + stats.secondaryRays + stats.occlusionRays;
+
+    std::cout << "BVH nodes visited per ray: " << (double)stats.bvhNodesVisited / std::max<uint64_t>(totalRays, 1)
+        << ", intersection tests per ray: " << (double)stats.intersectionTests / std::max<uint64_t>(totalRays, 1) << '\n';
+#endif
+
+    std::cout << "Writing render statistics to image_stats.json\n";
+
+    if (!stats.writeJSON("image_stats.json", renderTime)) {
+        throw std::runtime_error("OUTPUT ERROR: Could not write image_stats.json!");
+    }
+
+    if (settings.writeSampleCountMap) {
+        std::vector<uint32_t> sampleCountMap((size_t)width * height);
+
+        accumulation.resolveSampleCounts(sampleCountMap.data(), (uint32_t)m_Camera.samplesPerPixel);
+        stbi_write_png("samples.png", width, height, 4, sampleCountMap.data(), width * 4);
+    }
+
+    // Note: The cycle heatmap is always written. The others need the
+    // counters, which are only compiled in with SRAY_RENDER_COUNTERS
+    if (settings.writeCostHeatmaps) {
+        const CostMap& costMap = m_Camera.getCostMap();
+        std::vector<uint32_t> heatmapPixels((size_t)width * height);
+
+        const std::pair<CostMetric, const char*> heatmaps[] = {
+            { CostMetric::CYCLES, "cycles" },
+            { CostMetric::INTERSECTION_TESTS, "tests" },
+            { CostMetric::BVH_NODES, "nodes" }
+        };
+
+        for (const auto& [metric, name] : heatmaps) {
+            if (metric != CostMetric::CYCLES && !SRAY_RENDER_COUNTERS) {
+                continue;
+            }
+
+            const std::string path = std::string("heatmap_") + name + ".png";
+            const uint64_t whiteCost = costMap.resolve(metric, heatmapPixels.data());
+
+            stbi_write_png(path.c_str(), width, height, 4, heatmapPixels.data(), width * 4);
+            std::cout << "Pixel cost (" << name << "): mean " << costMap.getMean(metric) << ", white at "
+                << whiteCost << ", written to " << path << '\n';
+        }
+
+        if (!SRAY_RENDER_COUNTERS) {
+            std::cout << "Intersection test and BVH node heatmaps need a build with SRAY_RENDER_COUNTERS\n";
+        }
+    }
+
+    if (settings.writeGuideBuffers) {
+        std::vector<uint32_t> guidePixels((size_t)width * height);
+
+        accumulation.resolveGuide(GuideBuffer::ALBEDO, guidePixels.data());
+        stbi_write_png("albedo.png", width, height, 4, guidePixels.data(), width * 4);
+        accumulation.resolveGuide(GuideBuffer::NORMAL, guidePixels.data());
+        stbi_write_png("normal.png", width, height, 4, guidePixels.data(), width * 4);
+        accumulation.resolveGuide(GuideBuffer::DEPTH, guidePixels.data());
+        stbi_write_png("depth.png", width, height, 4, guidePixels.data(), width * 4);
+    }
+
+    if (settings.denoise) {
+        Denoiser denoiser{};
+        std::vector<Vec3> denoised((size_t)width * height);
+
+        timer.begin();
+        denoiser.denoise(accumulation, denoised.data(), threadPool);
+        timer.end();
+
+        std::cout << "Denoise time: " << timer.getElapsedTime() << " ms\n";
+
+        for (size_t i = 0; i < denoised.size(); ++i) {
+            pixels[i] = linearToHex(denoised[i]);
+        }
+
+        stbi_write_png("denoised.png", width, height, 4, pixels.data(), width * 4);
+    }
 
     return 0;
 }
@@ -1,6 +1,7 @@
 #include "material.h"
 
 #include "hittable.h"
+#include "sampler.h"
 
 /* Diffuse Material */
 bool DiffuseMaterial::scatter(
@@ -8,15 +9,15 @@ bool DiffuseMaterial::scatter(
     const HitData& hitData,
     Vec3* const attenuation,
     Ray* const rayScattered,
-    uint32_t* seed) const {
+    Sampler* sampler) const {
 
-    Vec3 scatterDir = hitData.normal + randomUnitVec3(seed);
+    Vec3 scatterDir = hitData.normal + sampleUnitSphere(sampler->get2D());
 
     if (scatterDir.isNearZero()) {
         scatterDir = hitData.normal;
     }
 
-    *rayScattered = { hitData.position, scatterDir };
+    *rayScattered = { hitData.position, scatterDir, rayIn.time };
     *attenuation = albedo;
 
     return true;
@@ -28,10 +29,10 @@ bool MetalMaterial::scatter(
     const HitData& hitData,
     Vec3* const attenuation,
     Ray* const rayScattered,
-    uint32_t* seed) const {
+    Sampler* sampler) const {
 
     Vec3 reflected = reflect(normalize(rayIn.dir), hitData.normal);
-    *rayScattered = { hitData.position, reflected + fuzz * randomUnitVec3(seed) };
+    *rayScattered = { hitData.position, reflected + fuzz * sampleUnitSphere(sampler->get2D()), rayIn.time };
     *attenuation = albedo;
 
     return dot(rayScattered->dir, hitData.normal) > 0;
@@ -43,7 +44,7 @@ bool DielectricMaterial::scatter(
     const HitData& hitData,
     Vec3* const attenuation,
     Ray* const rayScattered,
-    uint32_t* seed) const {
+    Sampler* sampler) const {
 
     *attenuation = { 1.0f, 1.0f, 1.0f };
     const float refractionRatio = hitData.frontFace ? (1.0f / refractionIndex) : refractionIndex;
@@ -52,17 +53,67 @@ bool DielectricMaterial::scatter(
     const float cosTheta = fmin(dot(-unitDir, hitData.normal), 1.0f);
     const float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
 
+    // Note: Drawn even under total internal reflection, so that the sampler
+    // dimensions of the following bounces do not depend on it
+    const float u = sampler->get1D();
     const bool cannotRefract = refractionRatio * sinTheta > 1.0f;
     Vec3 direction{};
 
-    if (cannotRefract || schlickReflectance(cosTheta, refractionRatio) > randomFloat(seed)) {
+    if (cannotRefract || schlickReflectance(cosTheta, refractionRatio) > u) {
         direction = reflect(unitDir, hitData.normal);
     }
     else {
         direction = refract(unitDir, hitData.normal, refractionRatio);
     }
 
-    *rayScattered = { hitData.position, direction };
+    *rayScattered = { hitData.position, direction, rayIn.time };
 
     return true;
 }
+
+/* Emissive Material */
+bool EmissiveMaterial::scatter(
+    const Ray& rayIn,
+    const HitData& hitData,
+    Vec3* const attenuation,
+    Ray* const rayScattered,
+    Sampler* sampler) const {
+
+    return false;
+}
+
+/* Material */
+bool Material::scatter(
+    const Ray& rayIn,
+    const HitData& hitData,
+    Vec3* const attenuation,
+    Ray* const rayScattered,
+    Sampler* sampler) const {
+
+    switch (type) {
+    case MaterialType::DIFFUSE:
+        return diffuse.scatter(rayIn, hitData, attenuation, rayScattered, sampler);
+    case MaterialType::METAL:
+        return metal.scatter(rayIn, hitData, attenuation, rayScattered, sampler);
+    case MaterialType::DIELECTRIC:
+        return dielectric.scatter(rayIn, hitData, attenuation, rayScattered, sampler);
+    case MaterialType::EMISSIVE:
+        return emissive.scatter(rayIn, hitData, attenuation, rayScattered, sampler);
+    }
+
+    return false;
+}
+
+Vec3 Material::getAlbedo() const {
+    switch (type) {
+    case MaterialType::DIFFUSE:
+        return diffuse.albedo;
+    case MaterialType::METAL:
+        return metal.albedo;
+    case MaterialType::DIELECTRIC:
+    case MaterialType::EMISSIVE:
+        return { 1.0f, 1.0f, 1.0f };
+    }
+
+    return {};
+}
@@ -2,23 +2,24 @@
 
 #include "math/sray_math.h"
 
+#include <vector>
+
+class Sampler;
 struct HitData;
 
-class Material {
-public:
-    virtual ~Material() = default;
+using MaterialId = uint32_t;
 
-    virtual bool scatter(
-        const Ray& rayIn,
-        const HitData& hitData,
-        Vec3* const attenuation,
-        Ray* const rayScattered,
-        uint32_t* seed) const = 0;
+enum class MaterialType : uint8_t {
+    DIFFUSE,
+    METAL,
+    DIELECTRIC,
+    EMISSIVE
 };
 
+constexpr int MaterialTypeCount = 4;
+
 // Note: Also known as Lambertian material
-class DiffuseMaterial final : public Material {
-public:
+struct DiffuseMaterial {
     DiffuseMaterial(const Vec3& color) : albedo(color) {}
 
     Vec3 albedo{};
@@ -28,26 +29,24 @@ public:
         const HitData& hitData,
         Vec3* const attenuation,
         Ray* const rayScattered,
-        uint32_t* seed) const override;
+        Sampler* sampler) const;
 };
 
-class MetalMaterial final : public Material {
-public:
+struct MetalMaterial {
     MetalMaterial(const Vec3& color, float f) : albedo(color), fuzz(f < 1.0f ? f : 1.0f) {}
 
+    Vec3 albedo{};
+    float fuzz = 0.0f;
+
     bool scatter(
         const Ray& rayIn,
         const HitData& hitData,
         Vec3* const attenuation,
         Ray* const rayScattered,
-        uint32_t* seed) const override;
-
-    Vec3 albedo{};
-    float fuzz = 0.0f;
+        Sampler* sampler) const;
 };
 
-class DielectricMaterial final : public Material {
-public:
+struct DielectricMaterial {
     DielectricMaterial(float _refractionIndex) : refractionIndex(_refractionIndex) {}
 
     float refractionIndex = 0.0f;
@@ -57,5 +56,73 @@ public:
         const HitData& hitData,
         Vec3* const attenuation,
         Ray* const rayScattered,
-        uint32_t* seed) const override;
+        Sampler* sampler) const;
+};
+
+// Note: Light source, emits radiance from its front face and absorbs
+// everything that hits it. Primitives with this material are added to the
+// light list of the scene
+struct EmissiveMaterial {
+    EmissiveMaterial(const Vec3& _emission) : emission(_emission) {}
+
+    Vec3 emission{};
+
+    bool scatter(
+        const Ray& rayIn,
+        const HitData& hitData,
+        Vec3* const attenuation,
+        Ray* const rayScattered,
+        Sampler* sampler) const;
+};
+
+// Note: Tagged union over all material types, dispatched with a switch
+// rather than a virtual call so that scattering needs no indirect branch
+struct Material {
+    Material(const DiffuseMaterial& material) : type(MaterialType::DIFFUSE), diffuse(material) {}
+    Material(const MetalMaterial& material) : type(MaterialType::METAL), metal(material) {}
+    Material(const DielectricMaterial& material) : type(MaterialType::DIELECTRIC), dielectric(material) {}
+    Material(const EmissiveMaterial& material) : type(MaterialType::EMISSIVE), emissive(material) {}
+
+    MaterialType type;
+
+    union {
+        DiffuseMaterial diffuse;
+        MetalMaterial metal;
+        DielectricMaterial dielectric;
+        EmissiveMaterial emissive;
+    };
+
+    bool scatter(
+        const Ray& rayIn,
+        const HitData& hitData,
+        Vec3* const attenuation,
+        Ray* const rayScattered,
+        Sampler* sampler) const;
+
+    // Note: Reflectance at normal incidence, used as the albedo guide of the denoiser
+    Vec3 getAlbedo() const;
+
+    inline Vec3 getEmission() const {
+        return (type == MaterialType::EMISSIVE) ? emissive.emission : Vec3{ 0.0f, 0.0f, 0.0f };
+    }
+
+    inline bool isSpecular() const { return type == MaterialType::METAL || type == MaterialType::DIELECTRIC; }
+};
+
+// Note: Contiguous storage for all materials of a scene, addressed by id.
+// Owned by the scene, so it can be shared by all render threads
+class MaterialTable {
+public:
+    inline MaterialId add(const Material& material) {
+        m_Materials.push_back(material);
+        return (MaterialId)(m_Materials.size() - 1);
+    }
+
+    inline void reserve(size_t count) { m_Materials.reserve(count); }
+    inline size_t size() const { return m_Materials.size(); }
+
+    inline const Material& operator[](MaterialId id) const { return m_Materials[id]; }
+
+private:
+    std::vector<Material> m_Materials;
 };
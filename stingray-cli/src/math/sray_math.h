@@ -3,11 +3,13 @@
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
+#include <limits>
 
 /* Constants */
 constexpr float Pi = 3.141592653589793238462643383279502884e+00F;
 constexpr float PiOver180 = Pi / 180.0f;
 constexpr float epsilon = 0.000001f;
+constexpr float Infinity = std::numeric_limits<float>::infinity();
 
 /* Vectors */
 struct Vec2 {
@@ -38,10 +40,13 @@ struct Vec3 {
         return *this;
     }
 
+    inline float operator[](int axis) const { return (&x)[axis]; }
+    inline float& operator[](int axis) { return (&x)[axis]; }
+
     inline float length() const { return sqrtf(x*x + y*y + z*z); }
 
     inline bool isNearZero() const {
-        return (x < epsilon) && (y < epsilon) && (z < epsilon);
+        return (fabsf(x) < epsilon) && (fabsf(y) < epsilon) && (fabsf(z) < epsilon);
     }
 };
 
@@ -105,6 +110,15 @@ inline Vec3 cross(const Vec3& u, const Vec3& v) {
     };
 }
 
+// Note: Component-wise minimum/maximum
+inline Vec3 min(const Vec3& u, const Vec3& v) {
+    return { fminf(u.x, v.x), fminf(u.y, v.y), fminf(u.z, v.z) };
+}
+
+inline Vec3 max(const Vec3& u, const Vec3& v) {
+    return { fmaxf(u.x, v.x), fmaxf(u.y, v.y), fmaxf(u.z, v.z) };
+}
+
 inline Vec3 normalize(const Vec3& u) {
     return (1.0f / sqrtf(u.x * u.x + u.y * u.y + u.z * u.z)) * u;
 }
@@ -124,79 +138,329 @@ inline Vec3 refract(const Vec3& uv, const Vec3& n, float etaiOverEtat) {
 struct Ray {
     Vec3 origin{};
     Vec3 dir{};
+    float time = 0.0f; // Note: Within the shutter interval [0, 1], moving primitives are intersected at this time
 
     inline Vec3 at(float t) const {
         return origin + t * dir;
     }
 };
 
-/* Randomizers */
-inline uint32_t xorShift32(uint32_t *state)
-{
-    uint32_t x = *state;
-    x ^= x << 13;
-    x ^= x >> 17;
-    x ^= x << 5;
-    *state = x;
-    return x;
-}
+/* Bounding Volumes */
+struct AABB {
+    Vec3 min = { Infinity, Infinity, Infinity };
+    Vec3 max = { -Infinity, -Infinity, -Infinity };
+
+    inline void grow(const Vec3& p) {
+        min = ::min(min, p);
+        max = ::max(max, p);
+    }
+
+    inline void grow(const AABB& box) {
+        min = ::min(min, box.min);
+        max = ::max(max, box.max);
+    }
+
+    inline Vec3 center() const { return 0.5f * (min + max); }
+    inline Vec3 extent() const { return max - min; }
 
-inline float randomFloat(uint32_t* state) {
-    return xorShift32(state) / 4294967296.0f;
+    inline float surfaceArea() const {
+        const Vec3 e = extent();
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    inline bool isEmpty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+};
+
+// Note: Bounds at time t of a box that moves linearly from start at t = 0
+// to end at t = 1. Interpolating the bounds of a node this way still
+// encloses all its children, as the minimum of the interpolated values is
+// never below the interpolated minimum
+inline AABB lerpBounds(const AABB& start, const AABB& end, float t) {
+    return { start.min + t * (end.min - start.min), start.max + t * (end.max - start.max) };
 }
 
-inline float randomFloat(float min, float max, uint32_t* state) {
-    return min + (max - min) * randomFloat(state);
+// Note: Reciprocal of a ray direction for the slab test. Zero components are
+// clamped to a tiny value, as an infinite reciprocal times a zero distance to
+// a slab plane would be NaN, and NaNs slip through the min/max of the test
+inline Vec3 safeInverse(const Vec3& dir) {
+    const auto inverse = [](float d) {
+        return 1.0f / ((fabsf(d) > 1e-20f) ? d : copysignf(1e-20f, d));
+    };
+
+    return { inverse(dir.x), inverse(dir.y), inverse(dir.z) };
 }
 
-inline Vec3 randomVec3(uint32_t* state) {
-    return { randomFloat(state), randomFloat(state), randomFloat(state) };
+// Note: Slab test against a box, using the precomputed reciprocal of the ray
+// direction. Returns the entry distance, or infinity if the box is missed
+// within [tMin, tMax]
+inline float intersectAABB(
+    const AABB& box,
+    const Vec3& origin,
+    const Vec3& invDir,
+    float tMin,
+    float tMax) {
+
+    const float tx0 = (box.min.x - origin.x) * invDir.x;
+    const float tx1 = (box.max.x - origin.x) * invDir.x;
+    const float ty0 = (box.min.y - origin.y) * invDir.y;
+    const float ty1 = (box.max.y - origin.y) * invDir.y;
+    const float tz0 = (box.min.z - origin.z) * invDir.z;
+    const float tz1 = (box.max.z - origin.z) * invDir.z;
+
+    const float tNear = fmaxf(fmaxf(fminf(tx0, tx1), fminf(ty0, ty1)), fmaxf(fminf(tz0, tz1), tMin));
+    const float tFar = fminf(fminf(fmaxf(tx0, tx1), fmaxf(ty0, ty1)), fminf(fmaxf(tz0, tz1), tMax));
+
+    return tNear <= tFar ? tNear : Infinity;
 }
 
-inline Vec3 randomVec3(float min, float max, uint32_t* state) {
-    return {
-        randomFloat(min, max, state),
-        randomFloat(min, max, state),
-        randomFloat(min, max, state)
+/* Transforms */
+// Note: Affine transform as a row-major 3x4 matrix, the same layout as the
+// transform of a TLAS instance in stingray-gui. The fourth column holds the
+// translation
+struct Transform {
+    float m[3][4] = {
+        { 1.0f, 0.0f, 0.0f, 0.0f },
+        { 0.0f, 1.0f, 0.0f, 0.0f },
+        { 0.0f, 0.0f, 1.0f, 0.0f }
     };
-}
 
-inline Vec3 randomUnitSphereVec3(uint32_t* state) {
-    while (true) {
-        const Vec3 u = randomVec3(-1.0f, 1.0f, state);
+    inline Vec3 transformPoint(const Vec3& p) const {
+        return {
+            m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+            m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+            m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]
+        };
+    }
 
-        if (dot(u, u) < 1.0f) {
-            return u;
+    inline Vec3 transformVector(const Vec3& v) const {
+        return {
+            m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+            m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+            m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z
+        };
+    }
+
+    // Note: Multiplies with the transposed linear part. Normals transform
+    // with the inverse transpose, so this is called on the inverse of the
+    // transform that moves the surface. The result is not normalized
+    inline Vec3 transformTransposed(const Vec3& n) const {
+        return {
+            m[0][0] * n.x + m[1][0] * n.y + m[2][0] * n.z,
+            m[0][1] * n.x + m[1][1] * n.y + m[2][1] * n.z,
+            m[0][2] * n.x + m[1][2] * n.y + m[2][2] * n.z
+        };
+    }
+
+    inline float determinant() const {
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+             - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+             + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    }
+
+    // Note: Whether the linear part is a uniform scale times an orthonormal
+    // matrix, so that it maps spheres to spheres. The scale is then the
+    // length of every column
+    inline bool isSimilarity(float* const scale) const {
+        const Vec3 x = { m[0][0], m[1][0], m[2][0] };
+        const Vec3 y = { m[0][1], m[1][1], m[2][1] };
+        const Vec3 z = { m[0][2], m[1][2], m[2][2] };
+        const float lengthSq = dot(x, x);
+        const float tolerance = 1e-5f * lengthSq;
+
+        if (fabsf(dot(y, y) - lengthSq) > tolerance || fabsf(dot(z, z) - lengthSq) > tolerance ||
+            fabsf(dot(x, y)) > tolerance || fabsf(dot(y, z)) > tolerance || fabsf(dot(z, x)) > tolerance) {
+            return false;
         }
+
+        *scale = sqrtf(lengthSq);
+
+        return true;
+    }
+
+    // Note: The transform must not be singular
+    Transform inverse() const {
+        const float invDet = 1.0f / determinant();
+        Transform result{};
+
+        result.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * invDet;
+        result.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet;
+        result.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+        result.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * invDet;
+        result.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+        result.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet;
+        result.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * invDet;
+        result.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet;
+        result.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+
+        const Vec3 translation = result.transformVector({ m[0][3], m[1][3], m[2][3] });
+
+        result.m[0][3] = -translation.x;
+        result.m[1][3] = -translation.y;
+        result.m[2][3] = -translation.z;
+
+        return result;
+    }
+
+    static Transform translation(const Vec3& offset) {
+        Transform result{};
+        result.m[0][3] = offset.x;
+        result.m[1][3] = offset.y;
+        result.m[2][3] = offset.z;
+
+        return result;
+    }
+
+    static Transform scaling(const Vec3& scale) {
+        Transform result{};
+        result.m[0][0] = scale.x;
+        result.m[1][1] = scale.y;
+        result.m[2][2] = scale.z;
+
+        return result;
     }
+
+    static Transform rotationY(float angle) {
+        const float c = cosf(angle);
+        const float s = sinf(angle);
+
+        Transform result{};
+        result.m[0][0] = c;
+        result.m[0][2] = s;
+        result.m[2][0] = -s;
+        result.m[2][2] = c;
+
+        return result;
+    }
+};
+
+// Note: Composition, applying v first and then u
+inline Transform operator*(const Transform& u, const Transform& v) {
+    Transform result{};
+
+    for (int row = 0; row < 3; ++row) {
+        for (int col = 0; col < 4; ++col) {
+            result.m[row][col] = u.m[row][0] * v.m[0][col] + u.m[row][1] * v.m[1][col] + u.m[row][2] * v.m[2][col];
+        }
+
+        result.m[row][3] += u.m[row][3];
+    }
+
+    return result;
 }
 
-inline Vec3 randomUnitVec3(uint32_t* state) {
-    return normalize(randomUnitSphereVec3(state));
+// Note: Bounds of the transformed corners of a box, which enclose the
+// transformed box itself
+inline AABB transformBounds(const Transform& transform, const AABB& box) {
+    AABB result{};
+
+    for (int corner = 0; corner < 8; ++corner) {
+        result.grow(transform.transformPoint({
+            (corner & 1) ? box.max.x : box.min.x,
+            (corner & 2) ? box.max.y : box.min.y,
+            (corner & 4) ? box.max.z : box.min.z
+        }));
+    }
+
+    return result;
 }
 
-inline Vec3 randomHemisphereVec3(const Vec3& normal, uint32_t* state) {
-    Vec3 onUnitSphere = randomUnitVec3(state);
+// Note: Entry-wise interpolation, exact for translation and scaling. Moving
+// a point by the interpolated transform moves it linearly between its start
+// and end positions, so interpolated bounds stay conservative
+inline Transform lerpTransform(const Transform& start, const Transform& end, float t) {
+    Transform result{};
 
-    if (dot(onUnitSphere, normal) > 0.0f) {
-        return onUnitSphere;
+    for (int row = 0; row < 3; ++row) {
+        for (int col = 0; col < 4; ++col) {
+            result.m[row][col] = start.m[row][col] + t * (end.m[row][col] - start.m[row][col]);
+        }
     }
 
-    return -onUnitSphere;
+    return result;
 }
 
-inline Vec3 randomVec3InUnitDisk(uint32_t* state) {
-    while (true) {
-        const Vec3 p = {
-            randomFloat(-1.0f, 1.0f, state),
-            randomFloat(-1.0f, 1.0f, state),
-            0.0f
-        };
+/* Randomizers */
+// Note: PCG hash (Jarzynski and Olano, "Hash Functions for GPU Rendering")
+inline uint32_t pcgHash(uint32_t value) {
+    const uint32_t state = value * 747796405u + 2891336453u;
+    const uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
 
-        if (dot(p, p) < 1.0f) {
-            return p;
-        }
+    return (word >> 22u) ^ word;
+}
+
+// Note: Counter-based random numbers. The n-th number of a stream is a hash
+// of the stream key and n, so a stream carries no state besides its counter.
+// Keying the stream on pixel and sample index makes every sample reproducible
+// no matter which thread renders it or in which order. Both indices are
+// hashed on their own before they are combined, as a key like
+// hash(hash(pixel) + sample) gives a pixel the same streams as another one
+// whose hash is off by one, just shifted by a sample
+struct RandomStream {
+    explicit RandomStream(uint32_t seed) : key(pcgHash(seed)) {}
+    RandomStream(uint32_t pixelIndex, uint32_t sampleIndex, uint32_t seed = 0) :
+        key(pcgHash(pcgHash(pixelIndex) ^ pcgHash(sampleIndex + pcgHash(seed)))) {}
+
+    uint32_t key = 0;
+    uint32_t dimension = 0;
+
+    inline uint32_t nextUint() {
+        return pcgHash(key ^ (dimension++ * 0x9e3779b9u));
+    }
+};
+
+inline float randomFloat(RandomStream* rng) {
+    // Note: The top 24 bits are exactly representable, so the result is < 1
+    return (rng->nextUint() >> 8) * (1.0f / 16777216.0f);
+}
+
+inline float randomFloat(float min, float max, RandomStream* rng) {
+    return min + (max - min) * randomFloat(rng);
+}
+
+/* Sample Mappings */
+// Note: Closed-form mappings from a point of the unit square to the
+// respective domain. They preserve the stratification of low-discrepancy
+// points and, unlike rejection sampling, consume exactly two dimensions
+inline Vec3 sampleUnitSphere(const Vec2& u) {
+    const float z = 1.0f - 2.0f * u.x;
+    const float r = sqrtf(fmaxf(0.0f, 1.0f - z * z));
+    const float phi = 2.0f * Pi * u.y;
+
+    return { r * cosf(phi), r * sinf(phi), z };
+}
+
+inline Vec3 sampleHemisphere(const Vec3& normal, const Vec2& u) {
+    const Vec3 onUnitSphere = sampleUnitSphere(u);
+    return (dot(onUnitSphere, normal) > 0.0f) ? onUnitSphere : -onUnitSphere;
+}
+
+// Note: Concentric mapping (Shirley and Chiu 1997), returns a point in the
+// xy-plane
+inline Vec3 sampleUnitDisk(const Vec2& u) {
+    const float a = 2.0f * u.x - 1.0f;
+    const float b = 2.0f * u.y - 1.0f;
+
+    if (a == 0.0f && b == 0.0f) {
+        return { 0.0f, 0.0f, 0.0f };
     }
+
+    const bool outerA = fabsf(a) > fabsf(b);
+    const float r = outerA ? a : b;
+    const float phi = outerA ? (0.25f * Pi) * (b / a) : (0.5f * Pi) - (0.25f * Pi) * (a / b);
+
+    return { r * cosf(phi), r * sinf(phi), 0.0f };
+}
+
+// Note: Multiple importance sampling weight (Veach 1997) of a sample drawn
+// with density pdf against another strategy that could have produced it
+// with density otherPdf
+inline float powerHeuristic(float pdf, float otherPdf) {
+    const float pdfSq = pdf * pdf;
+    const float sumSq = pdfSq + otherPdf * otherPdf;
+
+    return (sumSq > 0.0f) ? pdfSq / sumSq : 0.0f;
 }
 
 /* Converters */
@@ -217,6 +481,26 @@ inline float linearToGamma(float linearComponent) {
     return sqrtf(linearComponent);
 }
 
+// Note: Rec. 709 luminance of a linear RGB color
+inline float luminance(const Vec3& linearColor) {
+    return 0.2126f * linearColor.x + 0.7152f * linearColor.y + 0.0722f * linearColor.z;
+}
+
+// Note: Gamma corrects and quantizes a linear color for display
+inline uint32_t linearToHex(const Vec3& linearColor) {
+    Vec3 color = {
+        linearToGamma(linearColor.x),
+        linearToGamma(linearColor.y),
+        linearToGamma(linearColor.z)
+    };
+
+    color.x = fminf(fmaxf(color.x, 0.0f), 0.999f);
+    color.y = fminf(fmaxf(color.y, 0.0f), 0.999f);
+    color.z = fminf(fmaxf(color.z, 0.0f), 0.999f);
+
+    return rgbToHex(color);
+}
+
 /* Approximations */
 inline float schlickReflectance(float cosine, float refractionIndex) {
     float r0 = (1.0f - refractionIndex) / (1.0f + refractionIndex);
@@ -0,0 +1,38 @@
+#include "motionBvh.h"
+
+void MotionBVH::build(const BVH& bvh, const std::vector<AABB>& startSlotBounds, const std::vector<AABB>& endSlotBounds) {
+    const std::vector<BVHNode>& nodes = bvh.getNodes();
+    m_Nodes.assign(nodes.size(), {});
+
+    // Note: Children are stored after their parent, so walking the nodes
+    // backwards computes both children of a node before the node itself
+    for (size_t i = nodes.size(); i-- > 0;) {
+        MotionBVHNode& node = m_Nodes[i];
+        node.skipIndex = nodes[i].skipIndex;
+        node.primData = nodes[i].primData;
+
+        AABB startBounds{};
+        AABB endBounds{};
+
+        if (node.isLeaf()) {
+            for (uint32_t slot = node.getFirstPrim(); slot < node.getFirstPrim() + node.getPrimCount(); ++slot) {
+                startBounds.grow(startSlotBounds[slot]);
+                endBounds.grow(endSlotBounds[slot]);
+            }
+        }
+        else {
+            const MotionBVHNode& left = m_Nodes[i + 1];
+            const MotionBVHNode& right = m_Nodes[left.skipIndex];
+
+            startBounds.grow(AABB{ left.startMin, left.startMax });
+            startBounds.grow(AABB{ right.startMin, right.startMax });
+            endBounds.grow(AABB{ left.endMin, left.endMax });
+            endBounds.grow(AABB{ right.endMin, right.endMax });
+        }
+
+        node.startMin = startBounds.min;
+        node.startMax = startBounds.max;
+        node.endMin = endBounds.min;
+        node.endMax = endBounds.max;
+    }
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include "bvh.h"
+
+#include <utility>
+#include <vector>
+
+// Note: Node with the bounds of its subtree at the start and at the end of
+// the shutter interval, in the same depth-first layout as BVHNode. The
+// bounds at any time in between are interpolated linearly, which for
+// linearly moving primitives is much tighter than the union of the whole
+// motion
+struct alignas(64) MotionBVHNode {
+    Vec3 startMin{};
+    uint32_t skipIndex = 0;
+    Vec3 startMax{};
+    uint32_t primData = 0; // Note: Same encoding as BVHNode::primData
+    Vec3 endMin{};
+    uint32_t pad0 = 0;
+    Vec3 endMax{};
+    uint32_t pad1 = 0;
+
+    inline bool isLeaf() const { return primData != 0; }
+    inline uint32_t getFirstPrim() const { return primData >> 4; }
+    inline uint32_t getPrimCount() const { return primData & 0xf; }
+
+    inline AABB boundsAt(float time) const {
+        return lerpBounds({ startMin, startMax }, { endMin, endMax }, time);
+    }
+};
+
+static_assert(sizeof(MotionBVHNode) == 64, "Motion BVH nodes must fill exactly one cache line");
+
+// Note: Binary BVH for primitives that move during the shutter interval.
+// The topology is taken from a BVH built over the bounds of the whole
+// motion, while every node stores the bounds at both ends of the interval,
+// so that traversal only visits the nodes the ray can hit at its own time
+class MotionBVH {
+public:
+    MotionBVH() = default;
+    ~MotionBVH() = default;
+
+    // Note: The bounds are indexed by slot of the given BVH, see BVH::refit()
+    void build(const BVH& bvh, const std::vector<AABB>& startSlotBounds, const std::vector<AABB>& endSlotBounds);
+
+    // Note: See BVH::intersect() for the callback signature
+    template<typename IntersectFunc>
+    bool intersect(const Ray& ray, float tMin, float tMax, IntersectFunc&& intersectPrims) const;
+
+    // Note: See BVH::occluded() for the callback signature
+    template<typename OccludedFunc>
+    bool occluded(const Ray& ray, float tMin, float tMax, OccludedFunc&& occludedPrims) const;
+
+    inline bool isEmpty() const { return m_Nodes.empty(); }
+    inline size_t getNodeCount() const { return m_Nodes.size(); }
+    inline const std::vector<MotionBVHNode>& getNodes() const { return m_Nodes; }
+
+private:
+    struct StackEntry {
+        uint32_t nodeIndex;
+        float tNear;
+    };
+
+    static constexpr int MaxDepth = 128;
+
+    std::vector<MotionBVHNode> m_Nodes;
+};
+
+inline float intersectMotionNode(
+    const MotionBVHNode& node,
+    const Ray& ray,
+    const Vec3& invDir,
+    float tMin,
+    float tMax) {
+
+    return intersectAABB(node.boundsAt(ray.time), ray.origin, invDir, tMin, tMax);
+}
+
+template<typename IntersectFunc>
+bool MotionBVH::intersect(const Ray& ray, float tMin, float tMax, IntersectFunc&& intersectPrims) const {
+    if (m_Nodes.empty()) {
+        return false;
+    }
+
+    const Vec3 invDir = safeInverse(ray.dir);
+    float closestT = tMax;
+    bool anyHit = false;
+
+    if (intersectMotionNode(m_Nodes[0], ray, invDir, tMin, closestT) == Infinity) {
+        return false;
+    }
+
+    StackEntry stack[MaxDepth];
+    int stackSize = 0;
+    uint32_t nodeIndex = 0;
+
+    while (true) {
+        const MotionBVHNode& node = m_Nodes[nodeIndex];
+        SRAY_COUNT(bvhNodesVisited, 1);
+
+        if (node.isLeaf()) {
+            if (intersectPrims(node.getFirstPrim(), node.getPrimCount(), closestT)) {
+                anyHit = true;
+            }
+        }
+        else {
+            uint32_t nearIndex = nodeIndex + 1;
+            uint32_t farIndex = m_Nodes[nearIndex].skipIndex;
+            float tNear = intersectMotionNode(m_Nodes[nearIndex], ray, invDir, tMin, closestT);
+            float tFar = intersectMotionNode(m_Nodes[farIndex], ray, invDir, tMin, closestT);
+
+            if (tFar < tNear) {
+                std::swap(nearIndex, farIndex);
+                std::swap(tNear, tFar);
+            }
+
+            if (tNear != Infinity) {
+                if (tFar != Infinity) {
+                    stack[stackSize++] = { farIndex, tFar };
+                }
+
+                nodeIndex = nearIndex;
+                continue;
+            }
+        }
+
+        while (stackSize > 0 && stack[stackSize - 1].tNear > closestT) {
+            --stackSize;
+        }
+
+        if (stackSize == 0) {
+            break;
+        }
+
+        nodeIndex = stack[--stackSize].nodeIndex;
+    }
+
+    return anyHit;
+}
+
+template<typename OccludedFunc>
+bool MotionBVH::occluded(const Ray& ray, float tMin, float tMax, OccludedFunc&& occludedPrims) const {
+    if (m_Nodes.empty()) {
+        return false;
+    }
+
+    const Vec3 invDir = safeInverse(ray.dir);
+
+    if (intersectMotionNode(m_Nodes[0], ray, invDir, tMin, tMax) == Infinity) {
+        return false;
+    }
+
+    uint32_t stack[MaxDepth];
+    int stackSize = 0;
+    uint32_t nodeIndex = 0;
+
+    while (true) {
+        const MotionBVHNode& node = m_Nodes[nodeIndex];
+        SRAY_COUNT(bvhNodesVisited, 1);
+
+        if (node.isLeaf()) {
+            if (occludedPrims(node.getFirstPrim(), node.getPrimCount())) {
+                return true;
+            }
+        }
+        else {
+            const uint32_t leftIndex = nodeIndex + 1;
+            const uint32_t rightIndex = m_Nodes[leftIndex].skipIndex;
+            const bool hitLeft = intersectMotionNode(m_Nodes[leftIndex], ray, invDir, tMin, tMax) != Infinity;
+            const bool hitRight = intersectMotionNode(m_Nodes[rightIndex], ray, invDir, tMin, tMax) != Infinity;
+
+            if (hitLeft) {
+                if (hitRight) {
+                    stack[stackSize++] = rightIndex;
+                }
+
+                nodeIndex = leftIndex;
+                continue;
+            }
+
+            if (hitRight) {
+                nodeIndex = rightIndex;
+                continue;
+            }
+        }
+
+        if (stackSize == 0) {
+            break;
+        }
+
+        nodeIndex = stack[--stackSize];
+    }
+
+    return false;
+}
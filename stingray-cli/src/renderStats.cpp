@@ -0,0 +1,70 @@
+#include "renderStats.h"
+
+#include <fstream>
+#include <iomanip>
+
+bool RenderStats::writeJSON(const std::string& path, double renderTime) const {
+    std::ofstream file(path);
+
+    if (!file) {
+        return false;
+    }
+
+    const double seconds = renderTime / 1000.0;
+    const uint64_t totalRays = primaryRays + secondaryRays + occlusionRays;
+
+    file << std::setprecision(9);
+    file << "{\n";
+    file << "  \"renderTimeMs\": " << renderTime << ",\n";
+    file << "  \"primaryRays\": " << primaryRays << ",\n";
+    file << "  \"secondaryRays\": " << secondaryRays << ",\n";
+    file << "  \"occlusionRays\": " << occlusionRays << ",\n";
+    file << "  \"raysPerSecond\": " << (seconds > 0.0 ? totalRays / seconds : 0.0) << ",\n";
+    file << "  \"attributeComputationsAvoided\": " << attributeComputationsAvoided << ",\n";
+    file << "  \"pathTerminations\": {\n";
+    file << "    \"escaped\": " << pathsEscaped << ",\n";
+    file << "    \"absorbed\": " << pathsAbsorbed << ",\n";
+    file << "    \"roulette\": " << pathsTerminatedByRoulette << ",\n";
+    file << "    \"maxDepth\": " << pathsTerminatedByMaxDepth << "\n";
+    file << "  },\n";
+    file << "  \"averagePathLength\": " << getAveragePathLength() << ",\n";
+
+    // Note: Trailing empty bins are left out, the index of an entry is the
+    // path length it counts
+    int histogramSize = PathLengthBins;
+
+    while (histogramSize > 0 && pathLengthHistogram[histogramSize - 1] == 0) {
+        --histogramSize;
+    }
+
+    file << "  \"pathLengthHistogram\": [";
+
+    for (int i = 0; i < histogramSize; ++i) {
+        file << (i > 0 ? ", " : "") << pathLengthHistogram[i];
+    }
+
+    file << "],\n";
+
+#if SRAY_RENDER_COUNTERS
+    const char* const materialNames[MaterialTypeCount] = { "diffuse", "metal", "dielectric", "emissive" };
+
+    file << "  \"counters\": {\n";
+    file << "    \"intersectionTests\": " << intersectionTests << ",\n";
+    file << "    \"bvhNodesVisited\": " << bvhNodesVisited << ",\n";
+    file << "    \"intersectionTestsPerRay\": " << (totalRays > 0 ? (double)intersectionTests / totalRays : 0.0) << ",\n";
+    file << "    \"bvhNodesVisitedPerRay\": " << (totalRays > 0 ? (double)bvhNodesVisited / totalRays : 0.0) << ",\n";
+    file << "    \"scatterCounts\": {";
+
+    for (int i = 0; i < MaterialTypeCount; ++i) {
+        file << (i > 0 ? ", " : " ") << '"' << materialNames[i] << "\": " << scatterCounts[i];
+    }
+
+    file << " }\n";
+    file << "  },\n";
+#endif
+
+    file << "  \"countersEnabled\": " << (SRAY_RENDER_COUNTERS ? "true" : "false") << "\n";
+    file << "}\n";
+
+    return (bool)file;
+}
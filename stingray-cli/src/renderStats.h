@@ -0,0 +1,100 @@
+#pragma once
+
+#include "material.h"
+
+#include <cstdint>
+#include <string>
+
+// Note: Detailed counters in the traversal and intersection kernels, which
+// are too hot to count unconditionally. Enabled with -DSRAY_RENDER_COUNTERS=1,
+// otherwise SRAY_COUNT() expands to nothing and the counters do not exist
+#ifndef SRAY_RENDER_COUNTERS
+    #define SRAY_RENDER_COUNTERS 0
+#endif
+
+// Note: Every render worker counts into its own block, so the blocks are
+// aligned to cache lines to keep the workers from false sharing
+struct alignas(64) RenderStats {
+    // Note: The last bin of the histogram also collects all longer paths
+    static constexpr int PathLengthBins = 64;
+
+    uint64_t primaryRays = 0;
+    uint64_t secondaryRays = 0;
+    uint64_t occlusionRays = 0; // Note: Shadow and ambient occlusion rays, which only test for any hit
+
+    // Note: Closer hits found during traversal, whose attributes the old
+    // eager hit contract would have computed and then thrown away
+    uint64_t attributeComputationsAvoided = 0;
+
+    // Note: How paths ended, paths are absorbed when a material does not
+    // scatter the incoming ray
+    uint64_t pathsEscaped = 0;
+    uint64_t pathsAbsorbed = 0;
+    uint64_t pathsTerminatedByRoulette = 0;
+    uint64_t pathsTerminatedByMaxDepth = 0;
+    uint64_t pathLengthHistogram[PathLengthBins]{};
+
+#if SRAY_RENDER_COUNTERS
+    uint64_t intersectionTests = 0; // Note: Ray-primitive tests, instances and other objects are not counted
+    uint64_t bvhNodesVisited = 0; // Note: Nodes whose children or primitives were tested, at every level
+    uint64_t scatterCounts[MaterialTypeCount]{}; // Note: Indexed by MaterialType
+#endif
+
+    inline uint64_t getPathCount() const {
+        return pathsEscaped + pathsAbsorbed + pathsTerminatedByRoulette + pathsTerminatedByMaxDepth;
+    }
+
+    inline double getAveragePathLength() const {
+        const uint64_t pathCount = getPathCount();
+        return pathCount > 0 ? (double)(primaryRays + secondaryRays) / pathCount : 0.0;
+    }
+
+    inline RenderStats& operator+=(const RenderStats& other) {
+        primaryRays += other.primaryRays;
+        secondaryRays += other.secondaryRays;
+        occlusionRays += other.occlusionRays;
+        attributeComputationsAvoided += other.attributeComputationsAvoided;
+        pathsEscaped += other.pathsEscaped;
+        pathsAbsorbed += other.pathsAbsorbed;
+        pathsTerminatedByRoulette += other.pathsTerminatedByRoulette;
+        pathsTerminatedByMaxDepth += other.pathsTerminatedByMaxDepth;
+
+        for (int i = 0; i < PathLengthBins; ++i) {
+            pathLengthHistogram[i] += other.pathLengthHistogram[i];
+        }
+
+#if SRAY_RENDER_COUNTERS
+        intersectionTests += other.intersectionTests;
+        bvhNodesVisited += other.bvhNodesVisited;
+
+        for (int i = 0; i < MaterialTypeCount; ++i) {
+            scatterCounts[i] += other.scatterCounts[i];
+        }
+#endif
+
+        return *this;
+    }
+
+    // Note: Render time in milliseconds, used for the throughput figures
+    bool writeJSON(const std::string& path, double renderTime) const;
+};
+
+#if SRAY_RENDER_COUNTERS
+    // Note: Stats block of the render worker running on this thread, so that
+    // the kernels can count without a stats parameter. Null outside of
+    // renders, e.g. in the benchmarks, where nothing is counted
+    inline thread_local RenderStats* t_RenderStats = nullptr;
+
+    #define SRAY_COUNT(counter, amount) \
+        do { if (t_RenderStats != nullptr) { t_RenderStats->counter += (amount); } } while (false)
+#else
+    #define SRAY_COUNT(counter, amount) ((void)0)
+#endif
+
+inline void bindRenderStats(RenderStats* const stats) {
+#if SRAY_RENDER_COUNTERS
+    t_RenderStats = stats;
+#else
+    (void)stats;
+#endif
+}
@@ -0,0 +1,257 @@
+#include "sampler.h"
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+namespace {
+    constexpr int BlueNoiseSize = 64; // Note: Must be a power of two
+    constexpr int BlueNoisePixels = BlueNoiseSize * BlueNoiseSize;
+    constexpr float BlueNoiseSigma = 1.9f;
+
+    // Note: The second Sobol dimension XORs together the direction numbers
+    // of the set bits of the index, which come from the primitive polynomial
+    // x + 1. The table holds those XORs for every value of every index byte,
+    // so a point takes four lookups. The first dimension is the van der
+    // Corput sequence, which is just the bit-reversed index
+    constexpr std::array<uint32_t, 4 * 256> makeSobolByteTable() {
+        std::array<uint32_t, 32> directions{};
+        directions[0] = 1u << 31;
+
+        for (int i = 1; i < 32; ++i) {
+            directions[i] = directions[i - 1] ^ (directions[i - 1] >> 1);
+        }
+
+        std::array<uint32_t, 4 * 256> table{};
+
+        for (int byte = 0; byte < 4; ++byte) {
+            for (int value = 0; value < 256; ++value) {
+                uint32_t result = 0;
+
+                for (int bit = 0; bit < 8; ++bit) {
+                    if (value & (1 << bit)) {
+                        result ^= directions[byte * 8 + bit];
+                    }
+                }
+
+                table[byte * 256 + value] = result;
+            }
+        }
+
+        return table;
+    }
+
+    constexpr std::array<uint32_t, 4 * 256> SobolByteTable = makeSobolByteTable();
+
+    inline uint32_t reverseBits(uint32_t x) {
+        x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+        x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+        x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+        x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+
+        return (x >> 16) | (x << 16);
+    }
+
+    inline uint32_t sobolSecondDimension(uint32_t index) {
+        return SobolByteTable[index & 0xffu] ^
+            SobolByteTable[256 + ((index >> 8) & 0xffu)] ^
+            SobolByteTable[512 + ((index >> 16) & 0xffu)] ^
+            SobolByteTable[768 + (index >> 24)];
+    }
+
+    // Note: Hash-based Owen scrambling (Burley 2020, "Practical Hash-based
+    // Owen Scrambling"). The Laine-Karras permutation only lets higher bits
+    // depend on lower ones, so applying it to the reversed bits flips every
+    // digit depending on all more significant digits, like a nested uniform
+    // scramble does
+    inline uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed) {
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+
+        return x;
+    }
+
+    inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+        return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+    }
+
+    inline float toUnitFloat(uint32_t x) {
+        return (x >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // Note: Owen-scrambled 2D Sobol point. The index is shuffled with its own
+    // scramble, so that every dimension pair walks the sequence in a
+    // different order and dimensions stay uncorrelated
+    inline Vec2 scrambledSobol(uint32_t sampleIndex, uint32_t seed) {
+        const uint32_t index = nestedUniformScramble(sampleIndex, seed);
+
+        return {
+            toUnitFloat(nestedUniformScramble(reverseBits(index), pcgHash(seed ^ 0xa511e9b3u))),
+            toUnitFloat(nestedUniformScramble(sobolSecondDimension(index), pcgHash(seed ^ 0x63d83595u)))
+        };
+    }
+
+    // Note: Void-and-cluster (Ulichney 1993) on a toroidal grid. The pixels
+    // are ranked by the order in which they are added to an increasingly
+    // dense binary pattern, always filling the largest void, so that every
+    // threshold of the ranks is itself a blue-noise pattern
+    std::vector<float> generateBlueNoise() {
+        std::vector<float> kernel(BlueNoisePixels);
+
+        for (int y = 0; y < BlueNoiseSize; ++y) {
+            for (int x = 0; x < BlueNoiseSize; ++x) {
+                const int dx = std::min(x, BlueNoiseSize - x);
+                const int dy = std::min(y, BlueNoiseSize - y);
+
+                kernel[y * BlueNoiseSize + x] = expf(-(dx * dx + dy * dy) / (2.0f * BlueNoiseSigma * BlueNoiseSigma));
+            }
+        }
+
+        std::vector<uint8_t> pattern(BlueNoisePixels, 0);
+        std::vector<float> energy(BlueNoisePixels, 0.0f);
+
+        const auto toggle = [&](int index, bool set) {
+            const int ix = index % BlueNoiseSize;
+            const int iy = index / BlueNoiseSize;
+            const float sign = set ? 1.0f : -1.0f;
+
+            pattern[index] = set ? 1 : 0;
+
+            for (int y = 0; y < BlueNoiseSize; ++y) {
+                const float* const kernelRow = kernel.data() + ((y - iy) & (BlueNoiseSize - 1)) * BlueNoiseSize;
+                float* const energyRow = energy.data() + y * BlueNoiseSize;
+
+                for (int x = 0; x < BlueNoiseSize; ++x) {
+                    energyRow[x] += sign * kernelRow[(x - ix) & (BlueNoiseSize - 1)];
+                }
+            }
+        };
+
+        // Note: Tightest cluster is the set pixel of highest energy, largest
+        // void the empty pixel of lowest energy
+        const auto findExtreme = [&](uint8_t state, bool highest) {
+            int best = -1;
+
+            for (int i = 0; i < BlueNoisePixels; ++i) {
+                if (pattern[i] == state && (best < 0 || (highest ? energy[i] > energy[best] : energy[i] < energy[best]))) {
+                    best = i;
+                }
+            }
+
+            return best;
+        };
+
+        // Initial binary pattern: random points, relaxed by moving the
+        // tightest cluster into the largest void until that changes nothing
+        RandomStream rng(0xb1fe5eedu);
+        const int initialCount = BlueNoisePixels / 10;
+
+        for (int placed = 0; placed < initialCount;) {
+            const int index = (int)(randomFloat(&rng) * BlueNoisePixels);
+
+            if (pattern[index] == 0) {
+                toggle(index, true);
+                ++placed;
+            }
+        }
+
+        while (true) {
+            const int cluster = findExtreme(1, true);
+            toggle(cluster, false);
+
+            const int largestVoid = findExtreme(0, false);
+            toggle(largestVoid, true);
+
+            if (largestVoid == cluster) {
+                break;
+            }
+        }
+
+        const std::vector<uint8_t> prototype = pattern;
+        const std::vector<float> prototypeEnergy = energy;
+        std::vector<int> ranks(BlueNoisePixels, 0);
+
+        // Phase 1: rank the initial points by removing the tightest clusters
+        for (int rank = initialCount - 1; rank >= 0; --rank) {
+            const int cluster = findExtreme(1, true);
+
+            ranks[cluster] = rank;
+            toggle(cluster, false);
+        }
+
+        // Phase 2: rank the remaining pixels by filling the largest voids
+        pattern = prototype;
+        energy = prototypeEnergy;
+
+        for (int rank = initialCount; rank < BlueNoisePixels; ++rank) {
+            const int largestVoid = findExtreme(0, false);
+
+            ranks[largestVoid] = rank;
+            toggle(largestVoid, true);
+        }
+
+        std::vector<float> values(BlueNoisePixels);
+
+        for (int i = 0; i < BlueNoisePixels; ++i) {
+            values[i] = (ranks[i] + 0.5f) / BlueNoisePixels;
+        }
+
+        return values;
+    }
+
+    // Note: Generated once on first use, which takes a few tens of milliseconds
+    const std::vector<float>& getBlueNoiseTile() {
+        static const std::vector<float> tile = generateBlueNoise();
+        return tile;
+    }
+
+    inline float blueNoiseShift(float value, int x, int y, uint32_t offsetHash) {
+        const int tileX = (x + (int)(offsetHash & 0xffffu)) & (BlueNoiseSize - 1);
+        const int tileY = (y + (int)(offsetHash >> 16)) & (BlueNoiseSize - 1);
+
+        const float shifted = value + getBlueNoiseTile()[tileY * BlueNoiseSize + tileX];
+        const float wrapped = (shifted >= 1.0f) ? shifted - 1.0f : shifted;
+
+        return fminf(wrapped, 0.99999994f);
+    }
+}
+
+Sampler::Sampler(SamplerType type, int x, int y, uint32_t pixelIndex, uint32_t sampleIndex, uint32_t seed) :
+    m_Type(type), m_Random(pixelIndex, sampleIndex, seed), m_Seed(pcgHash(seed)),
+    m_PixelSeed(pcgHash(pixelIndex ^ m_Seed)), m_SampleIndex(sampleIndex), m_X(x), m_Y(y) {}
+
+float Sampler::get1D() {
+    if (m_Type == SamplerType::RANDOM) {
+        return randomFloat(&m_Random);
+    }
+
+    return get2D().x;
+}
+
+Vec2 Sampler::get2D() {
+    const uint32_t dimension = m_Dimension++;
+
+    switch (m_Type) {
+    case SamplerType::RANDOM:
+        return { randomFloat(&m_Random), randomFloat(&m_Random) };
+    case SamplerType::SOBOL:
+        return scrambledSobol(m_SampleIndex, pcgHash(m_PixelSeed ^ (dimension * 0x9e3779b9u)));
+    case SamplerType::BLUE_NOISE: {
+        // Note: Every pixel uses the same sequence, shifted by the blue-noise
+        // tile at an offset that differs per dimension, so that the error of
+        // neighboring pixels is negatively correlated
+        const uint32_t seed = pcgHash(m_Seed ^ (dimension * 0x9e3779b9u));
+        const Vec2 u = scrambledSobol(m_SampleIndex, seed);
+
+        return {
+            blueNoiseShift(u.x, m_X, m_Y, pcgHash(seed ^ 0x5bd1e995u)),
+            blueNoiseShift(u.y, m_X, m_Y, pcgHash(seed ^ 0x27d4eb2fu))
+        };
+    }
+    }
+
+    return {};
+}
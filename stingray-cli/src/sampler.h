@@ -0,0 +1,34 @@
+#pragma once
+
+#include "math/sray_math.h"
+
+enum class SamplerType : uint8_t {
+    RANDOM, // Note: Independent white noise from the counter-based RandomStream
+    SOBOL, // Note: Owen-scrambled Sobol, decorrelated per pixel
+    BLUE_NOISE // Note: One scrambled Sobol sequence for all pixels, shifted per pixel by a blue-noise tile
+};
+
+// Note: Source of the sample values of a single camera sample. Every call to
+// get1D() or get2D() consumes one dimension, so the path integrator must
+// request them in the same order for every sample. Samplers are cheap to
+// construct and are created on the stack for every camera sample; the sampler
+// type is dispatched with a switch like the materials
+class Sampler {
+public:
+    // Note: Samplers with different seeds draw independent sample sets
+    Sampler(SamplerType type, int x, int y, uint32_t pixelIndex, uint32_t sampleIndex, uint32_t seed = 0);
+    ~Sampler() = default;
+
+    float get1D();
+    Vec2 get2D();
+
+private:
+    SamplerType m_Type;
+    RandomStream m_Random;
+    uint32_t m_Seed = 0;
+    uint32_t m_PixelSeed = 0;
+    uint32_t m_SampleIndex = 0;
+    uint32_t m_Dimension = 0;
+    int m_X = 0;
+    int m_Y = 0;
+};
@@ -1,17 +1,130 @@
 #include "scene.h"
 
-bool Scene::hit(const Ray& ray, float tMin, float tMax, HitData* const hitData) const {
-    HitData tempHitData{};
-    bool anyHit = false;
-    float closestT = tMax;
+void Scene::build() {
+    std::vector<AABB> objectBounds(objects.size());
+
+    for (size_t i = 0; i < objects.size(); ++i) {
+        objects[i]->build(bvhSettings);
+        objectBounds[i] = objects[i]->boundingBox();
+    }
+
+    buildTopLevel(objectBounds);
+}
+
+bool Scene::update() {
+    std::vector<AABB> objectBounds(objects.size());
+    bool rebuilt = false;
 
     for (size_t i = 0; i < objects.size(); ++i) {
-        if (objects[i]->hit(ray, tMin, closestT, &tempHitData)) {
-            anyHit = true;
-            closestT = tempHitData.t;
-            *hitData = tempHitData;
+        rebuilt |= objects[i]->update(bvhSettings);
+        objectBounds[i] = objects[i]->boundingBox();
+    }
+
+    // Note: The objects are already in leaf order, so their bounds are
+    // indexed by slot. Moving objects need a motion BVH, which is rebuilt
+    if (hasMovingObjects() || m_Accel.refit(objectBounds, bvhSettings)) {
+        buildTopLevel(objectBounds);
+        return true;
+    }
+
+    collectLights();
+
+    return rebuilt;
+}
+
+void Scene::buildTopLevel(const std::vector<AABB>& objectBounds) {
+    if (hasMovingObjects()) {
+        std::vector<AABB> startBounds(objects.size());
+        std::vector<AABB> endBounds(objects.size());
+
+        for (size_t i = 0; i < objects.size(); ++i) {
+            startBounds[i] = objects[i]->boundingBoxAt(0.0f);
+            endBounds[i] = objects[i]->boundingBoxAt(1.0f);
         }
+
+        m_Accel.build(startBounds, endBounds, bvhSettings);
+    }
+    else {
+        m_Accel.build(objectBounds, bvhSettings);
     }
 
-    return anyHit;
+    // Note: Store the objects in leaf order, so that every leaf references
+    // a contiguous range of objects without going through an index array
+    const std::vector<uint32_t>& primIndices = m_Accel.getPrimIndices();
+    std::vector<Hittable*> orderedObjects(objects.size());
+    std::vector<uint32_t> orderedObjectIds(objects.size());
+
+    for (size_t i = 0; i < objects.size(); ++i) {
+        orderedObjects[i] = objects[primIndices[i]];
+        orderedObjectIds[i] = m_ObjectIds[primIndices[i]];
+    }
+
+    objects = std::move(orderedObjects);
+    m_ObjectIds = std::move(orderedObjectIds);
+
+    collectLights();
+}
+
+bool Scene::hasMovingObjects() const {
+    for (const Hittable* object : objects) {
+        if (object->isMoving()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Scene::collectLights() {
+    std::vector<Light> sceneLights;
+
+    for (size_t i = 0; i < objects.size(); ++i) {
+        objects[i]->collectLights(materials, (uint32_t)i, &sceneLights);
+    }
+
+    lights.build(std::move(sceneLights));
+}
+
+bool Scene::intersect(const Ray& ray, float tMin, float tMax, HitRecord* const record) const {
+    return m_Accel.intersect(ray, tMin, tMax, [&](uint32_t first, uint32_t count, float& closestT) {
+        bool anyHit = false;
+
+        for (uint32_t i = first; i < first + count; ++i) {
+            if (objects[i]->intersect(ray, tMin, closestT, record)) {
+                anyHit = true;
+                closestT = record->t;
+                record->objectIndex = i;
+            }
+        }
+
+        return anyHit;
+    });
+}
+
+void Scene::computeHitData(const Ray& ray, const HitRecord& record, HitData* const hitData) const {
+    objects[record.objectIndex]->computeHitData(ray, record, hitData);
+}
+
+bool Scene::occluded(const Ray& ray, float tMin, float tMax) const {
+    return m_Accel.occluded(ray, tMin, tMax, [&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; ++i) {
+            if (objects[i]->occluded(ray, tMin, tMax)) {
+                return true;
+            }
+        }
+
+        return false;
+    });
+}
+
+bool Scene::hit(const Ray& ray, float tMin, float tMax, HitData* const hitData) const {
+    HitRecord record{};
+
+    if (!intersect(ray, tMin, tMax, &record)) {
+        return false;
+    }
+
+    computeHitData(ray, record, hitData);
+
+    return true;
 }
@@ -2,14 +2,60 @@
 
 #include <memory>
 #include <vector>
+#include "accelerationStructure.h"
 #include "hittable.h"
+#include "light.h"
+#include "material.h"
 
-struct Scene {
+class Scene {
+public:
     std::vector<Hittable*> objects;
+    MaterialTable materials;
+    BVHSettings bvhSettings{};
+    LightList lights; // Note: Filled in by build()
 
     inline void add(Hittable* object) {
+        m_ObjectIds.push_back((uint32_t)objects.size());
         objects.push_back(object);
     }
 
+    // Note: Must be called after all objects have been added and before
+    // the scene is rendered, as hit() only traverses the BVH. The objects
+    // are reordered to match the leaf order of the BVH
+    void build();
+
+    // Note: Brings the BVH up to date after objects or their primitives
+    // moved, refitting it or rebuilding it once the SAH cost has degraded
+    // past bvhSettings.rebuildThreshold. Returns true if the BVH of the
+    // scene or of any object was rebuilt
+    bool update();
+
+    // Note: Closest-hit search that only fills in the compact record, the
+    // attributes of the final hit are then computed by computeHitData()
+    bool intersect(const Ray& ray, float tMin, float tMax, HitRecord* const record) const;
+    void computeHitData(const Ray& ray, const HitRecord& record, HitData* const hitData) const;
+
+    // Note: Index the hit object was added with and the stable id of the hit
+    // primitive within it. record.objectIndex and record.primId are BVH leaf
+    // slots, which change with every build
+    inline uint32_t getObjectId(const HitRecord& record) const { return m_ObjectIds[record.objectIndex]; }
+    inline uint32_t getPrimitiveId(const HitRecord& record) const { return objects[record.objectIndex]->getPrimitiveId(record); }
+
     bool hit(const Ray& ray, float tMin, float tMax, HitData* const hitData) const;
+
+    // Note: Any-hit query for shadow and ambient occlusion rays, the CPU
+    // counterpart of RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH in stingray-gui
+    bool occluded(const Ray& ray, float tMin, float tMax) const;
+
+    inline const AccelerationStructure& getAccelerationStructure() const { return m_Accel; }
+
+private:
+    // Note: Builds the BVH over the objects and reorders them to its leaf
+    // order. Uses a motion BVH as soon as any object moves
+    void buildTopLevel(const std::vector<AABB>& objectBounds);
+    void collectLights();
+    bool hasMovingObjects() const;
+
+    AccelerationStructure m_Accel;
+    std::vector<uint32_t> m_ObjectIds; // Note: Index the object in every slot was added with
 };
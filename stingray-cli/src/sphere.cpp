@@ -1,7 +1,9 @@
 #include "sphere.h"
 
-bool Sphere::hit(const Ray& ray, float tMin, float tMax, HitData* const hitData) const {
-    const Vec3 oc = ray.origin - position;
+bool Sphere::intersect(const Ray& ray, float tMin, float tMax, HitRecord* const record) const {
+    SRAY_COUNT(intersectionTests, 1);
+
+    const Vec3 oc = ray.origin - getPosition(ray.time);
     const float a = dot(ray.dir, ray.dir);
     const float bHalf = dot(ray.dir, oc);
     const float c = dot(oc, oc) - radius * radius;
@@ -23,12 +25,64 @@ bool Sphere::hit(const Ray& ray, float tMin, float tMax, HitData* const hitData)
         }
     }
 
-    hitData->t = root;
-    hitData->position = ray.at(root);
+    record->t = root;
+    record->primId = 0;
+    record->candidateCount++;
+
+    return true;
+}
+
+bool Sphere::occluded(const Ray& ray, float tMin, float tMax) const {
+    SRAY_COUNT(intersectionTests, 1);
 
-    const Vec3 outwardNormal = (hitData->position - position) / radius;
+    const Vec3 oc = ray.origin - getPosition(ray.time);
+    const float a = dot(ray.dir, ray.dir);
+    const float bHalf = dot(ray.dir, oc);
+    const float c = dot(oc, oc) - radius * radius;
+    const float discriminant = bHalf * bHalf - a * c;
+
+    if (discriminant < 0.0f) {
+        return false;
+    }
+
+    // Note: Either root within the interval occludes it
+    const float invDenom = 1.0f / a;
+    const float sqrtTerm = sqrtf(discriminant);
+    const float nearRoot = (-bHalf - sqrtTerm) * invDenom;
+    const float farRoot = (-bHalf + sqrtTerm) * invDenom;
+
+    return (tMin < nearRoot && nearRoot < tMax) || (tMin < farRoot && farRoot < tMax);
+}
+
+void Sphere::computeHitData(const Ray& ray, const HitRecord& record, HitData* const hitData) const {
+    hitData->t = record.t;
+    hitData->position = ray.at(record.t);
+
+    const Vec3 outwardNormal = (hitData->position - getPosition(ray.time)) / radius;
     hitData->setNormal(ray, outwardNormal);
-    hitData->material = material;
+    hitData->materialId = materialId;
+}
 
-    return true;
+void Sphere::collectLights(const MaterialTable& materials, uint32_t objectIndex, std::vector<Light>* const lights) const {
+    const Vec3 emission = materials[materialId].getEmission();
+
+    // Note: Lights are sampled at fixed positions, so moving emitters are
+    // only found by BSDF sampling, whose MIS weight is then one
+    if (luminance(emission) > 0.0f && !isMoving()) {
+        lights->push_back({ position, radius, emission, objectIndex, 0 });
+    }
+}
+
+AABB Sphere::boundingBox() const {
+    AABB bounds = boundingBoxAt(0.0f);
+    bounds.grow(boundingBoxAt(1.0f));
+
+    return bounds;
+}
+
+AABB Sphere::boundingBoxAt(float time) const {
+    const Vec3 r = { radius, radius, radius };
+    const Vec3 center = getPosition(time);
+
+    return { center - r, center + r };
 }
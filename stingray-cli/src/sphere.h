@@ -4,12 +4,28 @@
 
 class Sphere final : public Hittable {
 public:
-    Sphere(Vec3 _position, float _radius, Material* _material) :
-        position(_position), radius(_radius), material(_material) {}
+    Sphere(Vec3 _position, float _radius, MaterialId _materialId) :
+        position(_position), endPosition(_position), radius(_radius), materialId(_materialId) {}
+
+    // Note: Moves linearly from the start to the end position during the
+    // shutter interval
+    Sphere(Vec3 _position, Vec3 _endPosition, float _radius, MaterialId _materialId) :
+        position(_position), endPosition(_endPosition), radius(_radius), materialId(_materialId) {}
 
     Vec3 position{};
+    Vec3 endPosition{};
     float radius = 0.5f;
-    Material* material = nullptr;
+    MaterialId materialId = 0;
+
+    bool intersect(const Ray& ray, float tMin, float tMax, HitRecord* const record) const override;
+    void computeHitData(const Ray& ray, const HitRecord& record, HitData* const hitData) const override;
+    bool occluded(const Ray& ray, float tMin, float tMax) const override;
+    AABB boundingBox() const override;
+    AABB boundingBoxAt(float time) const override;
+    inline bool isMoving() const override {
+        return endPosition.x != position.x || endPosition.y != position.y || endPosition.z != position.z;
+    }
+    void collectLights(const MaterialTable& materials, uint32_t objectIndex, std::vector<Light>* const lights) const override;
 
-    bool hit(const Ray& ray, float tMin, float tMax, HitData* const hitData) const override;
+    inline Vec3 getPosition(float time) const { return position + time * (endPosition - position); }
 };
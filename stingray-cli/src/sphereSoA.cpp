@@ -0,0 +1,554 @@
+#include "sphereSoA.h"
+#include "utility/threadPool.h"
+
+#include <algorithm>
+#include <bit>
+#include <type_traits>
+
+#if SRAY_X64
+    #include <immintrin.h>
+#endif
+
+namespace {
+    struct SphereArrays {
+        const float* centerX;
+        const float* centerY;
+        const float* centerZ;
+        const float* radiusSq;
+        const float* motionX; // Note: Null without motion
+        const float* motionY;
+        const float* motionZ;
+    };
+
+    inline Vec3 centerAt(const SphereArrays& spheres, uint32_t i, float time) {
+        const Vec3 center = { spheres.centerX[i], spheres.centerY[i], spheres.centerZ[i] };
+
+        if (spheres.motionX == nullptr) {
+            return center;
+        }
+
+        return center + time * Vec3{ spheres.motionX[i], spheres.motionY[i], spheres.motionZ[i] };
+    }
+
+    bool intersectScalar(
+        const SphereArrays& spheres,
+        const Ray& ray,
+        uint32_t first,
+        uint32_t count,
+        float tMin,
+        float tMax,
+        uint32_t* const slot,
+        float* const t) {
+
+        const float a = dot(ray.dir, ray.dir);
+        const float invA = 1.0f / a;
+        bool anyHit = false;
+
+        for (uint32_t i = first; i < first + count; ++i) {
+            const Vec3 oc = ray.origin - centerAt(spheres, i, ray.time);
+            const float bHalf = dot(ray.dir, oc);
+            const float c = dot(oc, oc) - spheres.radiusSq[i];
+            const float discriminant = bHalf * bHalf - a * c;
+
+            if (discriminant < 0.0f) {
+                continue;
+            }
+
+            const float sqrtTerm = sqrtf(discriminant);
+            float root = (-bHalf - sqrtTerm) * invA;
+
+            if (root <= tMin || tMax <= root) {
+                root = (-bHalf + sqrtTerm) * invA;
+
+                if (root <= tMin || tMax <= root) {
+                    continue;
+                }
+            }
+
+            tMax = root;
+            *slot = i;
+            anyHit = true;
+        }
+
+        *t = tMax;
+
+        return anyHit;
+    }
+
+    bool occludedScalar(
+        const SphereArrays& spheres,
+        const Ray& ray,
+        uint32_t first,
+        uint32_t count,
+        float tMin,
+        float tMax) {
+
+        const float a = dot(ray.dir, ray.dir);
+        const float invA = 1.0f / a;
+
+        for (uint32_t i = first; i < first + count; ++i) {
+            const Vec3 oc = ray.origin - centerAt(spheres, i, ray.time);
+            const float bHalf = dot(ray.dir, oc);
+            const float c = dot(oc, oc) - spheres.radiusSq[i];
+            const float discriminant = bHalf * bHalf - a * c;
+
+            if (discriminant < 0.0f) {
+                continue;
+            }
+
+            const float sqrtTerm = sqrtf(discriminant);
+            const float nearRoot = (-bHalf - sqrtTerm) * invA;
+            const float farRoot = (-bHalf + sqrtTerm) * invA;
+
+            if ((tMin < nearRoot && nearRoot < tMax) || (tMin < farRoot && farRoot < tMax)) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+#if SRAY_X64
+    SRAY_TARGET_AVX2 inline bool intersectAVX2(
+        const SphereArrays& spheres,
+        const Ray& ray,
+        uint32_t first,
+        uint32_t count,
+        float tMin,
+        float tMax,
+        uint32_t* const slot,
+        float* const t) {
+
+        const __m256 originX = _mm256_set1_ps(ray.origin.x);
+        const __m256 originY = _mm256_set1_ps(ray.origin.y);
+        const __m256 originZ = _mm256_set1_ps(ray.origin.z);
+        const __m256 dirX = _mm256_set1_ps(ray.dir.x);
+        const __m256 dirY = _mm256_set1_ps(ray.dir.y);
+        const __m256 dirZ = _mm256_set1_ps(ray.dir.z);
+        const __m256 a = _mm256_set1_ps(dot(ray.dir, ray.dir));
+        const __m256 invA = _mm256_set1_ps(1.0f / dot(ray.dir, ray.dir));
+        const __m256 tMinV = _mm256_set1_ps(tMin);
+        const __m256 time = _mm256_set1_ps(ray.time);
+        const __m256 laneIndices = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+        bool anyHit = false;
+
+        for (uint32_t base = first; base < first + count; base += 8) {
+            const __m256 tMaxV = _mm256_set1_ps(tMax);
+            const __m256 laneMask = _mm256_cmp_ps(
+                laneIndices, _mm256_set1_ps((float)(first + count - base)), _CMP_LT_OQ);
+
+            __m256 centerX = _mm256_loadu_ps(spheres.centerX + base);
+            __m256 centerY = _mm256_loadu_ps(spheres.centerY + base);
+            __m256 centerZ = _mm256_loadu_ps(spheres.centerZ + base);
+
+            if (spheres.motionX != nullptr) {
+                centerX = _mm256_fmadd_ps(time, _mm256_loadu_ps(spheres.motionX + base), centerX);
+                centerY = _mm256_fmadd_ps(time, _mm256_loadu_ps(spheres.motionY + base), centerY);
+                centerZ = _mm256_fmadd_ps(time, _mm256_loadu_ps(spheres.motionZ + base), centerZ);
+            }
+
+            const __m256 ocX = _mm256_sub_ps(originX, centerX);
+            const __m256 ocY = _mm256_sub_ps(originY, centerY);
+            const __m256 ocZ = _mm256_sub_ps(originZ, centerZ);
+
+            const __m256 bHalf = _mm256_fmadd_ps(dirX, ocX, _mm256_fmadd_ps(dirY, ocY, _mm256_mul_ps(dirZ, ocZ)));
+            const __m256 c = _mm256_sub_ps(
+                _mm256_fmadd_ps(ocX, ocX, _mm256_fmadd_ps(ocY, ocY, _mm256_mul_ps(ocZ, ocZ))),
+                _mm256_loadu_ps(spheres.radiusSq + base));
+            const __m256 discriminant = _mm256_fmsub_ps(bHalf, bHalf, _mm256_mul_ps(a, c));
+
+            __m256 valid = _mm256_and_ps(laneMask, _mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GE_OQ));
+
+            if (_mm256_movemask_ps(valid) == 0) {
+                continue;
+            }
+
+            // Note: Prefer the near root, falling back to the far root when the
+            // ray starts inside the sphere, exactly like Sphere::hit()
+            const __m256 sqrtTerm = _mm256_sqrt_ps(_mm256_max_ps(discriminant, _mm256_setzero_ps()));
+            const __m256 nearRoot = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), bHalf), sqrtTerm), invA);
+            const __m256 farRoot = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_setzero_ps(), bHalf), sqrtTerm), invA);
+            const __m256 nearValid = _mm256_and_ps(
+                _mm256_cmp_ps(nearRoot, tMinV, _CMP_GT_OQ), _mm256_cmp_ps(nearRoot, tMaxV, _CMP_LT_OQ));
+            const __m256 root = _mm256_blendv_ps(farRoot, nearRoot, nearValid);
+
+            valid = _mm256_and_ps(valid, _mm256_and_ps(
+                _mm256_cmp_ps(root, tMinV, _CMP_GT_OQ), _mm256_cmp_ps(root, tMaxV, _CMP_LT_OQ)));
+
+            const int validMask = _mm256_movemask_ps(valid);
+
+            if (validMask == 0) {
+                continue;
+            }
+
+            // Horizontal minimum over the valid lanes
+            const __m256 roots = _mm256_blendv_ps(_mm256_set1_ps(Infinity), root, valid);
+            __m256 minRoot = _mm256_min_ps(roots, _mm256_permute2f128_ps(roots, roots, 1));
+            minRoot = _mm256_min_ps(minRoot, _mm256_shuffle_ps(minRoot, minRoot, _MM_SHUFFLE(1, 0, 3, 2)));
+            minRoot = _mm256_min_ps(minRoot, _mm256_shuffle_ps(minRoot, minRoot, _MM_SHUFFLE(2, 3, 0, 1)));
+
+            const int minMask = _mm256_movemask_ps(_mm256_cmp_ps(roots, minRoot, _CMP_EQ_OQ)) & validMask;
+
+            tMax = _mm256_cvtss_f32(minRoot);
+            *slot = base + (uint32_t)std::countr_zero((uint32_t)minMask);
+            anyHit = true;
+        }
+
+        *t = tMax;
+
+        return anyHit;
+    }
+
+    // Note: Same as intersectAVX2(), but returns as soon as any lane has a
+    // root within the interval, without reducing to the closest one
+    SRAY_TARGET_AVX2 inline bool occludedAVX2(
+        const SphereArrays& spheres,
+        const Ray& ray,
+        uint32_t first,
+        uint32_t count,
+        float tMin,
+        float tMax) {
+
+        const __m256 originX = _mm256_set1_ps(ray.origin.x);
+        const __m256 originY = _mm256_set1_ps(ray.origin.y);
+        const __m256 originZ = _mm256_set1_ps(ray.origin.z);
+        const __m256 dirX = _mm256_set1_ps(ray.dir.x);
+        const __m256 dirY = _mm256_set1_ps(ray.dir.y);
+        const __m256 dirZ = _mm256_set1_ps(ray.dir.z);
+        const __m256 a = _mm256_set1_ps(dot(ray.dir, ray.dir));
+        const __m256 invA = _mm256_set1_ps(1.0f / dot(ray.dir, ray.dir));
+        const __m256 tMinV = _mm256_set1_ps(tMin);
+        const __m256 time = _mm256_set1_ps(ray.time);
+        const __m256 tMaxV = _mm256_set1_ps(tMax);
+        const __m256 laneIndices = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+
+        for (uint32_t base = first; base < first + count; base += 8) {
+            const __m256 laneMask = _mm256_cmp_ps(
+                laneIndices, _mm256_set1_ps((float)(first + count - base)), _CMP_LT_OQ);
+
+            __m256 centerX = _mm256_loadu_ps(spheres.centerX + base);
+            __m256 centerY = _mm256_loadu_ps(spheres.centerY + base);
+            __m256 centerZ = _mm256_loadu_ps(spheres.centerZ + base);
+
+            if (spheres.motionX != nullptr) {
+                centerX = _mm256_fmadd_ps(time, _mm256_loadu_ps(spheres.motionX + base), centerX);
+                centerY = _mm256_fmadd_ps(time, _mm256_loadu_ps(spheres.motionY + base), centerY);
+                centerZ = _mm256_fmadd_ps(time, _mm256_loadu_ps(spheres.motionZ + base), centerZ);
+            }
+
+            const __m256 ocX = _mm256_sub_ps(originX, centerX);
+            const __m256 ocY = _mm256_sub_ps(originY, centerY);
+            const __m256 ocZ = _mm256_sub_ps(originZ, centerZ);
+
+            const __m256 bHalf = _mm256_fmadd_ps(dirX, ocX, _mm256_fmadd_ps(dirY, ocY, _mm256_mul_ps(dirZ, ocZ)));
+            const __m256 c = _mm256_sub_ps(
+                _mm256_fmadd_ps(ocX, ocX, _mm256_fmadd_ps(ocY, ocY, _mm256_mul_ps(ocZ, ocZ))),
+                _mm256_loadu_ps(spheres.radiusSq + base));
+            const __m256 discriminant = _mm256_fmsub_ps(bHalf, bHalf, _mm256_mul_ps(a, c));
+
+            const __m256 valid = _mm256_and_ps(laneMask, _mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GE_OQ));
+
+            if (_mm256_movemask_ps(valid) == 0) {
+                continue;
+            }
+
+            const __m256 sqrtTerm = _mm256_sqrt_ps(_mm256_max_ps(discriminant, _mm256_setzero_ps()));
+            const __m256 nearRoot = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), bHalf), sqrtTerm), invA);
+            const __m256 farRoot = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_setzero_ps(), bHalf), sqrtTerm), invA);
+            const __m256 nearInside = _mm256_and_ps(
+                _mm256_cmp_ps(nearRoot, tMinV, _CMP_GT_OQ), _mm256_cmp_ps(nearRoot, tMaxV, _CMP_LT_OQ));
+            const __m256 farInside = _mm256_and_ps(
+                _mm256_cmp_ps(farRoot, tMinV, _CMP_GT_OQ), _mm256_cmp_ps(farRoot, tMaxV, _CMP_LT_OQ));
+
+            if (_mm256_movemask_ps(_mm256_and_ps(valid, _mm256_or_ps(nearInside, farInside))) != 0) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+#endif
+}
+
+void SphereSoA::add(const Vec3& center, float radius, MaterialId materialId) {
+    resizeArrays(m_Count + 1);
+
+    m_CenterX[m_Count] = center.x;
+    m_CenterY[m_Count] = center.y;
+    m_CenterZ[m_Count] = center.z;
+    m_RadiusSq[m_Count] = radius * radius;
+    m_InvRadius[m_Count] = 1.0f / radius;
+    m_MaterialIds[m_Count] = materialId;
+    m_Ids.push_back(m_Count);
+    m_Slots.push_back(m_Count);
+    m_Count++;
+}
+
+void SphereSoA::add(const Vec3& startCenter, const Vec3& endCenter, float radius, MaterialId materialId) {
+    enableMotion();
+
+    const uint32_t slot = m_Count;
+    add(startCenter, radius, materialId);
+
+    m_MotionX[slot] = endCenter.x - startCenter.x;
+    m_MotionY[slot] = endCenter.y - startCenter.y;
+    m_MotionZ[slot] = endCenter.z - startCenter.z;
+}
+
+void SphereSoA::setCenter(uint32_t id, const Vec3& center) {
+    const uint32_t slot = m_Slots[id];
+
+    m_CenterX[slot] = center.x;
+    m_CenterY[slot] = center.y;
+    m_CenterZ[slot] = center.z;
+}
+
+void SphereSoA::setCenter(uint32_t id, const Vec3& startCenter, const Vec3& endCenter) {
+    enableMotion();
+    setCenter(id, startCenter);
+
+    const uint32_t slot = m_Slots[id];
+
+    m_MotionX[slot] = endCenter.x - startCenter.x;
+    m_MotionY[slot] = endCenter.y - startCenter.y;
+    m_MotionZ[slot] = endCenter.z - startCenter.z;
+}
+
+void SphereSoA::enableMotion() {
+    if (m_HasMotion) {
+        return;
+    }
+
+    m_HasMotion = true;
+    m_MotionX.assign(m_CenterX.size(), 0.0f);
+    m_MotionY.assign(m_CenterY.size(), 0.0f);
+    m_MotionZ.assign(m_CenterZ.size(), 0.0f);
+}
+
+void SphereSoA::reserve(size_t count) {
+    const size_t paddedCount = count + SimdWidth - 1;
+
+    m_CenterX.reserve(paddedCount);
+    m_CenterY.reserve(paddedCount);
+    m_CenterZ.reserve(paddedCount);
+    m_RadiusSq.reserve(paddedCount);
+    m_InvRadius.reserve(paddedCount);
+    m_MaterialIds.reserve(paddedCount);
+    m_Ids.reserve(count);
+    m_Slots.reserve(count);
+}
+
+void SphereSoA::resizeArrays(size_t count) {
+    const size_t paddedCount = count + SimdWidth - 1;
+
+    m_CenterX.resize(paddedCount, 0.0f);
+    m_CenterY.resize(paddedCount, 0.0f);
+    m_CenterZ.resize(paddedCount, 0.0f);
+    m_RadiusSq.resize(paddedCount, 0.0f);
+    m_InvRadius.resize(paddedCount, 0.0f);
+    m_MaterialIds.resize(paddedCount, 0);
+
+    if (m_HasMotion) {
+        m_MotionX.resize(paddedCount, 0.0f);
+        m_MotionY.resize(paddedCount, 0.0f);
+        m_MotionZ.resize(paddedCount, 0.0f);
+    }
+}
+
+std::vector<AABB> SphereSoA::computeSlotBounds(ThreadPool* const threadPool, float time) const {
+    std::vector<AABB> sphereBounds(m_Count);
+
+    parallelFor(threadPool, m_Count, [&](int, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            Vec3 center = { m_CenterX[i], m_CenterY[i], m_CenterZ[i] };
+
+            if (m_HasMotion) {
+                center += time * Vec3{ m_MotionX[i], m_MotionY[i], m_MotionZ[i] };
+            }
+
+            const float radius = 1.0f / m_InvRadius[i];
+            const Vec3 r = { radius, radius, radius };
+
+            sphereBounds[i] = { center - r, center + r };
+        }
+    });
+
+    return sphereBounds;
+}
+
+void SphereSoA::build(const BVHSettings& settings) {
+    if (m_HasMotion) {
+        m_Accel.build(computeSlotBounds(settings.threadPool, 0.0f), computeSlotBounds(settings.threadPool, 1.0f), settings);
+    }
+    else {
+        m_Accel.build(computeSlotBounds(settings.threadPool), settings);
+    }
+
+    m_UseAVX2 = SRAY_X64 && getCPUFeatures().avx2;
+
+    // Note: Reorder all arrays to match the leaf order of the BVH. The
+    // padding entries past m_Count stay zero
+    const std::vector<uint32_t>& primIndices = m_Accel.getPrimIndices();
+
+    const auto reorder = [&](auto& values) {
+        std::remove_reference_t<decltype(values)> ordered(values.size());
+
+        parallelFor(settings.threadPool, m_Count, [&](int, uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; ++i) {
+                ordered[i] = values[primIndices[i]];
+            }
+        });
+
+        values = std::move(ordered);
+    };
+
+    reorder(m_CenterX);
+    reorder(m_CenterY);
+    reorder(m_CenterZ);
+    reorder(m_RadiusSq);
+    reorder(m_InvRadius);
+    reorder(m_MaterialIds);
+    reorder(m_Ids);
+
+    if (m_HasMotion) {
+        reorder(m_MotionX);
+        reorder(m_MotionY);
+        reorder(m_MotionZ);
+    }
+
+    parallelFor(settings.threadPool, m_Count, [&](int, uint32_t begin, uint32_t end) {
+        for (uint32_t slot = begin; slot < end; ++slot) {
+            m_Slots[m_Ids[slot]] = slot;
+        }
+    });
+}
+
+bool SphereSoA::update(const BVHSettings& settings) {
+    if (!m_HasMotion && !m_Accel.refit(computeSlotBounds(settings.threadPool), settings)) {
+        return false;
+    }
+
+    build(settings);
+
+    return true;
+}
+
+bool SphereSoA::intersectRange(
+    const Ray& ray,
+    uint32_t first,
+    uint32_t count,
+    float tMin,
+    float tMax,
+    uint32_t* const slot,
+    float* const t) const {
+
+    const SphereArrays spheres = {
+        m_CenterX.data(), m_CenterY.data(), m_CenterZ.data(), m_RadiusSq.data(),
+        m_HasMotion ? m_MotionX.data() : nullptr, m_MotionY.data(), m_MotionZ.data()
+    };
+
+#if SRAY_X64
+    if (m_UseAVX2) {
+        return intersectAVX2(spheres, ray, first, count, tMin, tMax, slot, t);
+    }
+#endif
+
+    return intersectScalar(spheres, ray, first, count, tMin, tMax, slot, t);
+}
+
+bool SphereSoA::intersect(const Ray& ray, float tMin, float tMax, HitRecord* const record) const {
+    const SphereArrays spheres = {
+        m_CenterX.data(), m_CenterY.data(), m_CenterZ.data(), m_RadiusSq.data(),
+        m_HasMotion ? m_MotionX.data() : nullptr, m_MotionY.data(), m_MotionZ.data()
+    };
+    uint32_t closestSlot = 0;
+    float closestHitT = tMax;
+
+    const bool anyHit = m_Accel.intersect(ray, tMin, tMax, [&](uint32_t first, uint32_t count, float& closestT) {
+        SRAY_COUNT(intersectionTests, count);
+
+        bool leafHit = false;
+
+#if SRAY_X64
+        if (m_UseAVX2) {
+            leafHit = intersectAVX2(spheres, ray, first, count, tMin, closestT, &closestSlot, &closestT);
+        }
+        else
+#endif
+        {
+            leafHit = intersectScalar(spheres, ray, first, count, tMin, closestT, &closestSlot, &closestT);
+        }
+
+        if (leafHit) {
+            closestHitT = closestT;
+            record->candidateCount++;
+        }
+
+        return leafHit;
+    });
+
+    if (!anyHit) {
+        return false;
+    }
+
+    record->t = closestHitT;
+    record->primId = closestSlot;
+
+    return true;
+}
+
+bool SphereSoA::occluded(const Ray& ray, float tMin, float tMax) const {
+    const SphereArrays spheres = {
+        m_CenterX.data(), m_CenterY.data(), m_CenterZ.data(), m_RadiusSq.data(),
+        m_HasMotion ? m_MotionX.data() : nullptr, m_MotionY.data(), m_MotionZ.data()
+    };
+
+    return m_Accel.occluded(ray, tMin, tMax, [&](uint32_t first, uint32_t count) {
+        SRAY_COUNT(intersectionTests, count);
+
+#if SRAY_X64
+        if (m_UseAVX2) {
+            return occludedAVX2(spheres, ray, first, count, tMin, tMax);
+        }
+#endif
+
+        return occludedScalar(spheres, ray, first, count, tMin, tMax);
+    });
+}
+
+void SphereSoA::computeHitData(const Ray& ray, const HitRecord& record, HitData* const hitData) const {
+    const uint32_t slot = record.primId;
+    Vec3 center = { m_CenterX[slot], m_CenterY[slot], m_CenterZ[slot] };
+
+    if (m_HasMotion) {
+        center += ray.time * Vec3{ m_MotionX[slot], m_MotionY[slot], m_MotionZ[slot] };
+    }
+
+    hitData->t = record.t;
+    hitData->position = ray.at(record.t);
+    hitData->setNormal(ray, (hitData->position - center) * m_InvRadius[slot]);
+    hitData->materialId = m_MaterialIds[slot];
+}
+
+// Note: Slots are only final after build(), which reorders the spheres.
+// Moving spheres are left to BSDF sampling, see Sphere::collectLights()
+void SphereSoA::collectLights(const MaterialTable& materials, uint32_t objectIndex, std::vector<Light>* const lights) const {
+    for (uint32_t slot = 0; slot < m_Count; ++slot) {
+        const Vec3 emission = materials[m_MaterialIds[slot]].getEmission();
+
+        const bool moving = m_HasMotion && (m_MotionX[slot] != 0.0f || m_MotionY[slot] != 0.0f || m_MotionZ[slot] != 0.0f);
+
+        if (luminance(emission) > 0.0f && !moving) {
+            const Vec3 center = { m_CenterX[slot], m_CenterY[slot], m_CenterZ[slot] };
+            lights->push_back({ center, sqrtf(m_RadiusSq[slot]), emission, objectIndex, slot });
+        }
+    }
+}
+
+AABB SphereSoA::boundingBox() const {
+    return m_Accel.getBounds();
+}
+
+AABB SphereSoA::boundingBoxAt(float time) const {
+    return m_Accel.getBoundsAt(time);
+}
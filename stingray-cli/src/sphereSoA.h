@@ -0,0 +1,84 @@
+#pragma once
+
+#include "hittable.h"
+
+#include <vector>
+
+// Note: Structure-of-arrays storage for large numbers of spheres, such as
+// point clouds, with its own BVH over the spheres. Leaves are intersected
+// 8 spheres at a time with AVX2 when available, and only the closest sphere
+// of the whole traversal has its hit attributes computed
+class SphereSoA final : public Hittable {
+public:
+    SphereSoA() = default;
+    ~SphereSoA() = default;
+
+    void add(const Vec3& center, float radius, MaterialId materialId);
+
+    // Note: Adds a sphere moving linearly from startCenter to endCenter
+    // during the shutter interval. A single moving sphere makes the whole
+    // container use a motion BVH
+    void add(const Vec3& startCenter, const Vec3& endCenter, float radius, MaterialId materialId);
+    void reserve(size_t count);
+
+    // Note: Moves the sphere that was added as the id-th one, keeping its
+    // motion. Only takes effect in traversal after update() or build()
+    void setCenter(uint32_t id, const Vec3& center);
+    void setCenter(uint32_t id, const Vec3& startCenter, const Vec3& endCenter);
+    inline size_t size() const { return m_Count; }
+    inline const AccelerationStructure& getAccelerationStructure() const { return m_Accel; }
+
+    void build(const BVHSettings& settings) override;
+    bool update(const BVHSettings& settings) override;
+    bool intersect(const Ray& ray, float tMin, float tMax, HitRecord* const record) const override;
+    void computeHitData(const Ray& ray, const HitRecord& record, HitData* const hitData) const override;
+    inline uint32_t getPrimitiveId(const HitRecord& record) const override { return m_Ids[record.primId]; }
+    bool occluded(const Ray& ray, float tMin, float tMax) const override;
+    AABB boundingBox() const override;
+    AABB boundingBoxAt(float time) const override;
+    inline bool isMoving() const override { return m_HasMotion; }
+    void collectLights(const MaterialTable& materials, uint32_t objectIndex, std::vector<Light>* const lights) const override;
+
+    // Note: Finds the closest sphere in the slots [first, first + count)
+    // that is hit within (tMin, tMax), returning its slot and distance
+    bool intersectRange(
+        const Ray& ray,
+        uint32_t first,
+        uint32_t count,
+        float tMin,
+        float tMax,
+        uint32_t* const slot,
+        float* const t
+    ) const;
+
+private:
+    // Note: Every array holds SimdWidth - 1 trailing padding entries, so that
+    // kernels can always load full registers starting at any slot
+    static constexpr uint32_t SimdWidth = 8;
+
+    void resizeArrays(size_t count);
+    void enableMotion();
+    std::vector<AABB> computeSlotBounds(ThreadPool* const threadPool, float time = 0.0f) const;
+
+    std::vector<float> m_CenterX;
+    std::vector<float> m_CenterY;
+    std::vector<float> m_CenterZ;
+    std::vector<float> m_RadiusSq;
+    std::vector<float> m_InvRadius;
+    std::vector<MaterialId> m_MaterialIds;
+    uint32_t m_Count = 0;
+
+    // Note: Offset from the start to the end center, only allocated once a
+    // moving sphere was added
+    std::vector<float> m_MotionX;
+    std::vector<float> m_MotionY;
+    std::vector<float> m_MotionZ;
+    bool m_HasMotion = false;
+
+    // Cold data
+    std::vector<uint32_t> m_Ids; // Note: Id of the sphere in every slot
+    std::vector<uint32_t> m_Slots; // Note: Slot of every sphere id
+
+    AccelerationStructure m_Accel;
+    bool m_UseAVX2 = false;
+};
@@ -0,0 +1,94 @@
+#include "tileScheduler.h"
+
+#include <algorithm>
+
+namespace {
+    uint32_t spreadBits(uint32_t x) {
+        x &= 0x0000ffff;
+        x = (x | (x << 8)) & 0x00ff00ff;
+        x = (x | (x << 4)) & 0x0f0f0f0f;
+        x = (x | (x << 2)) & 0x33333333;
+        x = (x | (x << 1)) & 0x55555555;
+
+        return x;
+    }
+
+    uint32_t mortonCode2D(uint32_t x, uint32_t y) {
+        return spreadBits(x) | (spreadBits(y) << 1);
+    }
+}
+
+void TileScheduler::reset(int imageWidth, int imageHeight, int tileSize, int numWorkers) {
+    const int tilesX = (imageWidth + tileSize - 1) / tileSize;
+    const int tilesY = (imageHeight + tileSize - 1) / tileSize;
+
+    std::vector<std::pair<uint32_t, Tile>> orderedTiles{};
+    orderedTiles.reserve((size_t)tilesX * tilesY);
+
+    for (int ty = 0; ty < tilesY; ++ty) {
+        for (int tx = 0; tx < tilesX; ++tx) {
+            const Tile tile = {
+                tx * tileSize,
+                ty * tileSize,
+                std::min((tx + 1) * tileSize, imageWidth),
+                std::min((ty + 1) * tileSize, imageHeight)
+            };
+
+            orderedTiles.push_back({ mortonCode2D(tx, ty), tile });
+        }
+    }
+
+    std::sort(orderedTiles.begin(), orderedTiles.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+    });
+
+    m_Tiles.resize(orderedTiles.size());
+
+    for (size_t i = 0; i < orderedTiles.size(); ++i) {
+        m_Tiles[i] = orderedTiles[i].second;
+    }
+
+    m_NumWorkers = std::max(numWorkers, 1);
+    m_Queues = std::make_unique<WorkerQueue[]>(m_NumWorkers);
+
+    const size_t tileCount = m_Tiles.size();
+
+    for (int w = 0; w < m_NumWorkers; ++w) {
+        const size_t first = tileCount * w / m_NumWorkers;
+        const size_t last = tileCount * (w + 1) / m_NumWorkers;
+
+        for (size_t i = first; i < last; ++i) {
+            m_Queues[w].tiles.push_back((uint32_t)i);
+        }
+    }
+}
+
+bool TileScheduler::next(int workerIndex, Tile* const tile) {
+    {
+        WorkerQueue& queue = m_Queues[workerIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if (!queue.tiles.empty()) {
+            *tile = m_Tiles[queue.tiles.front()];
+            queue.tiles.pop_front();
+
+            return true;
+        }
+    }
+
+    // Note: Steal from the far end of the victim's run, which is the work
+    // the victim itself would reach last
+    for (int i = 1; i < m_NumWorkers; ++i) {
+        WorkerQueue& victim = m_Queues[(workerIndex + i) % m_NumWorkers];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        if (!victim.tiles.empty()) {
+            *tile = m_Tiles[victim.tiles.back()];
+            victim.tiles.pop_back();
+
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct Tile {
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = 0; // Note: Exclusive
+    int y1 = 0; // Note: Exclusive
+};
+
+// Note: Splits the image into square tiles enumerated in Morton order, so
+// that consecutive tiles stay close on screen and in the BVH. Every worker
+// owns a contiguous run of that order and steals from the back of the other
+// workers' queues once its own queue runs dry
+class TileScheduler {
+public:
+    TileScheduler() = default;
+    ~TileScheduler() = default;
+
+    void reset(int imageWidth, int imageHeight, int tileSize, int numWorkers);
+    bool next(int workerIndex, Tile* const tile);
+
+private:
+    struct alignas(64) WorkerQueue {
+        std::mutex mutex;
+        std::deque<uint32_t> tiles;
+    };
+
+    std::vector<Tile> m_Tiles;
+    std::unique_ptr<WorkerQueue[]> m_Queues;
+    int m_NumWorkers = 0;
+};
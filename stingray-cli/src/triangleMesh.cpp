@@ -0,0 +1,518 @@
+#include "triangleMesh.h"
+
+#include <algorithm>
+#include <bit>
+
+#if SRAY_X64
+    #include <immintrin.h>
+#endif
+
+namespace {
+    // Note: Ray in the form of the watertight ray-triangle test (Woop, Benthin
+    // and Wald 2013). The axes are permuted so that z is the dominant axis
+    // of the ray direction, and a shear then turns the ray into the +z axis,
+    // which reduces the test to 2D edge functions. The vertex array pointers
+    // are permuted the same way, so that the kernels need no per-axis branches
+    struct TriangleRay {
+        float originX;
+        float originY;
+        float originZ;
+        float shearX;
+        float shearY;
+        float shearZ;
+        const float* vertices[3][3];
+    };
+
+    TriangleRay makeTriangleRay(const Ray& ray, const std::vector<float> (&vertexArrays)[9]) {
+        const Vec3 absDir = { fabsf(ray.dir.x), fabsf(ray.dir.y), fabsf(ray.dir.z) };
+        const int kz = (absDir.x > absDir.y) ? (absDir.x > absDir.z ? 0 : 2) : (absDir.y > absDir.z ? 1 : 2);
+        int kx = (kz + 1) % 3;
+        int ky = (kx + 1) % 3;
+
+        // Note: Swapping keeps the winding of the triangles
+        if (ray.dir[kz] < 0.0f) {
+            std::swap(kx, ky);
+        }
+
+        TriangleRay triangleRay{};
+        triangleRay.originX = ray.origin[kx];
+        triangleRay.originY = ray.origin[ky];
+        triangleRay.originZ = ray.origin[kz];
+        triangleRay.shearX = ray.dir[kx] / ray.dir[kz];
+        triangleRay.shearY = ray.dir[ky] / ray.dir[kz];
+        triangleRay.shearZ = 1.0f / ray.dir[kz];
+
+        for (int vertex = 0; vertex < 3; ++vertex) {
+            triangleRay.vertices[vertex][0] = vertexArrays[vertex * 3 + kx].data();
+            triangleRay.vertices[vertex][1] = vertexArrays[vertex * 3 + ky].data();
+            triangleRay.vertices[vertex][2] = vertexArrays[vertex * 3 + kz].data();
+        }
+
+        return triangleRay;
+    }
+
+    // Note: Returns the barycentric coordinates of the second and third vertex
+    inline bool intersectTriangle(
+        const TriangleRay& ray,
+        uint32_t slot,
+        float tMin,
+        float tMax,
+        float* const t,
+        float* const u,
+        float* const v) {
+
+        const float az = ray.vertices[0][2][slot] - ray.originZ;
+        const float bz = ray.vertices[1][2][slot] - ray.originZ;
+        const float cz = ray.vertices[2][2][slot] - ray.originZ;
+
+        const float ax = ray.vertices[0][0][slot] - ray.originX - ray.shearX * az;
+        const float ay = ray.vertices[0][1][slot] - ray.originY - ray.shearY * az;
+        const float bx = ray.vertices[1][0][slot] - ray.originX - ray.shearX * bz;
+        const float by = ray.vertices[1][1][slot] - ray.originY - ray.shearY * bz;
+        const float cx = ray.vertices[2][0][slot] - ray.originX - ray.shearX * cz;
+        const float cy = ray.vertices[2][1][slot] - ray.originY - ray.shearY * cz;
+
+        float edgeU = cx * by - cy * bx;
+        float edgeV = ax * cy - ay * cx;
+        float edgeW = bx * ay - by * ax;
+
+        // Note: An edge function of exactly zero means the ray passes through
+        // an edge or vertex, which is resolved in double precision so that
+        // neighboring triangles agree on who owns it
+        if (edgeU == 0.0f || edgeV == 0.0f || edgeW == 0.0f) {
+            edgeU = (float)((double)cx * by - (double)cy * bx);
+            edgeV = (float)((double)ax * cy - (double)ay * cx);
+            edgeW = (float)((double)bx * ay - (double)by * ax);
+        }
+
+        if ((edgeU < 0.0f || edgeV < 0.0f || edgeW < 0.0f) && (edgeU > 0.0f || edgeV > 0.0f || edgeW > 0.0f)) {
+            return false;
+        }
+
+        const float det = edgeU + edgeV + edgeW;
+
+        if (det == 0.0f) {
+            return false;
+        }
+
+        const float invDet = 1.0f / det;
+        const float hitT = (edgeU * az + edgeV * bz + edgeW * cz) * ray.shearZ * invDet;
+
+        if (hitT <= tMin || tMax <= hitT) {
+            return false;
+        }
+
+        *t = hitT;
+        *u = edgeV * invDet;
+        *v = edgeW * invDet;
+
+        return true;
+    }
+
+    bool intersectScalar(
+        const TriangleRay& ray,
+        uint32_t first,
+        uint32_t count,
+        float tMin,
+        float tMax,
+        uint32_t* const slot,
+        float* const t,
+        float* const u,
+        float* const v) {
+
+        bool anyHit = false;
+
+        for (uint32_t i = first; i < first + count; ++i) {
+            if (intersectTriangle(ray, i, tMin, tMax, &tMax, u, v)) {
+                *slot = i;
+                anyHit = true;
+            }
+        }
+
+        *t = tMax;
+
+        return anyHit;
+    }
+
+    bool occludedScalar(const TriangleRay& ray, uint32_t first, uint32_t count, float tMin, float tMax) {
+        float t = 0.0f;
+        float u = 0.0f;
+        float v = 0.0f;
+
+        for (uint32_t i = first; i < first + count; ++i) {
+            if (intersectTriangle(ray, i, tMin, tMax, &t, &u, &v)) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+#if SRAY_X64
+    struct TriangleLanes {
+        __m256 edgeU;
+        __m256 edgeV;
+        __m256 edgeW;
+        __m256 det;
+        __m256 invDet;
+        __m256 t;
+        __m256 hitMask; // Note: Lanes with a hit within the interval
+        __m256 edgeMask; // Note: Lanes with a zero edge function, left to the scalar test
+    };
+
+    // Note: Eight triangles of the watertight test at once, see intersectTriangle()
+    SRAY_TARGET_AVX2 inline TriangleLanes intersectTriangleLanes(
+        const TriangleRay& ray,
+        uint32_t base,
+        __m256 laneMask,
+        __m256 tMin,
+        __m256 tMax) {
+
+        const __m256 originX = _mm256_set1_ps(ray.originX);
+        const __m256 originY = _mm256_set1_ps(ray.originY);
+        const __m256 originZ = _mm256_set1_ps(ray.originZ);
+        const __m256 shearX = _mm256_set1_ps(ray.shearX);
+        const __m256 shearY = _mm256_set1_ps(ray.shearY);
+        const __m256 zero = _mm256_setzero_ps();
+
+        const __m256 az = _mm256_sub_ps(_mm256_loadu_ps(ray.vertices[0][2] + base), originZ);
+        const __m256 bz = _mm256_sub_ps(_mm256_loadu_ps(ray.vertices[1][2] + base), originZ);
+        const __m256 cz = _mm256_sub_ps(_mm256_loadu_ps(ray.vertices[2][2] + base), originZ);
+
+        // Note: Plain multiplies and subtractions in the same order as the
+        // scalar test rather than FMA. A fused edge function of the shared
+        // edge is no longer the exact negation of the one of the neighboring
+        // triangle, so both could reject a ray through that edge, and would
+        // rarely be exactly zero to take the double precision fallback
+        const __m256 ax = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(ray.vertices[0][0] + base), originX), _mm256_mul_ps(shearX, az));
+        const __m256 ay = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(ray.vertices[0][1] + base), originY), _mm256_mul_ps(shearY, az));
+        const __m256 bx = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(ray.vertices[1][0] + base), originX), _mm256_mul_ps(shearX, bz));
+        const __m256 by = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(ray.vertices[1][1] + base), originY), _mm256_mul_ps(shearY, bz));
+        const __m256 cx = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(ray.vertices[2][0] + base), originX), _mm256_mul_ps(shearX, cz));
+        const __m256 cy = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(ray.vertices[2][1] + base), originY), _mm256_mul_ps(shearY, cz));
+
+        TriangleLanes lanes{};
+        lanes.edgeU = _mm256_sub_ps(_mm256_mul_ps(cx, by), _mm256_mul_ps(cy, bx));
+        lanes.edgeV = _mm256_sub_ps(_mm256_mul_ps(ax, cy), _mm256_mul_ps(ay, cx));
+        lanes.edgeW = _mm256_sub_ps(_mm256_mul_ps(bx, ay), _mm256_mul_ps(by, ax));
+
+        lanes.edgeMask = _mm256_and_ps(laneMask, _mm256_or_ps(
+            _mm256_cmp_ps(lanes.edgeU, zero, _CMP_EQ_OQ),
+            _mm256_or_ps(_mm256_cmp_ps(lanes.edgeV, zero, _CMP_EQ_OQ), _mm256_cmp_ps(lanes.edgeW, zero, _CMP_EQ_OQ))));
+
+        const __m256 anyNegative = _mm256_or_ps(
+            _mm256_cmp_ps(lanes.edgeU, zero, _CMP_LT_OQ),
+            _mm256_or_ps(_mm256_cmp_ps(lanes.edgeV, zero, _CMP_LT_OQ), _mm256_cmp_ps(lanes.edgeW, zero, _CMP_LT_OQ)));
+        const __m256 anyPositive = _mm256_or_ps(
+            _mm256_cmp_ps(lanes.edgeU, zero, _CMP_GT_OQ),
+            _mm256_or_ps(_mm256_cmp_ps(lanes.edgeV, zero, _CMP_GT_OQ), _mm256_cmp_ps(lanes.edgeW, zero, _CMP_GT_OQ)));
+
+        lanes.det = _mm256_add_ps(_mm256_add_ps(lanes.edgeU, lanes.edgeV), lanes.edgeW);
+        lanes.invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), lanes.det);
+
+        const __m256 scaledT = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(lanes.edgeU, az), _mm256_mul_ps(lanes.edgeV, bz)), _mm256_mul_ps(lanes.edgeW, cz));
+        lanes.t = _mm256_mul_ps(_mm256_mul_ps(scaledT, _mm256_set1_ps(ray.shearZ)), lanes.invDet);
+
+        __m256 valid = _mm256_andnot_ps(_mm256_and_ps(anyNegative, anyPositive), laneMask);
+        valid = _mm256_andnot_ps(lanes.edgeMask, valid);
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(lanes.det, zero, _CMP_NEQ_OQ));
+        valid = _mm256_and_ps(valid, _mm256_and_ps(
+            _mm256_cmp_ps(lanes.t, tMin, _CMP_GT_OQ), _mm256_cmp_ps(lanes.t, tMax, _CMP_LT_OQ)));
+
+        lanes.hitMask = valid;
+
+        return lanes;
+    }
+
+    SRAY_TARGET_AVX2 inline __m256 makeLaneMask(uint32_t base, uint32_t end) {
+        const __m256 laneIndices = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+        return _mm256_cmp_ps(laneIndices, _mm256_set1_ps((float)(end - base)), _CMP_LT_OQ);
+    }
+
+    SRAY_TARGET_AVX2 inline bool intersectAVX2(
+        const TriangleRay& ray,
+        uint32_t first,
+        uint32_t count,
+        float tMin,
+        float tMax,
+        uint32_t* const slot,
+        float* const t,
+        float* const u,
+        float* const v) {
+
+        const __m256 tMinV = _mm256_set1_ps(tMin);
+        bool anyHit = false;
+
+        for (uint32_t base = first; base < first + count; base += 8) {
+            const TriangleLanes lanes = intersectTriangleLanes(
+                ray, base, makeLaneMask(base, first + count), tMinV, _mm256_set1_ps(tMax));
+
+            const int hitMask = _mm256_movemask_ps(lanes.hitMask);
+
+            if (hitMask != 0) {
+                // Horizontal minimum over the lanes that were hit
+                const __m256 roots = _mm256_blendv_ps(_mm256_set1_ps(Infinity), lanes.t, lanes.hitMask);
+                __m256 minRoot = _mm256_min_ps(roots, _mm256_permute2f128_ps(roots, roots, 1));
+                minRoot = _mm256_min_ps(minRoot, _mm256_shuffle_ps(minRoot, minRoot, _MM_SHUFFLE(1, 0, 3, 2)));
+                minRoot = _mm256_min_ps(minRoot, _mm256_shuffle_ps(minRoot, minRoot, _MM_SHUFFLE(2, 3, 0, 1)));
+
+                const int minMask = _mm256_movemask_ps(_mm256_cmp_ps(roots, minRoot, _CMP_EQ_OQ)) & hitMask;
+                const int lane = std::countr_zero((uint32_t)minMask);
+
+                alignas(32) float edgeV[8];
+                alignas(32) float edgeW[8];
+                alignas(32) float invDet[8];
+                _mm256_store_ps(edgeV, lanes.edgeV);
+                _mm256_store_ps(edgeW, lanes.edgeW);
+                _mm256_store_ps(invDet, lanes.invDet);
+
+                tMax = _mm256_cvtss_f32(minRoot);
+                *slot = base + (uint32_t)lane;
+                *u = edgeV[lane] * invDet[lane];
+                *v = edgeW[lane] * invDet[lane];
+                anyHit = true;
+            }
+
+            uint32_t edgeMask = (uint32_t)_mm256_movemask_ps(lanes.edgeMask);
+
+            while (edgeMask != 0) {
+                const uint32_t lane = (uint32_t)std::countr_zero(edgeMask);
+                edgeMask &= edgeMask - 1;
+
+                if (intersectTriangle(ray, base + lane, tMin, tMax, &tMax, u, v)) {
+                    *slot = base + lane;
+                    anyHit = true;
+                }
+            }
+        }
+
+        *t = tMax;
+
+        return anyHit;
+    }
+
+    SRAY_TARGET_AVX2 inline bool occludedAVX2(
+        const TriangleRay& ray,
+        uint32_t first,
+        uint32_t count,
+        float tMin,
+        float tMax) {
+
+        const __m256 tMinV = _mm256_set1_ps(tMin);
+        const __m256 tMaxV = _mm256_set1_ps(tMax);
+
+        for (uint32_t base = first; base < first + count; base += 8) {
+            const TriangleLanes lanes = intersectTriangleLanes(ray, base, makeLaneMask(base, first + count), tMinV, tMaxV);
+
+            if (_mm256_movemask_ps(lanes.hitMask) != 0) {
+                return true;
+            }
+
+            uint32_t edgeMask = (uint32_t)_mm256_movemask_ps(lanes.edgeMask);
+
+            while (edgeMask != 0) {
+                const uint32_t lane = (uint32_t)std::countr_zero(edgeMask);
+                edgeMask &= edgeMask - 1;
+
+                if (occludedScalar(ray, base + lane, 1, tMin, tMax)) {
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+#endif
+}
+
+uint32_t TriangleMesh::addVertex(const Vec3& position, const Vec3& normal) {
+    m_Positions.push_back(position);
+    m_Normals.push_back(normal);
+
+    return (uint32_t)(m_Positions.size() - 1);
+}
+
+void TriangleMesh::addTriangle(uint32_t i0, uint32_t i1, uint32_t i2, MaterialId materialId) {
+    m_Indices.push_back(i0);
+    m_Indices.push_back(i1);
+    m_Indices.push_back(i2);
+    m_TriangleIds.push_back((uint32_t)m_MaterialIds.size());
+    m_MaterialIds.push_back(materialId);
+}
+
+void TriangleMesh::reserve(size_t vertexCount, size_t triangleCount) {
+    m_Positions.reserve(vertexCount);
+    m_Normals.reserve(vertexCount);
+    m_Indices.reserve(triangleCount * 3);
+    m_MaterialIds.reserve(triangleCount);
+    m_TriangleIds.reserve(triangleCount);
+}
+
+AABB TriangleMesh::computeVertexBounds() const {
+    AABB bounds{};
+
+    for (const Vec3& position : m_Positions) {
+        bounds.grow(position);
+    }
+
+    return bounds;
+}
+
+void TriangleMesh::build(const BVHSettings& settings) {
+    const uint32_t triangleCount = (uint32_t)getTriangleCount();
+    std::vector<AABB> triangleBounds(triangleCount);
+
+    for (uint32_t i = 0; i < triangleCount; ++i) {
+        AABB bounds{};
+        bounds.grow(m_Positions[m_Indices[i * 3 + 0]]);
+        bounds.grow(m_Positions[m_Indices[i * 3 + 1]]);
+        bounds.grow(m_Positions[m_Indices[i * 3 + 2]]);
+
+        triangleBounds[i] = bounds;
+    }
+
+    m_Accel.build(triangleBounds, settings);
+    m_UseAVX2 = SRAY_X64 && getCPUFeatures().avx2;
+
+    // Note: Reorder the triangles to match the leaf order of the BVH, the
+    // vertices stay where they are
+    const std::vector<uint32_t>& primIndices = m_Accel.getPrimIndices();
+    std::vector<uint32_t> orderedIndices(m_Indices.size());
+    std::vector<MaterialId> orderedMaterialIds(triangleCount);
+    std::vector<uint32_t> orderedTriangleIds(triangleCount);
+
+    for (uint32_t i = 0; i < triangleCount; ++i) {
+        const uint32_t triangle = primIndices[i];
+
+        orderedIndices[i * 3 + 0] = m_Indices[triangle * 3 + 0];
+        orderedIndices[i * 3 + 1] = m_Indices[triangle * 3 + 1];
+        orderedIndices[i * 3 + 2] = m_Indices[triangle * 3 + 2];
+        orderedMaterialIds[i] = m_MaterialIds[triangle];
+        orderedTriangleIds[i] = m_TriangleIds[triangle];
+    }
+
+    m_Indices = std::move(orderedIndices);
+    m_MaterialIds = std::move(orderedMaterialIds);
+    m_TriangleIds = std::move(orderedTriangleIds);
+
+    for (int vertex = 0; vertex < 3; ++vertex) {
+        for (int axis = 0; axis < 3; ++axis) {
+            std::vector<float>& values = m_Vertices[vertex * 3 + axis];
+            values.assign(triangleCount + SimdWidth - 1, 0.0f);
+
+            for (uint32_t i = 0; i < triangleCount; ++i) {
+                values[i] = m_Positions[m_Indices[i * 3 + vertex]][axis];
+            }
+        }
+    }
+}
+
+bool TriangleMesh::intersect(const Ray& ray, float tMin, float tMax, HitRecord* const record) const {
+    const TriangleRay triangleRay = makeTriangleRay(ray, m_Vertices);
+    uint32_t closestSlot = 0;
+    float closestHitT = tMax;
+    float closestU = 0.0f;
+    float closestV = 0.0f;
+
+    const bool anyHit = m_Accel.intersect(ray, tMin, tMax, [&](uint32_t first, uint32_t count, float& closestT) {
+        SRAY_COUNT(intersectionTests, count);
+
+        bool leafHit = false;
+
+#if SRAY_X64
+        if (m_UseAVX2) {
+            leafHit = intersectAVX2(triangleRay, first, count, tMin, closestT, &closestSlot, &closestT, &closestU, &closestV);
+        }
+        else
+#endif
+        {
+            leafHit = intersectScalar(triangleRay, first, count, tMin, closestT, &closestSlot, &closestT, &closestU, &closestV);
+        }
+
+        if (leafHit) {
+            closestHitT = closestT;
+            record->candidateCount++;
+        }
+
+        return leafHit;
+    });
+
+    if (!anyHit) {
+        return false;
+    }
+
+    record->t = closestHitT;
+    record->primId = closestSlot;
+    record->u = closestU;
+    record->v = closestV;
+
+    return true;
+}
+
+bool TriangleMesh::occluded(const Ray& ray, float tMin, float tMax) const {
+    const TriangleRay triangleRay = makeTriangleRay(ray, m_Vertices);
+
+    return m_Accel.occluded(ray, tMin, tMax, [&](uint32_t first, uint32_t count) {
+        SRAY_COUNT(intersectionTests, count);
+
+#if SRAY_X64
+        if (m_UseAVX2) {
+            return occludedAVX2(triangleRay, first, count, tMin, tMax);
+        }
+#endif
+
+        return occludedScalar(triangleRay, first, count, tMin, tMax);
+    });
+}
+
+void TriangleMesh::computeHitData(const Ray& ray, const HitRecord& record, HitData* const hitData) const {
+    const uint32_t slot = record.primId;
+    const uint32_t i0 = m_Indices[slot * 3 + 0];
+    const uint32_t i1 = m_Indices[slot * 3 + 1];
+    const uint32_t i2 = m_Indices[slot * 3 + 2];
+
+    const Vec3& p0 = m_Positions[i0];
+    const Vec3 geometricNormal = normalize(cross(m_Positions[i1] - p0, m_Positions[i2] - p0));
+
+    hitData->t = record.t;
+    hitData->position = ray.at(record.t);
+    hitData->setNormal(ray, geometricNormal);
+    hitData->materialId = m_MaterialIds[slot];
+
+    // Note: The interpolated vertex normal only replaces the geometric one
+    // for shading, the side that was hit is still decided by the geometry
+    const Vec3 shadingNormal = (1.0f - record.u - record.v) * m_Normals[i0] +
+        record.u * m_Normals[i1] + record.v * m_Normals[i2];
+    const float shadingLength = shadingNormal.length();
+
+    if (shadingLength > 1e-6f) {
+        const Vec3 unitShadingNormal = shadingNormal / shadingLength;
+        hitData->normal = (dot(unitShadingNormal, hitData->normal) < 0.0f) ? -unitShadingNormal : unitShadingNormal;
+    }
+}
+
+AABB TriangleMesh::boundingBox() const {
+    return m_Accel.getBounds();
+}
+
+// Note: Slots are only final after build(), which reorders the triangles
+void TriangleMesh::collectLights(const MaterialTable& materials, uint32_t objectIndex, std::vector<Light>* const lights) const {
+    for (uint32_t slot = 0; slot < (uint32_t)m_MaterialIds.size(); ++slot) {
+        const Vec3 emission = materials[m_MaterialIds[slot]].getEmission();
+
+        if (luminance(emission) > 0.0f) {
+            Light light{};
+            light.emission = emission;
+            light.objectIndex = objectIndex;
+            light.primId = slot;
+            light.shape = LightShape::TRIANGLE;
+
+            for (int vertex = 0; vertex < 3; ++vertex) {
+                light.vertices[vertex] = m_Positions[m_Indices[slot * 3 + vertex]];
+            }
+
+            lights->push_back(light);
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "hittable.h"
+
+#include <vector>
+
+// Note: Indexed triangle mesh with its own BVH over the triangles. Vertices
+// and indices are kept in flat arrays, so that a mesh of any size is a
+// single Hittable. For traversal the vertices of every triangle are also
+// copied into structure-of-arrays storage in BVH leaf order, from which the
+// leaves are intersected 8 triangles at a time with AVX2 when available
+class TriangleMesh final : public Hittable {
+public:
+    TriangleMesh() = default;
+    ~TriangleMesh() = default;
+
+    // Note: A zero normal makes the triangles using the vertex flat shaded
+    uint32_t addVertex(const Vec3& position, const Vec3& normal = {});
+    void addTriangle(uint32_t i0, uint32_t i1, uint32_t i2, MaterialId materialId);
+    void reserve(size_t vertexCount, size_t triangleCount);
+
+    inline size_t getVertexCount() const { return m_Positions.size(); }
+    inline size_t getTriangleCount() const { return m_MaterialIds.size(); }
+    inline const AccelerationStructure& getAccelerationStructure() const { return m_Accel; }
+
+    // Note: Bounds of the vertices, also valid before build()
+    AABB computeVertexBounds() const;
+
+    void build(const BVHSettings& settings) override;
+    bool intersect(const Ray& ray, float tMin, float tMax, HitRecord* const record) const override;
+    void computeHitData(const Ray& ray, const HitRecord& record, HitData* const hitData) const override;
+    inline uint32_t getPrimitiveId(const HitRecord& record) const override { return m_TriangleIds[record.primId]; }
+    bool occluded(const Ray& ray, float tMin, float tMax) const override;
+    AABB boundingBox() const override;
+    void collectLights(const MaterialTable& materials, uint32_t objectIndex, std::vector<Light>* const lights) const override;
+
+private:
+    // Note: Every triangle vertex array holds SimdWidth - 1 trailing padding
+    // entries, see SphereSoA
+    static constexpr uint32_t SimdWidth = 8;
+
+    std::vector<Vec3> m_Positions;
+    std::vector<Vec3> m_Normals;
+    std::vector<uint32_t> m_Indices; // Note: Three per triangle
+    std::vector<MaterialId> m_MaterialIds;
+    std::vector<uint32_t> m_TriangleIds; // Note: Index the triangle in every slot was added with
+
+    // Note: Built from the indexed data by build(), slot i holding the
+    // triangle of the i-th BVH leaf slot
+    std::vector<float> m_Vertices[9]; // Note: x, y and z of the first, second and third vertex
+
+    AccelerationStructure m_Accel;
+    bool m_UseAVX2 = false;
+};
@@ -0,0 +1,73 @@
+#include "cpuFeatures.h"
+
+#include <cstdint>
+
+#if SRAY_X64
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+#endif
+
+namespace {
+#if SRAY_X64
+    void cpuid(uint32_t leaf, uint32_t subLeaf, uint32_t regs[4]) {
+    #if defined(_MSC_VER)
+        __cpuidex((int*)regs, (int)leaf, (int)subLeaf);
+    #else
+        __cpuid_count(leaf, subLeaf, regs[0], regs[1], regs[2], regs[3]);
+    #endif
+    }
+
+    uint64_t xgetbv(uint32_t index) {
+    #if defined(_MSC_VER)
+        return _xgetbv(index);
+    #else
+        uint32_t eax = 0;
+        uint32_t edx = 0;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+
+        return ((uint64_t)edx << 32) | eax;
+    #endif
+    }
+#endif
+
+    CPUFeatures detectCPUFeatures() {
+        CPUFeatures features{};
+
+#if SRAY_X64
+        uint32_t regs[4]{};
+        cpuid(0, 0, regs);
+        const uint32_t maxLeaf = regs[0];
+
+        if (maxLeaf < 1) {
+            return features;
+        }
+
+        cpuid(1, 0, regs);
+        features.sse41 = (regs[2] & (1u << 19)) != 0;
+
+        const bool fma = (regs[2] & (1u << 12)) != 0;
+        const bool osxsave = (regs[2] & (1u << 27)) != 0;
+        const bool avx = (regs[2] & (1u << 28)) != 0;
+
+        // Note: The OS must save the YMM registers on context switches,
+        // otherwise AVX instructions fault even if the CPU supports them
+        const bool ymmEnabled = osxsave && (xgetbv(0) & 0x6) == 0x6;
+
+        if (maxLeaf >= 7 && avx && fma && ymmEnabled) {
+            cpuid(7, 0, regs);
+            features.avx2 = (regs[1] & (1u << 5)) != 0;
+        }
+#endif
+
+        return features;
+    }
+}
+
+const CPUFeatures& getCPUFeatures() {
+    static const CPUFeatures features = detectCPUFeatures();
+
+    return features;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define SRAY_X64 1
+#else
+    #define SRAY_X64 0
+#endif
+
+// Note: Kernels for wider instruction sets are marked with a target attribute
+// rather than compiling whole files with different flags, so that inline
+// functions shared with the rest of the program never end up being emitted
+// with instructions the host might not support. Code that should be compiled
+// for the instruction set of its caller is force-inlined into it
+#if defined(_MSC_VER)
+    #define SRAY_TARGET_SSE41
+    #define SRAY_TARGET_AVX2
+    #define SRAY_FORCEINLINE __forceinline
+#else
+    #define SRAY_TARGET_SSE41 __attribute__((target("sse4.1")))
+    #define SRAY_TARGET_AVX2 __attribute__((target("avx2,fma")))
+    #define SRAY_FORCEINLINE inline __attribute__((always_inline))
+#endif
+
+struct CPUFeatures {
+    bool sse41 = false;
+    bool avx2 = false; // Note: Also implies FMA3 and OS support for the YMM registers
+};
+
+const CPUFeatures& getCPUFeatures();
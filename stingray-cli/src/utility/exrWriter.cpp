@@ -0,0 +1,198 @@
+#include "exrWriter.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace {
+    constexpr uint8_t NoCompression = 0;
+    constexpr uint8_t IncreasingY = 0;
+
+    // Note: The format is little endian throughout
+    void appendBytes(std::vector<unsigned char>& buffer, const void* data, size_t size) {
+        const unsigned char* bytes = (const unsigned char*)data;
+        buffer.insert(buffer.end(), bytes, bytes + size);
+    }
+
+    template<typename T>
+    void storeValue(unsigned char* const destination, T value) {
+        std::memcpy(destination, &value, sizeof(T));
+
+        if constexpr (std::endian::native == std::endian::big) {
+            std::reverse(destination, destination + sizeof(T));
+        }
+    }
+
+    template<typename T>
+    void appendValue(std::vector<unsigned char>& buffer, T value) {
+        unsigned char bytes[sizeof(T)];
+        storeValue(bytes, value);
+        appendBytes(buffer, bytes, sizeof(T));
+    }
+
+    void appendString(std::vector<unsigned char>& buffer, const std::string& value) {
+        appendBytes(buffer, value.c_str(), value.size() + 1);
+    }
+
+    void appendAttribute(
+        std::vector<unsigned char>& buffer,
+        const char* name,
+        const char* type,
+        const std::vector<unsigned char>& value) {
+
+        appendString(buffer, name);
+        appendString(buffer, type);
+        appendValue<int32_t>(buffer, (int32_t)value.size());
+        appendBytes(buffer, value.data(), value.size());
+    }
+}
+
+ExrWriter::~ExrWriter() {
+    close();
+}
+
+bool ExrWriter::open(
+    const std::string& path,
+    int width,
+    int height,
+    const std::vector<std::string>& channelNames,
+    const std::vector<ExrPixelType>& channelTypes) {
+
+    close();
+
+    m_File = std::fopen(path.c_str(), "wb");
+
+    if (m_File == nullptr) {
+        return false;
+    }
+
+    m_Width = width;
+    m_Height = height;
+    m_ChannelTypes = channelTypes;
+
+    m_ChannelOrder.resize(channelNames.size());
+
+    for (size_t i = 0; i < channelNames.size(); ++i) {
+        m_ChannelOrder[i] = (int)i;
+    }
+
+    std::sort(m_ChannelOrder.begin(), m_ChannelOrder.end(), [&](int a, int b) {
+        return channelNames[a] < channelNames[b];
+    });
+
+    std::vector<unsigned char> header{};
+    std::vector<unsigned char> value{};
+
+    // Magic number and version 2, single-part scanline
+    appendValue<int32_t>(header, 20000630);
+    appendValue<int32_t>(header, 2);
+
+    for (int channel : m_ChannelOrder) {
+        appendString(value, channelNames[channel]);
+        appendValue<int32_t>(value, (int32_t)channelTypes[channel]);
+        appendValue<uint32_t>(value, 0); // Note: pLinear and 3 reserved bytes
+        appendValue<int32_t>(value, 1); // Note: x and y sampling
+        appendValue<int32_t>(value, 1);
+    }
+
+    value.push_back(0);
+    appendAttribute(header, "channels", "chlist", value);
+
+    appendAttribute(header, "compression", "compression", { NoCompression });
+
+    value.clear();
+    appendValue<int32_t>(value, 0);
+    appendValue<int32_t>(value, 0);
+    appendValue<int32_t>(value, width - 1);
+    appendValue<int32_t>(value, height - 1);
+    appendAttribute(header, "dataWindow", "box2i", value);
+    appendAttribute(header, "displayWindow", "box2i", value);
+
+    appendAttribute(header, "lineOrder", "lineOrder", { IncreasingY });
+
+    value.clear();
+    appendValue<float>(value, 1.0f);
+    appendAttribute(header, "pixelAspectRatio", "float", value);
+    appendAttribute(header, "screenWindowWidth", "float", value);
+
+    value.clear();
+    appendValue<float>(value, 0.0f);
+    appendValue<float>(value, 0.0f);
+    appendAttribute(header, "screenWindowCenter", "v2f", value);
+
+    header.push_back(0);
+
+    // Note: Each scanline chunk is its y coordinate, its data size and then
+    // the row of every channel in sorted order. Both supported pixel types
+    // take 4 bytes
+    const uint64_t rowDataSize = (uint64_t)m_ChannelOrder.size() * width * sizeof(uint32_t);
+    const uint64_t chunkSize = 2 * sizeof(int32_t) + rowDataSize;
+
+    m_FirstRowOffset = header.size() + (uint64_t)height * sizeof(uint64_t);
+
+    for (int y = 0; y < height; ++y) {
+        appendValue<uint64_t>(header, m_FirstRowOffset + y * chunkSize);
+    }
+
+    m_RowBuffer.resize(chunkSize);
+
+    if (std::fwrite(header.data(), 1, header.size(), m_File) != header.size()) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+bool ExrWriter::writeRow(int y, const void* const* channelRows) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    if (m_File == nullptr) {
+        return false;
+    }
+
+    unsigned char* data = m_RowBuffer.data();
+    storeValue<int32_t>(data, y);
+    storeValue<int32_t>(data + sizeof(int32_t), (int32_t)(m_RowBuffer.size() - 2 * sizeof(int32_t)));
+    data += 2 * sizeof(int32_t);
+
+    for (int channel : m_ChannelOrder) {
+        if (m_ChannelTypes[channel] == ExrPixelType::UINT) {
+            const uint32_t* const row = (const uint32_t*)channelRows[channel];
+
+            for (int x = 0; x < m_Width; ++x) {
+                storeValue<uint32_t>(data, row[x]);
+                data += sizeof(uint32_t);
+            }
+        }
+        else {
+            const float* const row = (const float*)channelRows[channel];
+
+            for (int x = 0; x < m_Width; ++x) {
+                storeValue<float>(data, row[x]);
+                data += sizeof(float);
+            }
+        }
+    }
+
+    const uint64_t offset = m_FirstRowOffset + (uint64_t)y * m_RowBuffer.size();
+
+#if defined(_MSC_VER)
+    const bool seeked = _fseeki64(m_File, (int64_t)offset, SEEK_SET) == 0;
+#else
+    const bool seeked = fseeko(m_File, (off_t)offset, SEEK_SET) == 0;
+#endif
+
+    return seeked && std::fwrite(m_RowBuffer.data(), 1, m_RowBuffer.size(), m_File) == m_RowBuffer.size();
+}
+
+bool ExrWriter::close() {
+    if (m_File == nullptr) {
+        return true;
+    }
+
+    const bool closed = std::fclose(m_File) == 0;
+    m_File = nullptr;
+
+    return closed;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Note: Pixel types of a channel, with the values the format uses for them.
+// Half floats are not supported
+enum class ExrPixelType : int32_t {
+    UINT = 0,
+    FLOAT = 2
+};
+
+// Note: Minimal single-part OpenEXR writer for uncompressed scanline images
+// with 32-bit float and unsigned int channels. Since every scanline has the
+// same size, the offset table is written up front and rows can then be
+// written in any order, and more than once, as soon as they are available.
+// Only a single row is ever buffered
+class ExrWriter {
+public:
+    ExrWriter() = default;
+    ~ExrWriter();
+
+    ExrWriter(const ExrWriter&) = delete;
+    ExrWriter& operator=(const ExrWriter&) = delete;
+
+    // Note: Writes the header and offset table, returns false if the file
+    // could not be written. channelTypes holds the pixel type of every channel
+    bool open(
+        const std::string& path,
+        int width,
+        int height,
+        const std::vector<std::string>& channelNames,
+        const std::vector<ExrPixelType>& channelTypes);
+
+    // Note: channelRows holds one row pointer per channel, in the order the
+    // channels were given to open(), pointing to floats or uint32_t values
+    // depending on the type of the channel. Can be called from multiple threads
+    bool writeRow(int y, const void* const* channelRows);
+
+    // Note: Returns false if the buffered rows could not be flushed
+    bool close();
+
+    inline bool isOpen() const { return m_File != nullptr; }
+
+private:
+    std::FILE* m_File = nullptr;
+    std::mutex m_Mutex;
+    int m_Width = 0;
+    int m_Height = 0;
+    uint64_t m_FirstRowOffset = 0;
+    std::vector<int> m_ChannelOrder; // Note: Channels sorted by name, as the format requires
+    std::vector<ExrPixelType> m_ChannelTypes;
+    std::vector<unsigned char> m_RowBuffer;
+};
@@ -1,7 +1,9 @@
 #include "perfTimer.h"
 
 double PerfTimer::getElapsedTime() const {
-    return std::chrono::duration_cast<std::chrono::milliseconds>(
+    // Note: Fractional milliseconds, so that short timings such as BVH
+    // builds do not round down to zero
+    return std::chrono::duration<double, std::milli>(
         endTime - beginTime
     ).count();
 }
@@ -1,6 +1,17 @@
 #pragma once
 
+#include "cpuFeatures.h"
+
 #include <chrono>
+#include <cstdint>
+
+#if SRAY_X64
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #else
+        #include <x86intrin.h>
+    #endif
+#endif
 
 class PerfTimer {
     public:
@@ -15,3 +26,16 @@ class PerfTimer {
         std::chrono::time_point<std::chrono::high_resolution_clock> beginTime{};
         std::chrono::time_point<std::chrono::high_resolution_clock> endTime{};
 };
+
+// Note: Cheap timestamp for measuring short spans of code, in time stamp
+// counter ticks on x64 and in nanoseconds elsewhere. Only differences taken
+// on the same thread are meaningful
+inline uint64_t readCycleCounter() {
+#if SRAY_X64
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+#endif
+}
@@ -0,0 +1,70 @@
+#include "threadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int numThreads) {
+    numThreads = std::max(numThreads, 1);
+    m_Threads.reserve(numThreads);
+
+    for (int i = 0; i < numThreads; ++i) {
+        m_Threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stopping = true;
+    }
+
+    m_JobAvailable.notify_all();
+
+    for (auto& thread : m_Threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+void ThreadPool::run(const std::function<void(int)>& job) {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+
+    m_Job = &job;
+    m_ActiveWorkers = (int)m_Threads.size();
+    ++m_Generation;
+
+    m_JobAvailable.notify_all();
+    m_JobFinished.wait(lock, [this]() { return m_ActiveWorkers == 0; });
+
+    m_Job = nullptr;
+}
+
+void ThreadPool::workerLoop(int workerIndex) {
+    uint64_t lastGeneration = 0;
+
+    while (true) {
+        const std::function<void(int)>* job = nullptr;
+
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_JobAvailable.wait(lock, [&]() { return m_Stopping || m_Generation != lastGeneration; });
+
+            if (m_Stopping) {
+                return;
+            }
+
+            lastGeneration = m_Generation;
+            job = m_Job;
+        }
+
+        (*job)(workerIndex);
+
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+
+            if (--m_ActiveWorkers == 0) {
+                m_JobFinished.notify_one();
+            }
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Note: Persistent set of worker threads that is created once and reused
+// for every job, so that back-to-back renders pay no thread startup cost
+class ThreadPool {
+public:
+    explicit ThreadPool(int numThreads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Note: Runs job(workerIndex) once on every worker and blocks until all
+    // workers have returned from it. Not reentrant
+    void run(const std::function<void(int)>& job);
+
+    inline int getNumThreads() const { return (int)m_Threads.size(); }
+
+private:
+    void workerLoop(int workerIndex);
+
+    std::vector<std::thread> m_Threads;
+    std::mutex m_Mutex;
+    std::condition_variable m_JobAvailable;
+    std::condition_variable m_JobFinished;
+    const std::function<void(int)>* m_Job = nullptr;
+    uint64_t m_Generation = 0;
+    int m_ActiveWorkers = 0;
+    bool m_Stopping = false;
+};
+
+// Note: Runs func(worker, begin, end) on one chunk of [0, count) per worker
+// of the pool, or func(0, 0, count) on the calling thread without a pool
+template<typename Func>
+void parallelFor(ThreadPool* const threadPool, uint32_t count, Func&& func) {
+    if (threadPool == nullptr) {
+        func(0, 0, count);
+        return;
+    }
+
+    const uint64_t numWorkers = (uint64_t)threadPool->getNumThreads();
+
+    threadPool->run([&](int worker) {
+        const uint32_t begin = (uint32_t)(count * worker / numWorkers);
+        const uint32_t end = (uint32_t)(count * (worker + 1) / numWorkers);
+
+        func(worker, begin, end);
+    });
+}
@@ -0,0 +1,118 @@
+#include "wideBvh.h"
+
+template<int Width>
+void WideBVH<Width>::build(const BVH& bvh) {
+    m_Nodes.clear();
+    m_SourceNodes.clear();
+
+    if (bvh.isEmpty()) {
+        return;
+    }
+
+    m_Nodes.reserve(bvh.getNodeCount() / (Width - 1) + 1);
+    m_SourceNodes.reserve(m_Nodes.capacity() * Width);
+    collapseNode(bvh, 0);
+    m_Nodes.shrink_to_fit();
+    m_SourceNodes.shrink_to_fit();
+}
+
+template<int Width>
+void WideBVH<Width>::refit(const BVH& bvh) {
+    const std::vector<BVHNode>& binaryNodes = bvh.getNodes();
+
+    for (size_t nodeIndex = 0; nodeIndex < m_Nodes.size(); ++nodeIndex) {
+        WideBVHNode<Width>& node = m_Nodes[nodeIndex];
+
+        for (int i = 0; i < Width; ++i) {
+            if (node.children[i] == EmptyChild) {
+                continue;
+            }
+
+            const BVHNode& binaryNode = binaryNodes[m_SourceNodes[nodeIndex * Width + i]];
+            node.minX[i] = binaryNode.boundsMin.x;
+            node.minY[i] = binaryNode.boundsMin.y;
+            node.minZ[i] = binaryNode.boundsMin.z;
+            node.maxX[i] = binaryNode.boundsMax.x;
+            node.maxY[i] = binaryNode.boundsMax.y;
+            node.maxZ[i] = binaryNode.boundsMax.z;
+        }
+    }
+}
+
+template<int Width>
+uint32_t WideBVH<Width>::collapseNode(const BVH& bvh, uint32_t binaryIndex) {
+    const std::vector<BVHNode>& binaryNodes = bvh.getNodes();
+
+    const auto getArea = [&](uint32_t index) {
+        return AABB{ binaryNodes[index].boundsMin, binaryNodes[index].boundsMax }.surfaceArea();
+    };
+
+    // Gather up to Width binary nodes by repeatedly opening the interior
+    // node with the largest surface area, as it is the most likely to be hit
+    uint32_t slots[Width]{};
+    int slotCount = 0;
+
+    if (binaryNodes[binaryIndex].isLeaf()) {
+        slots[slotCount++] = binaryIndex;
+    }
+    else {
+        slots[slotCount++] = binaryIndex + 1;
+        slots[slotCount++] = binaryNodes[binaryIndex + 1].skipIndex;
+    }
+
+    while (slotCount < Width) {
+        int bestSlot = -1;
+        float bestArea = -1.0f;
+
+        for (int i = 0; i < slotCount; ++i) {
+            if (!binaryNodes[slots[i]].isLeaf() && getArea(slots[i]) > bestArea) {
+                bestSlot = i;
+                bestArea = getArea(slots[i]);
+            }
+        }
+
+        if (bestSlot == -1) {
+            break;
+        }
+
+        const uint32_t opened = slots[bestSlot];
+        slots[bestSlot] = opened + 1;
+        slots[slotCount++] = binaryNodes[opened + 1].skipIndex;
+    }
+
+    const uint32_t nodeIndex = (uint32_t)m_Nodes.size();
+    m_Nodes.emplace_back();
+    m_SourceNodes.resize(m_SourceNodes.size() + Width, 0);
+
+    for (int i = 0; i < Width; ++i) {
+        WideBVHNode<Width>& node = m_Nodes[nodeIndex];
+
+        if (i >= slotCount) {
+            node.minX[i] = node.minY[i] = node.minZ[i] = Infinity;
+            node.maxX[i] = node.maxY[i] = node.maxZ[i] = -Infinity;
+            node.children[i] = EmptyChild;
+            continue;
+        }
+
+        const BVHNode& binaryNode = binaryNodes[slots[i]];
+        m_SourceNodes[nodeIndex * Width + i] = slots[i];
+        node.minX[i] = binaryNode.boundsMin.x;
+        node.minY[i] = binaryNode.boundsMin.y;
+        node.minZ[i] = binaryNode.boundsMin.z;
+        node.maxX[i] = binaryNode.boundsMax.x;
+        node.maxY[i] = binaryNode.boundsMax.y;
+        node.maxZ[i] = binaryNode.boundsMax.z;
+
+        // Note: Collapsing the child may grow m_Nodes, so the reference to
+        // the current node is only taken again once it has returned
+        const uint32_t child = binaryNode.isLeaf() ?
+            binaryNode.primData : (collapseNode(bvh, slots[i]) << 4);
+
+        m_Nodes[nodeIndex].children[i] = child;
+    }
+
+    return nodeIndex;
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
@@ -0,0 +1,322 @@
+#pragma once
+
+#include "bvh.h"
+#include "utility/cpuFeatures.h"
+
+#include <bit>
+#include <vector>
+
+#if SRAY_X64
+    #include <immintrin.h>
+#endif
+
+// Note: Child slots use the same encoding as BVHNode::primData, i.e.
+// (firstPrim << 4) | primCount for leaves and (nodeIndex << 4) for interior
+// nodes. The root is never a child, so zero marks an empty slot
+template<int Width>
+struct alignas(64) WideBVHNode {
+    float minX[Width];
+    float minY[Width];
+    float minZ[Width];
+    float maxX[Width];
+    float maxY[Width];
+    float maxZ[Width];
+    uint32_t children[Width];
+};
+
+constexpr uint32_t EmptyChild = 0;
+
+inline bool isLeafChild(uint32_t child) { return (child & 0xf) != 0; }
+
+// Note: Ray data shared by all children of a node. The near plane of every
+// slab is selected from the direction sign, which also makes empty slots
+// (stored as inverted infinite boxes) always miss
+struct WideRay {
+    Vec3 invDir{};
+    Vec3 originInvDir{};
+    bool dirNegative[3]{};
+};
+
+inline WideRay makeWideRay(const Ray& ray) {
+    WideRay wideRay{};
+    wideRay.invDir = safeInverse(ray.dir);
+    wideRay.originInvDir = ray.origin * wideRay.invDir;
+
+    // Note: Taken from the reciprocal rather than the direction, so that a
+    // negative zero component selects the planes matching the sign that
+    // safeInverse() gave it. The reciprocal is never zero, which keeps the
+    // comparison reliable even where -ffast-math ignores signed zeros
+    wideRay.dirNegative[0] = wideRay.invDir.x < 0.0f;
+    wideRay.dirNegative[1] = wideRay.invDir.y < 0.0f;
+    wideRay.dirNegative[2] = wideRay.invDir.z < 0.0f;
+
+    return wideRay;
+}
+
+// Note: Wide BVH built by collapsing a binary BVH, so that a single SIMD slab
+// test covers all children of a node. Leaves reference the same primitive
+// slots as the binary BVH it was built from
+template<int Width>
+class WideBVH {
+public:
+    WideBVH() = default;
+    ~WideBVH() = default;
+
+    void build(const BVH& bvh);
+
+    // Note: Copies the bounds of the binary nodes the child slots were
+    // collapsed from, after the BVH this was built from has been refit
+    void refit(const BVH& bvh);
+
+    // Note: See BVH::intersect() for the callback signature. Must be called
+    // from a function compiled for the instruction set matching Width
+    template<typename IntersectFunc>
+    SRAY_FORCEINLINE bool intersect(const Ray& ray, float tMin, float tMax, IntersectFunc&& intersectPrims) const;
+
+    // Note: See BVH::occluded() for the callback signature
+    template<typename OccludedFunc>
+    SRAY_FORCEINLINE bool occluded(const Ray& ray, float tMin, float tMax, OccludedFunc&& occludedPrims) const;
+
+    inline bool isEmpty() const { return m_Nodes.empty(); }
+    inline size_t getNodeCount() const { return m_Nodes.size(); }
+
+private:
+    struct StackEntry {
+        uint32_t child;
+        float tNear;
+    };
+
+    // Note: Every visited node pushes at most Width - 1 entries beyond the
+    // one it replaces, and the wide tree is never deeper than the binary one
+    static constexpr int StackSize = 128 * (Width - 1) + Width;
+
+    uint32_t collapseNode(const BVH& bvh, uint32_t binaryIndex);
+
+    std::vector<WideBVHNode<Width>> m_Nodes;
+
+    // Cold data
+    std::vector<uint32_t> m_SourceNodes; // Note: Binary node of every child slot, Width per node
+};
+
+/* Node Intersection */
+#if SRAY_X64
+SRAY_TARGET_SSE41 inline uint32_t intersectWideNode(
+    const WideBVHNode<4>& node,
+    const WideRay& ray,
+    float tMin,
+    float tMax,
+    float* const tNear) {
+
+    const __m128 nearX = _mm_load_ps(ray.dirNegative[0] ? node.maxX : node.minX);
+    const __m128 nearY = _mm_load_ps(ray.dirNegative[1] ? node.maxY : node.minY);
+    const __m128 nearZ = _mm_load_ps(ray.dirNegative[2] ? node.maxZ : node.minZ);
+    const __m128 farX = _mm_load_ps(ray.dirNegative[0] ? node.minX : node.maxX);
+    const __m128 farY = _mm_load_ps(ray.dirNegative[1] ? node.minY : node.maxY);
+    const __m128 farZ = _mm_load_ps(ray.dirNegative[2] ? node.minZ : node.maxZ);
+
+    const __m128 invDirX = _mm_set1_ps(ray.invDir.x);
+    const __m128 invDirY = _mm_set1_ps(ray.invDir.y);
+    const __m128 invDirZ = _mm_set1_ps(ray.invDir.z);
+    const __m128 originInvDirX = _mm_set1_ps(ray.originInvDir.x);
+    const __m128 originInvDirY = _mm_set1_ps(ray.originInvDir.y);
+    const __m128 originInvDirZ = _mm_set1_ps(ray.originInvDir.z);
+
+    const __m128 tNearX = _mm_sub_ps(_mm_mul_ps(nearX, invDirX), originInvDirX);
+    const __m128 tNearY = _mm_sub_ps(_mm_mul_ps(nearY, invDirY), originInvDirY);
+    const __m128 tNearZ = _mm_sub_ps(_mm_mul_ps(nearZ, invDirZ), originInvDirZ);
+    const __m128 tFarX = _mm_sub_ps(_mm_mul_ps(farX, invDirX), originInvDirX);
+    const __m128 tFarY = _mm_sub_ps(_mm_mul_ps(farY, invDirY), originInvDirY);
+    const __m128 tFarZ = _mm_sub_ps(_mm_mul_ps(farZ, invDirZ), originInvDirZ);
+
+    const __m128 tEntry = _mm_max_ps(_mm_max_ps(tNearX, tNearY), _mm_max_ps(tNearZ, _mm_set1_ps(tMin)));
+    const __m128 tExit = _mm_min_ps(_mm_min_ps(tFarX, tFarY), _mm_min_ps(tFarZ, _mm_set1_ps(tMax)));
+
+    _mm_storeu_ps(tNear, tEntry);
+
+    return (uint32_t)_mm_movemask_ps(_mm_cmple_ps(tEntry, tExit));
+}
+
+SRAY_TARGET_AVX2 inline uint32_t intersectWideNode(
+    const WideBVHNode<8>& node,
+    const WideRay& ray,
+    float tMin,
+    float tMax,
+    float* const tNear) {
+
+    const __m256 nearX = _mm256_load_ps(ray.dirNegative[0] ? node.maxX : node.minX);
+    const __m256 nearY = _mm256_load_ps(ray.dirNegative[1] ? node.maxY : node.minY);
+    const __m256 nearZ = _mm256_load_ps(ray.dirNegative[2] ? node.maxZ : node.minZ);
+    const __m256 farX = _mm256_load_ps(ray.dirNegative[0] ? node.minX : node.maxX);
+    const __m256 farY = _mm256_load_ps(ray.dirNegative[1] ? node.minY : node.maxY);
+    const __m256 farZ = _mm256_load_ps(ray.dirNegative[2] ? node.minZ : node.maxZ);
+
+    const __m256 invDirX = _mm256_set1_ps(ray.invDir.x);
+    const __m256 invDirY = _mm256_set1_ps(ray.invDir.y);
+    const __m256 invDirZ = _mm256_set1_ps(ray.invDir.z);
+    const __m256 originInvDirX = _mm256_set1_ps(ray.originInvDir.x);
+    const __m256 originInvDirY = _mm256_set1_ps(ray.originInvDir.y);
+    const __m256 originInvDirZ = _mm256_set1_ps(ray.originInvDir.z);
+
+    const __m256 tNearX = _mm256_fmsub_ps(nearX, invDirX, originInvDirX);
+    const __m256 tNearY = _mm256_fmsub_ps(nearY, invDirY, originInvDirY);
+    const __m256 tNearZ = _mm256_fmsub_ps(nearZ, invDirZ, originInvDirZ);
+    const __m256 tFarX = _mm256_fmsub_ps(farX, invDirX, originInvDirX);
+    const __m256 tFarY = _mm256_fmsub_ps(farY, invDirY, originInvDirY);
+    const __m256 tFarZ = _mm256_fmsub_ps(farZ, invDirZ, originInvDirZ);
+
+    const __m256 tEntry = _mm256_max_ps(_mm256_max_ps(tNearX, tNearY), _mm256_max_ps(tNearZ, _mm256_set1_ps(tMin)));
+    const __m256 tExit = _mm256_min_ps(_mm256_min_ps(tFarX, tFarY), _mm256_min_ps(tFarZ, _mm256_set1_ps(tMax)));
+
+    _mm256_storeu_ps(tNear, tEntry);
+
+    return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(tEntry, tExit, _CMP_LE_OQ));
+}
+#else
+template<int Width>
+inline uint32_t intersectWideNode(
+    const WideBVHNode<Width>& node,
+    const WideRay& ray,
+    float tMin,
+    float tMax,
+    float* const tNear) {
+
+    uint32_t mask = 0;
+
+    for (int i = 0; i < Width; ++i) {
+        const AABB box = {
+            { node.minX[i], node.minY[i], node.minZ[i] },
+            { node.maxX[i], node.maxY[i], node.maxZ[i] }
+        };
+        const Vec3 origin = ray.originInvDir / ray.invDir;
+
+        tNear[i] = intersectAABB(box, origin, ray.invDir, tMin, tMax);
+        mask |= (tNear[i] != Infinity) ? (1u << i) : 0u;
+    }
+
+    return mask;
+}
+#endif
+
+template<int Width>
+template<typename IntersectFunc>
+SRAY_FORCEINLINE bool WideBVH<Width>::intersect(const Ray& ray, float tMin, float tMax, IntersectFunc&& intersectPrims) const {
+    if (m_Nodes.empty()) {
+        return false;
+    }
+
+    const WideRay wideRay = makeWideRay(ray);
+    float closestT = tMax;
+    bool anyHit = false;
+
+    StackEntry stack[StackSize];
+    int stackSize = 0;
+    uint32_t nodeIndex = 0;
+
+    while (true) {
+        const WideBVHNode<Width>& node = m_Nodes[nodeIndex];
+        SRAY_COUNT(bvhNodesVisited, 1);
+        alignas(32) float tNear[Width];
+        uint32_t hitMask = intersectWideNode(node, wideRay, tMin, closestT, tNear);
+
+        // Push the children sorted far to near, so that the nearest child
+        // is popped first and shrinks closestT as early as possible
+        const int stackBase = stackSize;
+
+        while (hitMask != 0) {
+            const int i = std::countr_zero(hitMask);
+            hitMask &= hitMask - 1;
+
+            const StackEntry entry = { node.children[i], tNear[i] };
+            int j = stackSize++;
+
+            while (j > stackBase && stack[j - 1].tNear < entry.tNear) {
+                stack[j] = stack[j - 1];
+                --j;
+            }
+
+            stack[j] = entry;
+        }
+
+        bool foundNode = false;
+
+        while (stackSize > 0) {
+            const StackEntry entry = stack[--stackSize];
+
+            if (entry.tNear > closestT) {
+                continue;
+            }
+
+            if (!isLeafChild(entry.child)) {
+                nodeIndex = entry.child >> 4;
+                foundNode = true;
+                break;
+            }
+
+            SRAY_COUNT(bvhNodesVisited, 1);
+
+            if (intersectPrims(entry.child >> 4, entry.child & 0xf, closestT)) {
+                anyHit = true;
+            }
+        }
+
+        if (!foundNode) {
+            break;
+        }
+    }
+
+    return anyHit;
+}
+
+template<int Width>
+template<typename OccludedFunc>
+SRAY_FORCEINLINE bool WideBVH<Width>::occluded(const Ray& ray, float tMin, float tMax, OccludedFunc&& occludedPrims) const {
+    if (m_Nodes.empty()) {
+        return false;
+    }
+
+    const WideRay wideRay = makeWideRay(ray);
+
+    // Note: Any hit ends the search, so the children are pushed in mask
+    // order and the entry distances are not needed
+    uint32_t stack[StackSize];
+    int stackSize = 0;
+    uint32_t nodeIndex = 0;
+
+    while (true) {
+        const WideBVHNode<Width>& node = m_Nodes[nodeIndex];
+        SRAY_COUNT(bvhNodesVisited, 1);
+        alignas(32) float tNear[Width];
+        uint32_t hitMask = intersectWideNode(node, wideRay, tMin, tMax, tNear);
+
+        while (hitMask != 0) {
+            const int i = std::countr_zero(hitMask);
+            hitMask &= hitMask - 1;
+
+            stack[stackSize++] = node.children[i];
+        }
+
+        bool foundNode = false;
+
+        while (stackSize > 0) {
+            const uint32_t child = stack[--stackSize];
+
+            if (!isLeafChild(child)) {
+                nodeIndex = child >> 4;
+                foundNode = true;
+                break;
+            }
+
+            SRAY_COUNT(bvhNodesVisited, 1);
+
+            if (occludedPrims(child >> 4, child & 0xf)) {
+                return true;
+            }
+        }
+
+        if (!foundNode) {
+            break;
+        }
+    }
+
+    return false;
+}